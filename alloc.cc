@@ -23,6 +23,12 @@ size_t ici_mem_limit;
 size_t ici_n_allocs;
 size_t ici_alloc_mem;
 
+/*
+ * Copy-on-write sharing counts. See shared_store in alloc.h.
+ */
+size_t cow_shared;
+size_t cow_split;
+
 #if !ICI_ALLALLOC
 
 /*
@@ -303,4 +309,40 @@ void drop_all_small_allocations()
 #endif /* ICI_ALLALLOC */
 }
 
+/*
+ * Share storage with one more object. The storage is that of the given
+ * record or, if there is no record because the storage is not yet shared,
+ * the allocation 'base' of 'size' bytes. Returns the record, or nullptr on
+ * error, usual conventions.
+ */
+shared_store *share_store(shared_store *ss, void *base, size_t size)
+{
+    if (ss == nullptr)
+    {
+        if ((ss = ici_talloc(shared_store)) == nullptr)
+        {
+            return nullptr;
+        }
+        ss->ss_nrefs = 1;
+        ss->ss_base = base;
+        ss->ss_size = size;
+    }
+    ++ss->ss_nrefs;
+    ++cow_shared;
+    return ss;
+}
+
+/*
+ * Release an object's use of shared storage, freeing the storage if
+ * that was the last use.
+ */
+void release_store(shared_store *ss)
+{
+    if (--ss->ss_nrefs == 0)
+    {
+        ici_nfree(ss->ss_base, ss->ss_size);
+        ici_tfree(ss, shared_store);
+    }
+}
+
 } // namespace ici
@@ -59,6 +59,34 @@ template <typename T> void ici_tfree(void *p)
     ici_nfree(p, sizeof(T));
 }
 
+/*
+ * Copies of large maps and arrays share the storage of the original (its
+ * slots or element pointers), copy-on-write, until one of them is to be
+ * modified. Then that one splits off its own copy of the storage. A
+ * shared_store records how many objects are using the storage and its
+ * allocation, so the last to release it can free it.
+ *
+ * cow_shared counts the copies made by sharing and cow_split counts the
+ * splits. A copy that is never written, nor its original, never splits.
+ *
+ * Only maps with more than COW_MIN_SLOTS slots, and arrays with more than
+ * as many elements, are shared. Smaller ones, such as the autos copied by
+ * each function call, are copied as they are almost always written.
+ */
+constexpr size_t COW_MIN_SLOTS = 64;
+
+struct shared_store
+{
+    size_t ss_nrefs;
+    void  *ss_base;
+    size_t ss_size;
+};
+
+extern size_t        cow_shared;
+extern size_t        cow_split;
+extern shared_store *share_store(shared_store *, void *, size_t);
+extern void          release_store(shared_store *);
+
 /*
  * End of ici.h export. --ici.h-end--
  */
@@ -0,0 +1,424 @@
+#define ICI_CORE
+#include "archive.h"
+#include "archiver.h"
+#include "array.h"
+#include "forall.h"
+#include "fwd.h"
+#include "int.h"
+#include "map.h"
+#include "null.h"
+#include "str.h"
+
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Lazily restored archives
+ *
+ * An indexed archive, written by msave(), holds a map or array, the
+ * archive's root, as a sequence of individually restorable elements
+ * followed by an index of their offsets. mrestore() maps such an
+ * archive into memory, reads its index and returns an archive object.
+ *
+ * An archive object may be used in place of the root object. Fetching
+ * an element restores it from the mapping, once, and forall restores
+ * elements as it visits them. Elements never used are never restored,
+ * so opening even a very large archive is cheap.
+ *
+ * Objects shared between elements are restored once and shared as
+ * they were when saved.
+ *
+ * This --intro-- and --synopsis-- are part of --ici-serialisation-- documentation.
+ */
+
+namespace ici
+{
+
+namespace
+{
+
+/*
+ * Restore the value for key 'k' if it has not yet been restored.
+ */
+int materialize(archive *a, object *k)
+{
+    if (isint(k) && isarray(a->a_values) && intof(k)->i_value < 0)
+    {
+        auto i = make_ref(new_int(intof(k)->i_value + arrayof(a->a_values)->len()));
+        return i == nullptr || materialize(a, i);
+    }
+    auto ofs = a->a_pending->fetch(k);
+    if (ofs == null)
+    {
+        return 0;
+    }
+    archiver ar(a->a_base, a->a_size, a, a->a_sent, a->a_scope);
+    if (!ar)
+    {
+        return 1;
+    }
+    ref<> v = ar.restore_at(size_t(intof(ofs)->i_value));
+    if (!v)
+    {
+        return 1;
+    }
+    if (ici_assign_base(a->a_values, k, v))
+    {
+        return 1;
+    }
+    return unassign(a->a_pending, k);
+}
+
+int materialize_all(archive *a)
+{
+    while (a->a_pending->s_nels > 0)
+    {
+        auto s = a->a_pending;
+        for (auto sl = s->s_slots; sl < s->s_slots + s->s_nslots; ++sl)
+        {
+            if (sl->sl_key)
+            {
+                if (materialize(a, sl->sl_key))
+                {
+                    return 1;
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Read the archive's index, creating the root object and recording
+ * the offsets of its elements.
+ */
+int read_index(archive *a, size_t index_ofs)
+{
+    archiver ar(a->a_base, a->a_size, a, a->a_sent, a->a_scope);
+    uint8_t  tcode;
+    int64_t  super_ofs;
+    int64_t  n;
+
+    if (!ar || ar.seek(index_ofs) || ar.read(&tcode) || ar.read(&super_ofs) || ar.read(&n))
+    {
+        return 1;
+    }
+    /*
+     * Each element has an entry in the index, of at least a byte for
+     * each offset, which must fit between here and the trailer.
+     */
+    const size_t entryz = tcode == TC_MAP ? 2 : 1;
+    const size_t end = a->a_size - ARCHIVE_TRAILERZ;
+    const size_t pos = ar.position();
+    if ((tcode != TC_MAP && tcode != TC_ARRAY) || n < 0 || pos > end || uint64_t(n) > (end - pos) / entryz)
+    {
+        return set_error("invalid archive index");
+    }
+    if (tcode == TC_MAP)
+    {
+        auto m = new_map();
+        if (!m)
+        {
+            return 1;
+        }
+        a->a_values = m;
+        decref(m);
+        if (super_ofs != 0)
+        {
+            ref<> super = ar.restore_at(size_t(super_ofs));
+            if (!super)
+            {
+                return 1;
+            }
+            if (!hassuper(super))
+            {
+                return set_error("invalid archive index");
+            }
+            m->o_super = objwsupof(super);
+            if (ar.seek(index_ofs) || ar.read(&tcode) || ar.read(&super_ofs) || ar.read(&n))
+            {
+                return 1;
+            }
+        }
+    }
+    else
+    {
+        auto v = new_array(n);
+        if (!v)
+        {
+            return 1;
+        }
+        a->a_values = v;
+        decref(v);
+    }
+    for (int64_t i = 0; i < n; ++i)
+    {
+        int64_t key_ofs;
+        int64_t value_ofs;
+        ref<>   key;
+
+        if (tcode == TC_MAP)
+        {
+            if (ar.read(&key_ofs) || ar.read(&value_ofs))
+            {
+                return 1;
+            }
+            const auto pos = ar.position();
+            if (!(key = ar.restore_at(size_t(key_ofs))) || ar.seek(pos))
+            {
+                return 1;
+            }
+            if (ici_assign_base(a->a_values, key, null))
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            if (ar.read(&value_ofs))
+            {
+                return 1;
+            }
+            if (!(key = new_int(i)) || arrayof(a->a_values)->push_back(null))
+            {
+                return 1;
+            }
+        }
+        auto ofs = make_ref(new_int(value_ofs));
+        if (!ofs || ici_assign(a->a_pending, key, ofs))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+/*
+ * Map the indexed archive in the named file and return a new archive
+ * object for it. The scope is used when restoring functions, as per
+ * restore().
+ *
+ * Returns nullptr on error, usual conventions.
+ */
+archive *new_archive(const char *path, objwsup *scope)
+{
+    struct stat statbuf;
+    size_t      size;
+    void       *base;
+    archive    *a;
+
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        get_last_errno("open", path);
+        return nullptr;
+    }
+    if (fstat(fd, &statbuf) == -1)
+    {
+        get_last_errno("fstat", path);
+        close(fd);
+        return nullptr;
+    }
+    size = size_t(statbuf.st_size);
+    if (size < sizeof ARCHIVE_INDEXED_MAGIC + 1 + ARCHIVE_TRAILERZ)
+    {
+        close(fd);
+        set_error("%s: not an indexed archive", path);
+        return nullptr;
+    }
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        get_last_errno("mmap", path);
+        return nullptr;
+    }
+
+    auto p = static_cast<const uint8_t *>(base);
+    auto trailer = p + size - ARCHIVE_TRAILERZ;
+    if (memcmp(p, ARCHIVE_INDEXED_MAGIC, sizeof ARCHIVE_INDEXED_MAGIC) != 0
+        || memcmp(trailer + 8, ARCHIVE_INDEXED_MAGIC, sizeof ARCHIVE_INDEXED_MAGIC) != 0)
+    {
+        munmap(base, size);
+        set_error("%s: not an indexed archive", path);
+        return nullptr;
+    }
+    if (p[sizeof ARCHIVE_INDEXED_MAGIC] != ARCHIVE_VERSION)
+    {
+        munmap(base, size);
+        set_error("%s: unsupported archive version %d", path, p[sizeof ARCHIVE_INDEXED_MAGIC]);
+        return nullptr;
+    }
+    uint64_t index_ofs = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        index_ofs |= uint64_t(trailer[i]) << (8 * i);
+    }
+    if (index_ofs >= size - ARCHIVE_TRAILERZ)
+    {
+        munmap(base, size);
+        set_error("%s: invalid archive index", path);
+        return nullptr;
+    }
+
+    if ((a = ici_talloc(archive)) == nullptr)
+    {
+        munmap(base, size);
+        return nullptr;
+    }
+    if ((a->a_sent = ici_talloc(archive_refs)) == nullptr)
+    {
+        ici_tfree(a, archive);
+        munmap(base, size);
+        return nullptr;
+    }
+    new (a->a_sent) archive_refs;
+    set_tfnz(a, TC_ARCHIVE, 0, 1, 0);
+    a->a_base = base;
+    a->a_size = size;
+    a->a_scope = scope;
+    a->a_values = nullptr;
+    a->a_pending = nullptr;
+    rego(a);
+    if ((a->a_pending = new_map()) == nullptr)
+    {
+        decref(a);
+        return nullptr;
+    }
+    decref(a->a_pending);
+    if (read_index(a, size_t(index_ofs)))
+    {
+        decref(a);
+        return nullptr;
+    }
+    return a;
+}
+
+size_t archive_type::mark(object *o)
+{
+    auto a = archiveof(o);
+    return type::mark(o) + mark_optional(a->a_scope) + mark_optional(a->a_values) + mark_optional(a->a_pending) +
+           a->a_sent->mark_values();
+}
+
+void archive_type::free(object *o)
+{
+    munmap(archiveof(o)->a_base, archiveof(o)->a_size);
+    archiveof(o)->a_sent->~archive_refs();
+    ici_tfree(archiveof(o)->a_sent, archive_refs);
+    type::free(o);
+}
+
+object *archive_type::copy(object *o)
+{
+    if (materialize_all(archiveof(o)))
+    {
+        return nullptr;
+    }
+    return copyof(archiveof(o)->a_values);
+}
+
+int archive_type::assign(object *o, object *k, object *v)
+{
+    auto a = archiveof(o);
+    if (unassign(a->a_pending, k))
+    {
+        return 1;
+    }
+    return ici_assign(a->a_values, k, v);
+}
+
+object *archive_type::fetch(object *o, object *k)
+{
+    auto a = archiveof(o);
+    if (materialize(a, k))
+    {
+        return nullptr;
+    }
+    return ici_fetch(a->a_values, k);
+}
+
+/*
+ * Restore the element the root's forall will visit next and then have
+ * the root's type perform the step.
+ */
+int archive_type::forall(object *o)
+{
+    auto fa = forallof(o);
+    auto a = archiveof(fa->fa_aggr);
+
+    if (ismap(a->a_values))
+    {
+        auto m = mapof(a->a_values);
+        for (auto i = fa->fa_index + 1; i < m->s_nslots; ++i)
+        {
+            if (auto k = m->s_slots[i].sl_key)
+            {
+                if (materialize(a, k))
+                {
+                    return 1;
+                }
+                break;
+            }
+        }
+    }
+    else
+    {
+        auto i = fa->fa_index + 1;
+        if (i < size_t(arrayof(a->a_values)->len()))
+        {
+            auto k = make_ref(new_int(int64_t(i)));
+            if (!k || materialize(a, k))
+            {
+                return 1;
+            }
+        }
+    }
+    incref(a);
+    fa->fa_aggr = a->a_values;
+    auto rc = a->a_values->icitype()->forall(fa);
+    fa->fa_aggr = a;
+    decref(a);
+    return rc;
+}
+
+int archive_type::nkeys(object *o)
+{
+    return archiveof(o)->a_values->icitype()->nkeys(archiveof(o)->a_values);
+}
+
+int archive_type::keys(object *o, array *k)
+{
+    return archiveof(o)->a_values->icitype()->keys(archiveof(o)->a_values, k);
+}
+
+/*
+ * An archive is saved as the, fully restored, root object and so is
+ * restored as that object.
+ */
+int archive_type::save(archiver *ar, object *o)
+{
+    if (materialize_all(archiveof(o)))
+    {
+        return 1;
+    }
+    return ar->save(archiveof(o)->a_values);
+}
+
+object *archive_type::restore(archiver *ar)
+{
+    return ar->restore();
+}
+
+int64_t archive_type::len(object *o)
+{
+    return archiveof(o)->a_values->icitype()->len(archiveof(o)->a_values);
+}
+
+} // namespace ici
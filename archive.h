@@ -0,0 +1,75 @@
+// -*- mode:c++ -*-
+
+#ifndef ICI_ARCHIVE_OBJ_H
+#define ICI_ARCHIVE_OBJ_H
+
+#include "archiver.h"
+#include "object.h"
+
+namespace ici
+{
+
+/*
+ * An archive is an indexed archive, written by msave(), mapped into
+ * memory by mrestore(). It acts as the map or array saved as the
+ * archive's root but restores each of the root's elements on first
+ * use, by fetch or forall.
+ *
+ * a_values             The root object. It has every key of the
+ *                      saved root, those not yet restored having
+ *                      null values.
+ * a_pending            Maps keys not yet restored to the offset
+ *                      (an int) of their value in the archive.
+ * a_sent               The archiver's record of restored objects,
+ *                      by offset, shared by every restore from
+ *                      the archive so references between elements
+ *                      are preserved. The archive marks them.
+ *
+ * vec data restored from the archive is used in place, the vecs
+ * referencing the archive to keep the mapping alive. The mapping is
+ * private so writes to such vecs do not affect the file.
+ */
+struct archive : object
+{
+    void         *a_base;
+    size_t        a_size;
+    objwsup      *a_scope;
+    object       *a_values;
+    map          *a_pending;
+    archive_refs *a_sent;
+};
+
+inline archive *archiveof(object *o)
+{
+    return o->as<archive>();
+}
+inline bool isarchive(object *o)
+{
+    return o->hastype(TC_ARCHIVE);
+}
+
+archive *new_archive(const char *, objwsup *);
+
+class archive_type : public type
+{
+public:
+    archive_type() : type("archive", sizeof(struct archive))
+    {
+    }
+
+    size_t  mark(object *o) override;
+    void    free(object *o) override;
+    object *copy(object *o) override;
+    int     assign(object *o, object *k, object *v) override;
+    object *fetch(object *o, object *k) override;
+    int     forall(object *o) override;
+    int     nkeys(object *o) override;
+    int     keys(object *o, array *k) override;
+    int     save(archiver *, object *) override;
+    object *restore(archiver *) override;
+    int64_t len(object *) override;
+};
+
+} // namespace ici
+
+#endif /* ICI_ARCHIVE_OBJ_H */
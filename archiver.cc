@@ -22,10 +22,33 @@
  * and format of all exchanged data and conforming implementations
  * must adhere to those sizes and formats.
  *
- * All integral types are represented in network byte order, floating
- * pointed is defined to be 64-bit IEEE-754 double precision values,
- * byte swapped in the same manner as 64-bit integers. Object sizes
- * and lengths are sent as 32-bit unsigned values.
+ * An archive starts with the four bytes "ICIA" and a version byte,
+ * currently 3. The remainder of the archive is a sequence of chunks,
+ * each a <length> followed by that many bytes of data, ending with a
+ * zero length chunk. The data of all chunks, concatenated, is the
+ * serialized object. Chunks are at most 64KiB.
+ *
+ * Objects that may be referenced more than once are identified by
+ * their <offset>, the position of their tcode in the archive, not
+ * counting chunk lengths. A second, or subsequent, occurrence of such
+ * an object is written as a reference, the TC_REF tcode followed by
+ * the object's <offset>. Offsets 1 to 4, within the header, name
+ * objects outside the archive agreed by its writer and reader.
+ *
+ * Indexed archives, written by msave(), start with "ICIX" and the
+ * version and are not chunked. The root map's keys and values, or
+ * root array's elements, follow as separate objects and then an index
+ * giving the root's tcode, the offset of its super (zero if none),
+ * the number of elements and the offsets of their keys and values.
+ * A trailer gives the offset of the index, as a little-endian 64-bit
+ * value, and the magic number again. vec data in indexed archives is
+ * aligned to the size of the vec's elements.
+ *
+ * All integral values, including sizes and lengths, are written as
+ * variable length integers - zig-zag encoded, little-endian base 128
+ * (LEB128) values - so small values take a single byte. Floating point
+ * values are 32 or 64-bit IEEE-754 values written in little-endian
+ * byte order.
  *
  * The exact protocol follows.
  *
@@ -36,13 +59,20 @@
  *      atom, an atomic, read-only value.
  *
  *
+ * archive ::- "ICIA" <version> [<length> <byte>...]... 0 ;
+ * indexed-archive ::- "ICIX" <version> [<object>...] <index> <trailer> ;
+ * index ::- tcode <offset> <count> [[<offset>] <offset>]... ;
+ * trailer ::- <uint64> "ICIX" ;
+ *
+ * ref ::- TC_REF <offset>
+ *
  * object ::- tcode <tcode-specific-data> ;
  *
  *      An object is sent as a _tcode_ (type code) followed by zero
  *      or more bytes of data specific to that type.
  *
  * null ::- tcode
- * int ::- tcode <int64>
+ * int ::- tcode <varint>
  * float ::- tcode <float64>
  * string ::- tcode <length> [<byte>...]
  * regexp ::- tcode <options> <length> [<byte>...]
@@ -50,15 +80,23 @@
  * set ::- tcode <length> [<object>...]
  * map ::- tcode <length> [ <key> <value> ]...
  * mem ::- tcode <accessz> <length> <byte>...
+ * vec32f ::- tcode <capacity> <size> <props> [<float32>...]
+ * vec64f ::- tcode <capacity> <size> <props> [<float64>...]
  *
  * op ::- tcode
- * func ::- tcode
+ * func ::- tcode <code> <args> <autos> <name> <int32> <scope>
+ *
+ *      The scope is null when the function is restored into the
+ *      restoring archiver's scope.
+ *
  * cfunc ::- tcode
  *
  * This --intro-- and --synopsis-- are part of --ici-serialisation-- documentation.
  */
 
 #include "archiver.h"
+#include "archive.h"
+#include "array.h"
 #include "cfunc.h"
 #include "file.h"
 #include "fwd.h"
@@ -67,74 +105,50 @@
 #include "null.h"
 #include "op.h"
 
-#include <netinet/in.h>
+#include <algorithm>
 
 namespace ici
 {
-static void swapout(void *ptr, int sz)
+
+namespace
 {
-#if defined(ICI_ARCHIVE_LITTLE_ENDIAN_HOST)
-    switch (sz)
-    {
-    case 2: {
-        int16_t *v = (int16_t *)ptr;
-        auto     tmp = htons(*v);
-        *v = tmp;
-    }
-    break;
-    case 4: {
-        int32_t *v = (int32_t *)ptr;
-        auto     tmp = htonl(*v);
-        *v = tmp;
-    }
-    break;
-    case 8: {
-        int64_t *v = (int64_t *)ptr;
-        auto     tmp = htonll(*v);
-        *v = tmp;
-    }
-    break;
-    default:
-        abort();
-    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+constexpr bool little_endian_host = true;
 #else
-    (void)ptr;
-    (void)sz;
+constexpr bool little_endian_host = false;
 #endif
+
+inline uint64_t zigzag(int64_t v)
+{
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v)
+{
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
 }
 
-static void swapin(void *ptr, int sz)
+inline void put_le(uint8_t *p, uint64_t v, size_t sz)
 {
-#if defined(ICI_ARCHIVE_LITTLE_ENDIAN_HOST)
-    switch (sz)
+    for (size_t i = 0; i < sz; ++i)
     {
-    case 2: {
-        int16_t *v = (int16_t *)ptr;
-        auto     tmp = ntohs(*v);
-        *v = tmp;
+        p[i] = uint8_t(v >> (8 * i));
     }
-    break;
-    case 4: {
-        int32_t *v = (int32_t *)ptr;
-        auto     tmp = ntohl(*v);
-        *v = tmp;
-    }
-    break;
-    case 8: {
-        int64_t *v = (int64_t *)ptr;
-        auto     tmp = ntohll(*v);
-        *v = tmp;
-    }
-    break;
-    default:
-        abort();
+}
+
+inline uint64_t get_le(const uint8_t *p, size_t sz)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < sz; ++i)
+    {
+        v |= uint64_t(p[i]) << (8 * i);
     }
-#else
-    (void)ptr;
-    (void)sz;
-#endif
+    return v;
 }
 
+} // namespace
+
 #ifdef BINOPFUNC
 constexpr auto num_op_funcs = 13;
 #else
@@ -168,115 +182,573 @@ void archive_uninit()
 {
 }
 
-inline ref<integer> make_key(object *obj)
+archive_refs::archive_refs()
+    : r_slots(nullptr)
+    , r_nslots(0)
+    , r_nels(0)
+    , r_shift(64)
+{
+}
+
+archive_refs::~archive_refs()
+{
+    if (r_slots)
+    {
+        ici_nfree(r_slots, r_nslots * sizeof(slot));
+    }
+}
+
+/*
+ * Double the size of the table, or create it. Tables are kept at most
+ * half full so probe sequences stay short.
+ */
+int archive_refs::grow()
+{
+    const auto nslots = r_nslots == 0 ? size_t(64) : r_nslots * 2;
+    auto       slots = static_cast<slot *>(ici_nalloc(nslots * sizeof(slot)));
+    if (slots == nullptr)
+    {
+        return 1;
+    }
+    memset(slots, 0, nslots * sizeof(slot));
+    auto oldslots = r_slots;
+    auto oldnslots = r_nslots;
+    r_slots = slots;
+    r_nslots = nslots;
+    r_shift = 64;
+    for (auto n = nslots; n > 1; n >>= 1)
+    {
+        --r_shift;
+    }
+    for (size_t i = 0; i < oldnslots; ++i)
+    {
+        if (oldslots[i].sl_key != 0)
+        {
+            *slot_for(oldslots[i].sl_key) = oldslots[i];
+        }
+    }
+    if (oldslots)
+    {
+        ici_nfree(oldslots, oldnslots * sizeof(slot));
+    }
+    return 0;
+}
+
+/*
+ * Record, or replace, the value for a key.
+ *
+ * Returns 0 on success, 1 on error, usual conventions.
+ */
+int archive_refs::insert(uintptr_t key, uintptr_t value)
+{
+    if ((r_nels + 1) * 2 > r_nslots && grow())
+    {
+        return 1;
+    }
+    auto sl = slot_for(key);
+    if (sl->sl_key == 0)
+    {
+        sl->sl_key = key;
+        ++r_nels;
+    }
+    sl->sl_value = value;
+    return 0;
+}
+
+/*
+ * Remove a key, moving entries that probed past it back so that
+ * lookups never need tombstones. As unassign() does for maps.
+ */
+void archive_refs::erase(uintptr_t key)
 {
-    return make_ref(new_int((int64_t)obj));
+    slot *ss;
+    slot *sl;
+    slot *ws;
+
+    if (r_nels == 0 || (ss = slot_for(key))->sl_key == 0)
+    {
+        return;
+    }
+    --r_nels;
+    sl = ss;
+    for (;;)
+    {
+        if (--sl < r_slots)
+        {
+            sl = r_slots + r_nslots - 1;
+        }
+        if (sl->sl_key == 0)
+        {
+            break;
+        }
+        ws = r_slots + hashindex(sl->sl_key);
+        if ((sl < ss && (ws >= ss || ws < sl)) || (sl > ss && (ws >= ss && ws < sl)))
+        {
+            *ss = *sl;
+            ss = sl;
+        }
+    }
+    ss->sl_key = 0;
+    ss->sl_value = 0;
+}
+
+/*
+ * Mark the objects recorded by a save.
+ */
+size_t archive_refs::mark_keys()
+{
+    size_t mem = 0;
+    for (size_t i = 0; i < r_nslots; ++i)
+    {
+        if (r_slots[i].sl_key != 0)
+        {
+            mem += ici_mark(reinterpret_cast<object *>(r_slots[i].sl_key));
+        }
+    }
+    return mem + r_nslots * sizeof(slot);
+}
+
+/*
+ * Mark the objects recorded by a restore.
+ */
+size_t archive_refs::mark_values()
+{
+    size_t mem = 0;
+    for (size_t i = 0; i < r_nslots; ++i)
+    {
+        if (r_slots[i].sl_key != 0 && r_slots[i].sl_value != 0)
+        {
+            mem += ici_mark(reinterpret_cast<object *>(r_slots[i].sl_value));
+        }
+    }
+    return mem + r_nslots * sizeof(slot);
 }
 
 archiver::archiver(file *f, objwsup *scope)
     : a_file(f)
+    , a_buf(static_cast<uint8_t *>(ici_nalloc(ARCHIVE_BUFZ)))
+    , a_pos(0)
+    , a_end(0)
+    , a_base(0)
+    , a_objpos(0)
+    , a_depth(0)
+    , a_mode(streamed)
+    , a_owner(nullptr)
     , a_scope(scope)
-    , a_sent(new_map())
+    , a_define(true)
+    , a_sent(&a_refs)
     , a_names(new_array())
 {
 }
 
+archiver::archiver(const void *base, size_t len, object *owner, archive_refs *sent, objwsup *scope)
+    : a_file(nullptr)
+    , a_buf(static_cast<uint8_t *>(const_cast<void *>(base)))
+    , a_pos(0)
+    , a_end(len)
+    , a_base(0)
+    , a_objpos(0)
+    , a_depth(0)
+    , a_mode(mapping)
+    , a_owner(owner)
+    , a_scope(scope)
+    , a_define(true)
+    , a_sent(sent)
+    , a_names(new_array())
+{
+}
+
+archiver::~archiver()
+{
+    if (a_buf && a_mode != mapping)
+    {
+        ici_nfree(a_buf, ARCHIVE_BUFZ);
+    }
+}
+
 archiver::operator bool() const
 {
-    return a_sent != nullptr && a_names != nullptr;
+    return a_buf != nullptr && a_names != nullptr;
 }
 
-int archiver::push_name(str *name)
+/*
+ * Write the buffered data to the file as a single chunk, or as is
+ * when writing an indexed archive.
+ */
+int archiver::flush()
 {
-    return a_names->push_back(name);
+    if (a_pos == 0)
+    {
+        return 0;
+    }
+    if (a_mode == indexed)
+    {
+        if (a_file->write(a_buf, long(a_pos)) != long(a_pos))
+        {
+            set_error("failed to write archive data");
+            return 1;
+        }
+        a_base += a_pos;
+        a_pos = 0;
+        return 0;
+    }
+    uint8_t hdr[10];
+    size_t  n = 0;
+    for (uint64_t v = a_pos; ; v >>= 7)
+    {
+        if (v < 0x80)
+        {
+            hdr[n++] = uint8_t(v);
+            break;
+        }
+        hdr[n++] = uint8_t(v | 0x80);
+    }
+    if (a_file->write(hdr, long(n)) != long(n) || a_file->write(a_buf, long(a_pos)) != long(a_pos))
+    {
+        set_error("failed to write archive data");
+        return 1;
+    }
+    a_base += a_pos;
+    a_pos = 0;
+    return 0;
 }
 
-int archiver::pop_name()
+/*
+ * Read the next chunk from the file into the buffer. Chunk lengths are
+ * read a byte at a time so we never read beyond the archive's end.
+ */
+int archiver::fill()
 {
-    a_names->pop_back();
+    uint64_t len = 0;
+    if (a_mode == mapping)
+    {
+        set_error("truncated archive");
+        return 1;
+    }
+    for (int shift = 0; ; shift += 7)
+    {
+        uint8_t c;
+        if (shift > 63 || a_file->read(&c, 1) != 1)
+        {
+            set_error("truncated archive");
+            return 1;
+        }
+        len |= uint64_t(c & 0x7F) << shift;
+        if ((c & 0x80) == 0)
+        {
+            break;
+        }
+    }
+    if (len == 0 || len > ARCHIVE_BUFZ)
+    {
+        set_error(len == 0 ? "unexpected end of archive" : "invalid archive chunk length");
+        return 1;
+    }
+    if (a_file->read(a_buf, long(len)) != long(len))
+    {
+        set_error("truncated archive");
+        return 1;
+    }
+    a_base += a_end;
+    a_pos = 0;
+    a_end = size_t(len);
     return 0;
 }
 
-int archiver::record(object *obj, object *ref)
+int archiver::read_slow(void *buf, size_t len)
 {
-    if (auto key = make_key(obj))
+    auto p = static_cast<uint8_t *>(buf);
+    while (len > 0)
     {
-        return a_sent->assign(key, ref);
+        if (a_pos == a_end && fill())
+        {
+            return 1;
+        }
+        size_t n = std::min(len, a_end - a_pos);
+        memcpy(p, a_buf + a_pos, n);
+        a_pos += n;
+        p += n;
+        len -= n;
     }
+    return 0;
+}
+
+int archiver::write_slow(const void *buf, size_t len)
+{
+    auto p = static_cast<const uint8_t *>(buf);
+    while (len > 0)
+    {
+        if (a_pos == ARCHIVE_BUFZ && flush())
+        {
+            return 1;
+        }
+        size_t n = std::min(len, ARCHIVE_BUFZ - a_pos);
+        memcpy(a_buf + a_pos, p, n);
+        a_pos += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int archiver::read_varint(uint64_t *v)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t c;
+        if (read(&c))
+        {
+            return 1;
+        }
+        value |= uint64_t(c & 0x7F) << shift;
+        if ((c & 0x80) == 0)
+        {
+            *v = value;
+            return 0;
+        }
+    }
+    set_error("malformed integer in archive");
     return 1;
 }
 
-void archiver::remove(object *obj)
+int archiver::write_varint(uint64_t v)
 {
-    if (auto k = make_key(obj))
+    if (ARCHIVE_BUFZ - a_pos < 10 && flush())
+    {
+        return 1;
+    }
+    while (v >= 0x80)
     {
-        unassign(a_sent, k);
+        a_buf[a_pos++] = uint8_t(v | 0x80);
+        v >>= 7;
     }
+    a_buf[a_pos++] = uint8_t(v);
+    return 0;
 }
 
-int archiver::save_name(object *o)
+/*
+ * The header precedes the chunks so the type of archive can be
+ * determined before any chunk is read. Offsets in the archive include
+ * the header and are those of the equivalent unchunked file.
+ */
+int archiver::begin_save()
+{
+    uint8_t hdr[sizeof ARCHIVE_MAGIC + 1];
+
+    memcpy(hdr, ARCHIVE_MAGIC, sizeof ARCHIVE_MAGIC);
+    hdr[sizeof ARCHIVE_MAGIC] = ARCHIVE_VERSION;
+    if (a_file->write(hdr, sizeof hdr) != sizeof hdr)
+    {
+        set_error("failed to write archive data");
+        return 1;
+    }
+    a_pos = 0;
+    a_base = sizeof hdr;
+    return 0;
+}
+
+int archiver::end_save()
 {
-    const int64_t value = (int64_t)o;
-    if (record(o, o))
+    const uint8_t end = 0;
+    if (flush())
     {
         return 1;
     }
-    if (write(value))
+    if (a_file->write(&end, 1) != 1)
     {
+        set_error("failed to write archive data");
         return 1;
     }
     return 0;
 }
 
-int archiver::restore_name(object **name)
+int archiver::begin_restore()
 {
-    int64_t value;
-    if (read(&value))
+    uint8_t hdr[sizeof ARCHIVE_MAGIC + 1];
+
+    if (a_file->read(hdr, sizeof hdr) != sizeof hdr)
+    {
+        set_error("truncated archive");
+        return 1;
+    }
+    if (memcmp(hdr, ARCHIVE_INDEXED_MAGIC, sizeof ARCHIVE_INDEXED_MAGIC) == 0)
+    {
+        set_error("indexed archives must be restored using mrestore()");
+        return 1;
+    }
+    if (memcmp(hdr, ARCHIVE_MAGIC, sizeof ARCHIVE_MAGIC) != 0)
+    {
+        set_error("not an ICI archive");
+        return 1;
+    }
+    if (hdr[sizeof ARCHIVE_MAGIC] != ARCHIVE_VERSION)
     {
+        set_error("unsupported archive version %d", hdr[sizeof ARCHIVE_MAGIC]);
         return 1;
     }
-    *name = (object *)value;
+    a_pos = a_end = 0;
+    a_base = sizeof hdr;
     return 0;
 }
 
-int archiver::save_ref(object *o)
+int archiver::end_restore()
+{
+    uint8_t end;
+    if (a_pos != a_end)
+    {
+        set_error("unexpected data at end of archive");
+        return 1;
+    }
+    if (a_file->read(&end, 1) != 1 || end != 0)
+    {
+        set_error("archive end marker missing");
+        return 1;
+    }
+    return 0;
+}
+
+int archiver::save_external(object *o, size_t name)
+{
+    if (name < 1 || name > ARCHIVE_NEXTERNALS)
+    {
+        return set_error("invalid archive external name %d", int(name));
+    }
+    return a_sent->insert(uintptr_t(o), uintptr_t(name));
+}
+
+int archiver::restore_external(size_t name, object *o)
+{
+    if (name < 1 || name > ARCHIVE_NEXTERNALS)
+    {
+        return set_error("invalid archive external name %d", int(name));
+    }
+    return a_sent->insert(uintptr_t(name), uintptr_t(o));
+}
+
+int archiver::begin_sequence_save()
+{
+    ++a_depth;
+    return begin_save();
+}
+
+int archiver::end_sequence_save()
+{
+    --a_depth;
+    return end_save();
+}
+
+int archiver::begin_sequence_restore()
+{
+    ++a_depth;
+    return begin_restore();
+}
+
+int archiver::end_sequence_restore()
+{
+    --a_depth;
+    return end_restore();
+}
+
+size_t archiver::mark_saved()
+{
+    return a_sent->mark_keys();
+}
+
+int archiver::push_name(str *name)
+{
+    return a_names->push_back(name);
+}
+
+int archiver::pop_name()
+{
+    a_names->pop_back();
+    return 0;
+}
+
+/*
+ * Record the object restored for a name so references to the name
+ * resolve to it.
+ */
+int archiver::record(object *name, object *o)
+{
+    return a_sent->insert(uintptr_t(name), uintptr_t(o));
+}
+
+void archiver::remove(object *name)
+{
+    a_sent->erase(uintptr_t(name));
+}
+
+/*
+ * Objects are named by their offset in the archive so a name takes no
+ * space. Saved objects are recorded against their name for use by any
+ * later references to them.
+ */
+int archiver::save_name(object *o)
+{
+    return a_sent->insert(uintptr_t(o), uintptr_t(a_objpos));
+}
+
+int archiver::restore_name(object **name)
+{
+    *name = (object *)a_objpos;
+    return 0;
+}
+
+int archiver::save_ref(size_t offset)
 {
     const uint8_t tcode = TC_REF;
-    const int64_t ref = (int64_t)o;
     if (write(tcode))
     {
         return 1;
     }
-    if (write(ref))
+    if (write(int64_t(offset)))
     {
         return 1;
     }
     return 0;
 }
 
+/*
+ * A reference to an object not yet restored is an error in a stream
+ * but when restoring from a mapping we simply restore the object at
+ * the referenced offset, unless that object is still being restored
+ * (see restore_at()).
+ */
 object *archiver::restore_ref()
 {
-    object *name;
-    if (restore_name(&name))
+    int64_t offset;
+    if (read(&offset))
+    {
+        return nullptr;
+    }
+    auto v = a_sent->find(uintptr_t(offset));
+    if (v != nullptr && *v == 0)
     {
+        set_error("invalid archive, reference to an object being restored");
         return nullptr;
     }
-    if (auto o = lookup(name))
+    if (auto o = lookup((object *)offset))
     {
         incref(o);
         return o;
     }
+    if (a_mode == mapping && offset > 0 && size_t(offset) < a_end)
+    {
+        const auto pos = a_pos;
+        auto       o = restore_at(size_t(offset));
+        a_pos = pos;
+        return o;
+    }
+    set_error("archive reference to unknown object");
     return nullptr;
 }
 
-object *archiver::lookup(object *obj)
+object *archiver::lookup(object *name)
 {
-    object *v = nullptr;
-    if (auto k = make_key(obj))
-    {
-        v = a_sent->fetch(k);
-    }
-    return v == null ? nullptr : v;
+    auto v = a_sent->find(uintptr_t(name));
+    return v ? reinterpret_cast<object *>(*v) : nullptr;
 }
 
 int archiver::op_func_code(int_func *fn)
@@ -302,95 +774,179 @@ int_func *archiver::op_func(int code)
 
 int archiver::read(int16_t *hword)
 {
-    if (read(hword, sizeof *hword))
+    int64_t v;
+    if (read(&v))
     {
         return 1;
     }
-    swapin(hword, sizeof *hword);
+    *hword = int16_t(v);
     return 0;
 }
 
 int archiver::read(int32_t *aword)
 {
-    if (read(aword, sizeof *aword))
+    int64_t v;
+    if (read(&v))
     {
         return 1;
     }
-    swapin(aword, sizeof *aword);
+    *aword = int32_t(v);
     return 0;
 }
 
 int archiver::read(int64_t *dword)
 {
-    if (read(dword, sizeof *dword))
+    uint64_t v;
+    if (read_varint(&v))
     {
         return 1;
     }
-    swapin(dword, sizeof *dword);
+    *dword = unzigzag(v);
     return 0;
 }
 
 int archiver::read(float *flt)
 {
-    if (read(flt, sizeof *flt))
+    uint8_t  b[sizeof *flt];
+    uint32_t bits;
+    if (read(b, sizeof b))
     {
         return 1;
     }
-    swapin(flt, sizeof *flt);
+    bits = uint32_t(get_le(b, sizeof b));
+    memcpy(flt, &bits, sizeof *flt);
     return 0;
 }
 
 int archiver::read(double *dbl)
 {
-    if (read(dbl, sizeof *dbl))
+    uint8_t  b[sizeof *dbl];
+    uint64_t bits;
+    if (read(b, sizeof b))
     {
         return 1;
     }
-    swapin(dbl, sizeof *dbl);
+    bits = get_le(b, sizeof b);
+    memcpy(dbl, &bits, sizeof *dbl);
     return 0;
 }
 
 int archiver::write(int16_t hword)
 {
-    swapout(&hword, sizeof hword);
-    return write(&hword, sizeof hword);
+    return write(int64_t(hword));
 }
 
 int archiver::write(int32_t aword)
 {
-    swapout(&aword, sizeof aword);
-    return write(&aword, sizeof aword);
+    return write(int64_t(aword));
 }
 
 int archiver::write(int64_t dword)
 {
-    swapout(&dword, sizeof dword);
-    return write(&dword, sizeof dword);
+    return write_varint(zigzag(dword));
 }
 
 int archiver::write(float v)
 {
-    swapout(&v, sizeof v);
-    return write(&v, sizeof v);
+    uint8_t  b[sizeof v];
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof v);
+    put_le(b, bits, sizeof b);
+    return write(b, sizeof b);
 }
 
 int archiver::write(double v)
 {
-    swapout(&v, sizeof v);
-    return write(&v, sizeof v);
+    uint8_t  b[sizeof v];
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof v);
+    put_le(b, bits, sizeof b);
+    return write(b, sizeof b);
+}
+
+int archiver::read(float *p, size_t n)
+{
+    if (little_endian_host)
+    {
+        return read(static_cast<void *>(p), n * sizeof *p);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (read(&p[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int archiver::read(double *p, size_t n)
+{
+    if (little_endian_host)
+    {
+        return read(static_cast<void *>(p), n * sizeof *p);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (read(&p[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int archiver::write(const float *p, size_t n)
+{
+    if (little_endian_host)
+    {
+        return write(static_cast<const void *>(p), n * sizeof *p);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (write(p[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int archiver::write(const double *p, size_t n)
+{
+    if (little_endian_host)
+    {
+        return write(static_cast<const void *>(p), n * sizeof *p);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (write(p[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 int archiver::save(object *o)
 {
-    if (auto p = lookup(o))
-    {                       // if already sent in this session
-        return save_ref(p); // save a reference to the object
+    if (a_depth == 0)
+    {
+        ++a_depth;
+        int failed = begin_save() || save(o) || end_save();
+        --a_depth;
+        return failed;
+    }
+    if (auto p = a_sent->find(uintptr_t(o)))
+    {                        // if already sent in this session
+        return save_ref(*p); // save a reference to the object
     }
-    uint8_t tcode = o->o_tcode & object::O_ICIBITS; // mask out user-bits
+    uint8_t tcode = o->o_tcode & ~O_ARCHIVE_ATOMIC;
     if (o->isatom())
     {
         tcode |= O_ARCHIVE_ATOMIC;
     }
+    a_objpos = position();
     if (write(tcode))
     {
         return 1;
@@ -407,6 +963,19 @@ object *archiver::restore()
     uint8_t tcode;
     uint8_t flags = 0;
 
+    if (a_depth == 0)
+    {
+        object *o = nullptr;
+        ++a_depth;
+        if (!begin_restore() && (o = restore()) != nullptr && end_restore())
+        {
+            decref(o);
+            o = nullptr;
+        }
+        --a_depth;
+        return o;
+    }
+    a_objpos = position();
     if (read(&tcode))
     {
         return nullptr;
@@ -433,18 +1002,210 @@ object *archiver::restore()
     {
         return no_type();
     }
-    auto o = t->restore(this);
+    const auto name = reinterpret_cast<object *>(a_objpos);
+    auto       o = t->restore(this);
     if (!o)
     {
         return nullptr;
     }
     if (flags & object::O_ATOM)
     {
-        o = atom(o, 1);
+        /*
+         * The atom may be an existing object, the restored one being
+         * freed, and references to this object must resolve to it.
+         */
+        auto a = atom(o, 1);
+        if (a != o && lookup(name) == o && record(name, a))
+        {
+            decref(a);
+            return nullptr;
+        }
+        o = a;
     }
     return o;
 }
 
+/*
+ * Restore the object at an offset in a mapping. Until the object is
+ * recorded under its name the offset is recorded with no object, so a
+ * reference to it, which only a malformed archive can make before the
+ * object is recorded, fails rather than recursing without end.
+ */
+object *archiver::restore_at(size_t offset)
+{
+    if (offset == 0 || offset >= a_end)
+    {
+        set_error("archive offset %zu out of range", offset);
+        return nullptr;
+    }
+    const bool pending = a_sent->find(offset) == nullptr;
+    if (pending && a_sent->insert(offset, 0))
+    {
+        return nullptr;
+    }
+    a_pos = offset;
+    ++a_depth;
+    auto o = restore();
+    --a_depth;
+    if (pending)
+    {
+        auto v = a_sent->find(offset);
+        if (v != nullptr && *v == 0)
+        {
+            a_sent->erase(offset);
+        }
+    }
+    return o;
+}
+
+int archiver::seek(size_t offset)
+{
+    if (a_mode != mapping || offset > a_end)
+    {
+        set_error("archive offset %zu out of range", offset);
+        return 1;
+    }
+    a_pos = offset;
+    return 0;
+}
+
+int archiver::save_indexed(object *root)
+{
+    const bool ismaproot = ismap(root);
+    size_t     n = ismaproot ? mapof(root)->s_nels : arrayof(root)->len();
+    size_t     nofs = ismaproot ? 2 * n : n;
+    size_t     i = 0;
+    int64_t    super_ofs = 0;
+    int        failed = 1;
+
+    auto ofs = static_cast<int64_t *>(ici_alloc((nofs + 1) * sizeof(int64_t)));
+    if (!ofs)
+    {
+        return 1;
+    }
+    a_mode = indexed;
+    a_pos = a_base = 0;
+    ++a_depth;
+    if (write(ARCHIVE_INDEXED_MAGIC, sizeof ARCHIVE_INDEXED_MAGIC) || write(ARCHIVE_VERSION))
+    {
+        goto done;
+    }
+    if (ismaproot)
+    {
+        auto m = mapof(root);
+        if (m->o_super)
+        {
+            super_ofs = int64_t(position());
+            if (save(m->o_super))
+            {
+                goto done;
+            }
+        }
+        for (slot *sl = m->s_slots; sl < m->s_slots + m->s_nslots; ++sl)
+        {
+            if (!sl->sl_key || !sl->sl_value)
+            {
+                continue;
+            }
+            auto do_pop_name = false;
+            if (ismap(sl->sl_value) && isstring(sl->sl_key))
+            {
+                if (push_name(stringof(sl->sl_key)))
+                {
+                    goto done;
+                }
+                do_pop_name = true;
+            }
+            ofs[i++] = int64_t(position());
+            auto err = save(sl->sl_key);
+            if (!err)
+            {
+                ofs[i++] = int64_t(position());
+                err = save(sl->sl_value);
+            }
+            if (do_pop_name)
+            {
+                pop_name();
+            }
+            if (err)
+            {
+                goto done;
+            }
+        }
+    }
+    else
+    {
+        auto a = arrayof(root);
+        for (auto e = a->astart(); e != a->alimit(); e = a->anext(e))
+        {
+            ofs[i++] = int64_t(position());
+            if (save(*e))
+            {
+                goto done;
+            }
+        }
+    }
+    {
+        const uint64_t index_ofs = position();
+        uint8_t        trailer[ARCHIVE_TRAILERZ];
+
+        if (write(uint8_t(root->o_tcode & ~O_ARCHIVE_ATOMIC)) || write(super_ofs) || write(int64_t(n)))
+        {
+            goto done;
+        }
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (write(ofs[j]))
+            {
+                goto done;
+            }
+        }
+        put_le(trailer, index_ofs, 8);
+        memcpy(trailer + 8, ARCHIVE_INDEXED_MAGIC, sizeof ARCHIVE_INDEXED_MAGIC);
+        if (write(trailer, sizeof trailer) || flush())
+        {
+            goto done;
+        }
+    }
+    failed = 0;
+
+done:
+    --a_depth;
+    ici_free(ofs);
+    return failed;
+}
+
+int archiver::align(size_t n)
+{
+    const size_t pad = (n - position() % n) % n;
+    if (a_mode == indexed)
+    {
+        static const uint8_t zeros[16] = {0};
+        return write(zeros, pad);
+    }
+    if (a_mode == mapping)
+    {
+        if (pad > a_end - a_pos)
+        {
+            set_error("truncated archive");
+            return 1;
+        }
+        a_pos += pad;
+    }
+    return 0;
+}
+
+void *archiver::mapped(size_t n)
+{
+    if (a_mode != mapping || n > a_end - a_pos)
+    {
+        return nullptr;
+    }
+    auto p = a_buf + a_pos;
+    a_pos += n;
+    return p;
+}
+
 /*
  * save(any, [file [, map]])
  *
@@ -551,10 +1312,112 @@ int f_archive_restore(...)
     return obj == nullptr ? 1 : ret_with_decref(obj);
 }
 
+/*
+ * msave(map|array, [file [, map]])
+ *
+ * Save a map or array to a file as an indexed archive. Each of the
+ * object's elements is written as a separately restorable object, any
+ * objects they share being saved once, followed by an index. Indexed
+ * archives are read using mrestore().
+ *
+ * The file and scope are as per save().
+ *
+ * This --topic-- forms part of the --ici-serialisation-- documentation.
+ */
+int f_archive_msave(...)
+{
+    objwsup *scp = mapof(vs.a_top[-1])->o_super;
+    file    *file;
+    object  *obj;
+    int      failed = 1;
+
+    switch (NARGS())
+    {
+    case 3:
+        if (typecheck("oud", &obj, &file, &scp))
+        {
+            return 1;
+        }
+        break;
+
+    case 2:
+        if (typecheck("ou", &obj, &file))
+        {
+            return 1;
+        }
+        break;
+
+    case 1:
+        if (typecheck("o", &obj))
+        {
+            return 1;
+        }
+        if ((file = need_stdout()) == nullptr)
+        {
+            return 1;
+        }
+        break;
+
+    default:
+        return argerror(2);
+    }
+    if (!ismap(obj) && !isarray(obj))
+    {
+        return argerror(0);
+    }
+
+    archiver ar(file, scp);
+    if (ar)
+    {
+        failed = ar.save_indexed(obj);
+    }
+    return failed ? failed : null_ret();
+}
+
+/*
+ * archive = mrestore(filename [, map])
+ *
+ * Map the indexed archive, written by msave(), in the named file into
+ * memory and return an archive object acting as the saved map or
+ * array. Elements are restored when first fetched, or visited by
+ * forall, and vec data is used directly from the mapping.
+ *
+ * If map is supplied it is used as the 'scope' as per restore().
+ *
+ * This --topic-- forms part of the --ici-serialisation-- documentation.
+ */
+int f_archive_mrestore(...)
+{
+    char    *path;
+    objwsup *scp = mapof(vs.a_top[-1])->o_super;
+
+    switch (NARGS())
+    {
+    case 1:
+        if (typecheck("s", &path))
+        {
+            return 1;
+        }
+        break;
+
+    default:
+        if (typecheck("sd", &path, &scp))
+        {
+            return 1;
+        }
+        break;
+    }
+
+    auto a = new_archive(path, scp);
+    return a == nullptr ? 1 : ret_with_decref(a);
+}
+
 ICI_DEFINE_CFUNCS(save_restore)
 {
     ICI_DEFINE_CFUNC(save, f_archive_save),
     ICI_DEFINE_CFUNC(restore, f_archive_restore),
+    ICI_DEFINE_CFUNC(msave, f_archive_msave),
+    ICI_DEFINE_CFUNC(mrestore, f_archive_mrestore),
     ICI_CFUNCS_END()
 };
 
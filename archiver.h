@@ -19,11 +19,8 @@ int  archive_init();
 void archive_uninit();
 int  f_archive_save(...);
 int  f_archive_restore(...);
-
-// HACK - endianess support needs re-think
-#if defined(__i386__) || defined(__x86_64__)
-#define ICI_ARCHIVE_LITTLE_ENDIAN_HOST 1
-#endif
+int  f_archive_msave(...);
+int  f_archive_mrestore(...);
 
 /*
  * The top bit of the tcode is set when the object is atomic.  This of
@@ -35,8 +32,131 @@ constexpr int O_ARCHIVE_ATOMIC = 0x80;
  * The following portion of this file exports to ici.h. --ici.h-start--
  */
 
+/*
+ * Archives start with a four byte magic number followed by a format
+ * version byte. Restore rejects archives with any other version.
+ */
+constexpr char    ARCHIVE_MAGIC[4] = {'I', 'C', 'I', 'A'};
+constexpr uint8_t ARCHIVE_VERSION = 3;
+
+/*
+ * Indexed archives, written by msave() and read via mrestore(), use
+ * their own magic number. They are not chunked and end with an index
+ * of the root object's elements followed by a trailer holding the
+ * index's offset and the magic number again.
+ */
+constexpr char   ARCHIVE_INDEXED_MAGIC[4] = {'I', 'C', 'I', 'X'};
+constexpr size_t ARCHIVE_TRAILERZ = 8 + sizeof ARCHIVE_INDEXED_MAGIC;
+
+/*
+ * The size of the archiver's I/O buffer and so the largest chunk
+ * written to, or accepted from, an archive file.
+ */
+constexpr size_t ARCHIVE_BUFZ = 64 * 1024;
+
+/*
+ * The number of objects outside an archive that may be named, by an
+ * offset within the header, and referenced from it.
+ */
+constexpr size_t ARCHIVE_NEXTERNALS = sizeof ARCHIVE_MAGIC;
+
+/*
+ * An archive_refs is an archiver's record of the objects it has saved
+ * or restored, so later occurrences of an object may be written, or
+ * resolved, as references. It maps object addresses to archive offsets
+ * when saving and offsets to objects when restoring.
+ *
+ * It is a native open addressed hash table, allocating no ICI objects,
+ * and holds no references. When restoring from a mapping the table is
+ * shared by all restores from the mapping and its owner must mark the
+ * recorded objects.
+ *
+ * Keys may not be zero, zero marks an empty slot. Neither object
+ * addresses nor offsets (which always follow an archive's header) are
+ * ever zero.
+ */
+class archive_refs
+{
+public:
+    archive_refs();
+    ~archive_refs();
+    archive_refs(const archive_refs &) = delete;
+    archive_refs &operator=(const archive_refs &) = delete;
+
+    /*
+     *  Return a pointer to the value recorded for the key, or nullptr
+     *  if there is none.
+     */
+    inline uintptr_t *find(uintptr_t key) const
+    {
+        if (r_nels == 0)
+        {
+            return nullptr;
+        }
+        auto sl = slot_for(key);
+        return sl->sl_key == key ? &sl->sl_value : nullptr;
+    }
+
+    int    insert(uintptr_t key, uintptr_t value);
+    void   erase(uintptr_t key);
+    size_t mark_keys();
+    size_t mark_values();
+
+private:
+    struct slot
+    {
+        uintptr_t sl_key;
+        uintptr_t sl_value;
+    };
+
+    /*
+     *  Fibonacci hashing, the top bits of the product, so both aligned
+     *  addresses and small offsets spread across the table.
+     */
+    inline size_t hashindex(uintptr_t key) const
+    {
+        return size_t((uint64_t(key) * UINT64_C(0x9E3779B97F4A7C15)) >> r_shift);
+    }
+
+    /*
+     *  The slot holding the key or the empty slot where it would go.
+     *  Probes downwards, as do maps.
+     */
+    inline slot *slot_for(uintptr_t key) const
+    {
+        auto sl = r_slots + hashindex(key);
+        while (sl->sl_key != 0 && sl->sl_key != key)
+        {
+            if (--sl < r_slots)
+            {
+                sl = r_slots + r_nslots - 1;
+            }
+        }
+        return sl;
+    }
+
+    int grow();
+
+    slot  *r_slots;
+    size_t r_nslots; // a power of two, or zero
+    size_t r_nels;
+    int    r_shift; // 64 - log2(r_nslots)
+};
+
 /*
  * An archiver holds the /state/ used when saving or restoring an object graph.
+ *
+ * All I/O goes via a buffer that is exchanged with the file in
+ * length-prefixed chunks, so a save results in a few large writes
+ * and a restore never reads past the end of its archive.
+ *
+ * An archiver may instead restore from an indexed archive mapped into
+ * memory. Its "buffer" is then the mapping itself and objects may be
+ * restored from any offset, in any order.
+ *
+ * Objects are named by the offset, from the start of the archive, of
+ * their encoding and references to previously saved objects are
+ * written as that offset.
  */
 class archiver
 {
@@ -56,9 +176,18 @@ public:
      *  The object (a map) must be writable.
      */
     archiver(file *, objwsup *);
+
+    /**
+     *  Constructs an archiver that restores from an indexed archive
+     *  mapped into memory. The owner is the object responsible for
+     *  the mapping. The table records restored objects by offset and
+     *  is shared by all archivers restoring from the mapping.
+     */
+    archiver(const void *, size_t, object *, archive_refs *, objwsup *);
+
     operator bool() const; // checks construction success
 
-    ~archiver() = default;
+    ~archiver();
     archiver(archiver &&) = delete;
     archiver(const archiver &) = delete;
     archiver &operator=(const archiver &) = delete;
@@ -68,9 +197,68 @@ public:
         return a_scope;
     }
 
+    /*
+     *  Whether restored functions are assigned into the scope under
+     *  their names. They are unless this is turned off.
+     */
+    inline bool defines() const
+    {
+        return a_define;
+    }
+
+    inline void defines(bool define)
+    {
+        a_define = define;
+    }
+
+    /*
+     *  Name an object that is not part of the archive, such as a
+     *  scope, so that references to it are saved as references and
+     *  restored as the object given to the restoring archiver under
+     *  the same name. Names are from 1 to ARCHIVE_NEXTERNALS, offsets
+     *  within the archive header that can't name a saved object.
+     *
+     *  Returns 0 on success, 1 on error, usual conventions.
+     */
+    int save_external(object *, size_t);
+    int restore_external(size_t, object *);
+
+    /*
+     *  Has the object been saved, or named as an external, by this
+     *  archiver?
+     */
+    inline bool saved(object *o) const
+    {
+        return a_sent->find(uintptr_t(o)) != nullptr;
+    }
+
+    /*
+     *  Save or restore a sequence of objects, each by a call to save()
+     *  or restore() between the calls to begin and end the sequence.
+     *  Objects in the sequence share references as if they were in a
+     *  single object. The saving archiver must be marked by whoever
+     *  holds it, using mark_saved(), while the sequence is written.
+     *
+     *  Returns 0 on success, 1 on error, usual conventions.
+     */
+    int begin_sequence_save();
+    int end_sequence_save();
+    int begin_sequence_restore();
+    int end_sequence_restore();
+
+    /*
+     *  Mark the objects saved so far so they, and their addresses,
+     *  stay in use until the archive is finished.
+     */
+    size_t mark_saved();
+
     /*
      *  Save the given object to the archiver's file.
      *
+     *  The outermost call writes the archive header before the object
+     *  and flushes the archiver's buffer, and writes the archive's end
+     *  marker, after it.
+     *
      *  Returns 0 on success, 1 on error, usual conventions.
      */
     int save(object *);
@@ -78,30 +266,122 @@ public:
     /*
      *  Restore an object from the archiver's files.
      *
+     *  The outermost call reads and checks the archive header and
+     *  consumes the end marker leaving the file positioned after
+     *  the archive.
+     *
      *  Returns nullptr on error.
      */
     object *restore();
 
-    inline int read(void *buf, int len)
+    /*
+     *  Write the given map or array as an indexed archive. The
+     *  elements are saved one at a time, sharing object references,
+     *  and an index of their offsets is written after them.
+     *
+     *  Returns 0 on success, 1 on error, usual conventions.
+     */
+    int save_indexed(object *);
+
+    /*
+     *  Restore the object encoded at the given offset of a mapped
+     *  archive.
+     *
+     *  Returns nullptr on error.
+     */
+    object *restore_at(size_t);
+
+    /*
+     *  Set the position when restoring from a mapping.
+     *
+     *  Returns 0 on success, 1 on error, usual conventions.
+     */
+    int seek(size_t);
+
+    /*
+     *  The archiver's position in the archive, the offset of the
+     *  next byte to be read or written.
+     */
+    inline size_t position() const
     {
-        return a_file->read(buf, len) != len;
+        return a_base + a_pos;
+    }
+
+    /*
+     *  Align the position in an indexed archive to a multiple of
+     *  the given size so that data may be used in place once mapped.
+     *  Does nothing for streamed archives.
+     */
+    int align(size_t);
+
+    /*
+     *  If restoring from a mapping, return a pointer to the next
+     *  'n' bytes of the mapping and skip them. Otherwise return
+     *  nullptr and data must be read as usual.
+     */
+    void *mapped(size_t n);
+
+    /*
+     *  The object owning the mapping being restored from, if any.
+     */
+    inline object *owner() const
+    {
+        return a_owner;
+    }
+
+    /*
+     *  Raw byte I/O. Bytes are copied to and from the archiver's
+     *  buffer which is only exchanged with the file when it is
+     *  full, or empty.
+     */
+    inline int read(void *buf, size_t len)
+    {
+        if (len <= a_end - a_pos)
+        {
+            memcpy(buf, a_buf + a_pos, len);
+            a_pos += len;
+            return 0;
+        }
+        return read_slow(buf, len);
     }
 
     inline int read(uint8_t *abyte)
     {
-        return read(abyte, 1);
+        if (a_pos == a_end && fill())
+        {
+            return 1;
+        }
+        *abyte = a_buf[a_pos++];
+        return 0;
     }
 
-    inline int write(const void *buf, int len)
+    inline int write(const void *buf, size_t len)
     {
-        return a_file->write(buf, len) != len;
+        if (len <= ARCHIVE_BUFZ - a_pos)
+        {
+            memcpy(a_buf + a_pos, buf, len);
+            a_pos += len;
+            return 0;
+        }
+        return write_slow(buf, len);
     }
 
     inline int write(uint8_t abyte)
     {
-        return write(&abyte, 1);
+        if (a_pos == ARCHIVE_BUFZ && flush())
+        {
+            return 1;
+        }
+        a_buf[a_pos++] = abyte;
+        return 0;
     }
 
+    /*
+     *  Integers are written as zig-zag encoded LEB128 varints, so
+     *  small values of either sign take a single byte. Floating
+     *  point values are written as their IEEE-754 bit pattern in
+     *  little-endian byte order.
+     */
     int read(int16_t *);
     int read(int32_t *);
     int read(int64_t *);
@@ -114,22 +394,59 @@ public:
     int write(float);
     int write(double);
 
+    /*
+     *  Bulk I/O of floating point spans, as used for vec payloads.
+     *  On little-endian hosts these are single copies.
+     */
+    int read(float *, size_t);
+    int read(double *, size_t);
+    int write(const float *, size_t);
+    int write(const double *, size_t);
+
     int     record(object *, object *);
     object *lookup(object *);
     void    remove(object *);
     int     save_name(object *);
     int     restore_name(object **);
-    int     save_ref(object *);
+    int     save_ref(size_t);
     object *restore_ref();
     int     push_name(str *);
     int     pop_name();
     str    *name_qualifier();
 
 private:
-    file      *a_file;
-    objwsup   *a_scope;
-    ref<map>   a_sent; // object -> 'name' (int)
-    ref<array> a_names;
+    enum
+    {
+        streamed,
+        indexed,
+        mapping
+    };
+
+    int read_slow(void *, size_t);
+    int write_slow(const void *, size_t);
+    int read_varint(uint64_t *);
+    int write_varint(uint64_t);
+    int fill();
+    int flush();
+    int begin_save();
+    int end_save();
+    int begin_restore();
+    int end_restore();
+
+    file         *a_file;
+    uint8_t      *a_buf;    // ARCHIVE_BUFZ bytes of I/O buffer, or the mapping
+    size_t        a_pos;    // next byte to read or write in a_buf
+    size_t        a_end;    // restoring, end of buffered chunk data
+    size_t        a_base;   // offset, in the archive, of a_buf[0]
+    size_t        a_objpos; // offset of the object being saved or restored
+    int           a_depth;  // save/restore nesting depth
+    int           a_mode;   // streamed, indexed or mapping
+    object       *a_owner;  // mapping, the object that owns it
+    objwsup      *a_scope;
+    bool          a_define; // assign restored functions into a_scope
+    archive_refs  a_refs;   // the objects of this session, unless mapping
+    archive_refs *a_sent;   // object -> offset, or offset -> object
+    ref<array>    a_names;
 };
 
 /*
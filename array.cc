@@ -32,6 +32,18 @@ int array::grow_stack(ptrdiff_t n)
     assert(!isatom());
     assert(a_bot == a_base);
 
+    if (a_shared != nullptr)
+    {
+        if (split())
+        {
+            return 1;
+        }
+        if (a_limit - a_top >= n)
+        {
+            return 0;
+        }
+    }
+
     /*
      * We don't use realloc to ensure that memory exhaustion is
      * cleanly recovereable.
@@ -189,6 +201,44 @@ int array::grow()
     return 0;
 }
 
+/*
+ * Give the array its own copy of the elements it shares with other copies
+ * of the array. If no other array still shares them it takes back all of
+ * their allocation. Returns 1 on error, else 0, usual error conventions.
+ * See unshare() in array.h.
+ */
+int array::split()
+{
+    auto ss = a_shared;
+
+    if (ss->ss_nrefs > 1)
+    {
+        ptrdiff_t n = a_top - a_bot;
+        ptrdiff_t m = n + n / 2 + 8;
+        object  **e;
+
+        if ((e = (object **)ici_nalloc(m * sizeof(object *))) == nullptr)
+        {
+            return 1;
+        }
+        memcpy(e, a_bot, n * sizeof(object *));
+        release_store(ss);
+        ++cow_split;
+        a_base = e;
+        a_bot = e;
+        a_top = e + n;
+        a_limit = e + m;
+    }
+    else
+    {
+        a_base = (object **)ss->ss_base;
+        a_limit = a_base + ss->ss_size / sizeof(object *);
+        ici_tfree(ss, shared_store);
+    }
+    a_shared = nullptr;
+    return 0;
+}
+
 /*
  * Push the object 'o' onto the end of the array 'a'. This is the general
  * case that works for any array whether it is a stack or a queue.
@@ -203,6 +253,10 @@ int array::push_back(object *o)
     {
         return set_error("attempt to push atomic array");
     }
+    if (unshare())
+    {
+        return 1;
+    }
     if (a_bot <= a_top)
     {
         /*
@@ -264,6 +318,10 @@ int array::push_front(object *o)
     {
         return set_error("attempt to rpush atomic array");
     }
+    if (unshare())
+    {
+        return 1;
+    }
     if (a_bot <= a_top)
     {
         /*
@@ -319,6 +377,20 @@ object *array::pop_back()
         set_error("attempt to pop atomic array");
         return nullptr;
     }
+    if (a_shared != nullptr)
+    {
+        /*
+         * Shared elements never wrap and the array keeps no room
+         * beyond them. See the comment on array in array.h.
+         */
+        if (a_bot == a_top)
+        {
+            return null;
+        }
+        auto o = *--a_top;
+        a_limit = a_top;
+        return o;
+    }
     if (a_bot <= a_top)
     {
         /*
@@ -365,6 +437,16 @@ object *array::pop_front()
         set_error("attempt to rpop atomic array");
         return nullptr;
     }
+    if (a_shared != nullptr)
+    {
+        if (a_bot == a_top)
+        {
+            return null;
+        }
+        auto o = *a_bot++;
+        a_base = a_bot;
+        return o;
+    }
     if (a_bot <= a_top)
     {
         /*
@@ -416,6 +498,10 @@ object **array::find_slot(ptrdiff_t i)
          * Within the range of exisiting objects. Just use
          * span to find the pointer to it.
          */
+        if (unshare())
+        {
+            return nullptr;
+        }
         return span(i, nullptr);
     }
     if (isatom())
@@ -474,6 +560,7 @@ array *new_array(ptrdiff_t n)
     a->a_top = nullptr;
     a->a_limit = nullptr;
     a->a_bot = nullptr;
+    a->a_shared = nullptr;
     if (n == 0)
     {
         n = 8; // initial capacity
@@ -543,7 +630,11 @@ size_t array_type::mark(object *o)
 void array_type::free(object *o)
 {
     auto a = arrayof(o);
-    if (a->a_base != nullptr)
+    if (a->a_shared != nullptr)
+    {
+        release_store(a->a_shared);
+    }
+    else if (a->a_base != nullptr)
     {
         ici_nfree(a->a_base, (a->a_limit - a->a_base) * sizeof(object *));
     }
@@ -608,15 +699,50 @@ int array_type::cmp(object *o1, object *o2)
 
 object *array_type::copy(object *o)
 {
+    array    *a = arrayof(o);
     array    *na;
     ptrdiff_t n;
 
-    n = arrayof(o)->len();
+    n = a->len();
+    /*
+     * The interpreter's stacks are written directly, without unsharing,
+     * so copies of them, as vstack() makes, are never shared.
+     */
+    if (n > ptrdiff_t(COW_MIN_SLOTS) && a->a_bot <= a->a_top && a != &vs && a != &os && a != &xs)
+    {
+        /*
+         * Share the elements, copy-on-write. Both arrays are left with
+         * no room before or after the elements, see array.h.
+         */
+        shared_store *ss;
+
+        if ((na = ici_talloc(array)) == nullptr)
+        {
+            return nullptr;
+        }
+        ss = share_store(a->a_shared, a->a_base, (a->a_limit - a->a_base) * sizeof(object *));
+        if (ss == nullptr)
+        {
+            ici_tfree(na, array);
+            return nullptr;
+        }
+        a->a_shared = ss;
+        a->a_base = a->a_bot;
+        a->a_limit = a->a_top;
+        set_tfnz(na, TC_ARRAY, 0, 1, 0);
+        na->a_base = a->a_bot;
+        na->a_bot = a->a_bot;
+        na->a_top = a->a_top;
+        na->a_limit = a->a_top;
+        na->a_shared = ss;
+        rego(na);
+        return na;
+    }
     if ((na = new_array(n)) == nullptr)
     {
         return nullptr;
     }
-    arrayof(o)->gather(na->a_top, 0, n);
+    a->gather(na->a_top, 0, n);
     na->a_top += n;
     return na;
 }
@@ -663,29 +789,28 @@ object *array_type::fetch(object *o, object *k)
 
 int array_type::forall(object *o)
 {
-    auto     fa = forallof(o);
-    array   *a;
-    integer *i;
+    return step(forallof(o));
+}
+
+/*
+ * Advance a forall loop over an array, see map_type::step().
+ */
+int array_type::step(struct forall *fa)
+{
+    auto a = arrayof(fa->fa_aggr);
 
-    a = arrayof(fa->fa_aggr);
     if (++fa->fa_index >= a->len())
     {
         return -1;
     }
-    if (fa->fa_vaggr != null)
+    if (fa->fa_vaggr != null && forall_assign(fa->fa_vaggr, fa->fa_vkey, a->get(fa->fa_index)))
     {
-        if (ici_assign(fa->fa_vaggr, fa->fa_vkey, a->get(fa->fa_index)))
-        {
-            return 1;
-        }
+        return 1;
     }
     if (fa->fa_kaggr != null)
     {
-        if ((i = make_ref(new_int((long)fa->fa_index))) == nullptr)
-        {
-            return 1;
-        }
-        if (ici_assign(fa->fa_kaggr, fa->fa_kkey, i))
+        ref<> i = new_int(int64_t(fa->fa_index));
+        if (!i || forall_assign(fa->fa_kaggr, fa->fa_kkey, i))
         {
             return 1;
         }
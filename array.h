@@ -72,13 +72,20 @@ namespace ici
  *
  * Note that one must never take the atomic form of a stack, and
  * assume the result is still a stack.
+ *
+ * Copies of large arrays share their elements, copy-on-write (see
+ * shared_store in alloc.h). Shared elements are never wrapped and each
+ * array sharing them has a_base == a_bot and a_limit == a_top, so that
+ * push_check() finds no room and any push splits off a private copy.
+ * Elements may only be written directly once unshare() has been called.
  */
 struct array : object
 {
-    object **a_top;   /* The next free slot. */
-    object **a_bot;   /* The first used slot. */
-    object **a_base;  /* The base of allocation. */
-    object **a_limit; /* Allocation limit, first one you can't use. */
+    object      **a_top;    /* The next free slot. */
+    object      **a_bot;    /* The first used slot. */
+    object      **a_base;   /* The base of allocation. */
+    object      **a_limit;  /* Allocation limit, first one you can't use. */
+    shared_store *a_shared; /* Non-null if the elements may be shared. */
 
     /*
      * Functions to assist in doing for loops over the elements of an array.
@@ -111,6 +118,7 @@ struct array : object
     size_t   len();
     object **span(size_t i, ptrdiff_t *np);
     int      grow();
+    int      split();
     int      push_back(object *o);
     int      push_front(object *o);
     object  *pop_back();
@@ -135,6 +143,15 @@ struct array : object
         return a_limit - a_top < n ? grow_stack(n) : 0;
     }
 
+    /*
+     * Ensure the array's elements are its own, and so may be written
+     * directly. Return non-zero on failure, usual conventions.
+     */
+    inline int unshare()
+    {
+        return a_shared != nullptr ? split() : 0;
+    }
+
     /*
      * Ensure that the stack a has i as a valid index.  Will grow and nullptr fill
      * as necessary. Return non-zero on failure, usual conventions.
@@ -229,6 +246,7 @@ public:
     int           save(archiver *, object *) override;
     object       *restore(archiver *) override;
     int64_t       len(object *) override;
+    static int    step(struct forall *);
 };
 
 /*
@@ -10,7 +10,13 @@
 
 #ifndef BINOPFUNC
 
-#define ICI_TRI(a, b, t) (((((a) << 4) + b) << 6) + t_subtype(t))
+/*
+ * ICI_TRI packs the tcodes of the operands and the operator's subtype
+ * into one switch value, six bits each. Types registered beyond the
+ * first 64 don't fit and are always dealt with by the default case.
+ */
+#define ICI_TRI_BITS 6
+#define ICI_TRI(a, b, t) (((((a) << ICI_TRI_BITS) + (b)) << 6) + t_subtype(t))
 
 // This uses knowledge of the exec switch in exec.c to avoid chains of
 // gotos.  The continue_with_same_pc label is defined there.
@@ -80,17 +86,20 @@
     o0 = os.a_top[-2];
     o1 = os.a_top[-1];
     can_temp = opof(o)->op_ecode == OP_BINOP_FOR_TEMP;
-    // if (o0->o_tcode > TC_MAX_BINOP || o1->o_tcode > TC_MAX_BINOP) {
-    //     goto others;
-    // }
-    switch (ICI_TRI(o0->o_tcode, o1->o_tcode, opof(o)->op_code))
+    static_assert(TC_MAX_CORE < 1 << ICI_TRI_BITS, "core tcodes must fit in ICI_TRI");
+    static_assert(TM_SUBTYPE < 1 << 6, "operator subtypes must fit in ICI_TRI");
+    switch ((o0->o_tcode | o1->o_tcode) >> ICI_TRI_BITS ? 0 : ICI_TRI(o0->o_tcode, o1->o_tcode, opof(o)->op_code))
     {
     /*
      * Pure integer operations.
      */
     case ICI_TRI(TC_INT, TC_INT, T_ASTERIX):
     case ICI_TRI(TC_INT, TC_INT, T_ASTERIXEQ):
-        USEi(intof(o0)->i_value * intof(o1)->i_value);
+        if (UNLIKELY(__builtin_mul_overflow(intof(o0)->i_value, intof(o1)->i_value, &i)))
+        {
+            goto int_overflow;
+        }
+        goto usei;
 
     case ICI_TRI(TC_INT, TC_INT, T_SLASH):
     case ICI_TRI(TC_INT, TC_INT, T_SLASHEQ):
@@ -99,6 +108,11 @@
             set_error("division by 0");
             FAIL();
         }
+        if (UNLIKELY(intof(o1)->i_value == -1 && intof(o0)->i_value == INT64_MIN))
+        {
+            i = INT64_MIN;
+            goto int_overflow;
+        }
         USEi(intof(o0)->i_value / intof(o1)->i_value);
 
     case ICI_TRI(TC_INT, TC_INT, T_PERCENT):
@@ -108,15 +122,27 @@
             set_error("modulus by 0");
             FAIL();
         }
+        if (UNLIKELY(intof(o1)->i_value == -1))
+        {
+            USE0();
+        }
         USEi(intof(o0)->i_value % intof(o1)->i_value);
 
     case ICI_TRI(TC_INT, TC_INT, T_PLUS):
     case ICI_TRI(TC_INT, TC_INT, T_PLUSEQ):
-        USEi(intof(o0)->i_value + intof(o1)->i_value);
+        if (UNLIKELY(__builtin_add_overflow(intof(o0)->i_value, intof(o1)->i_value, &i)))
+        {
+            goto int_overflow;
+        }
+        goto usei;
 
     case ICI_TRI(TC_INT, TC_INT, T_MINUS):
     case ICI_TRI(TC_INT, TC_INT, T_MINUSEQ):
-        USEi(intof(o0)->i_value - intof(o1)->i_value);
+        if (UNLIKELY(__builtin_sub_overflow(intof(o0)->i_value, intof(o1)->i_value, &i)))
+        {
+            goto int_overflow;
+        }
+        goto usei;
 
     case ICI_TRI(TC_INT, TC_INT, T_GRTGRT):
     case ICI_TRI(TC_INT, TC_INT, T_GRTGRTEQ):
@@ -780,7 +806,7 @@
                 o = o0;
                 USEo();
             }
-            MISMATCH();
+            break;
 
         case t_subtype(T_MINUSEQ):
             if (o0->o_tcode == TC_SET)
@@ -792,38 +818,54 @@
                 o = o0;
                 USEo();
             }
-            MISMATCH();
+            break;
 
         case t_subtype(T_EQEQ):
             if (o0->icitype() == o1->icitype() && compare(o0, o1) == 0)
             {
                 USE1();
             }
-            USE0();
+            if (!has_user_equality(o0) && !has_user_equality(o1))
+            {
+                USE0();
+            }
+            break;
 
         case t_subtype(T_EXCLAMEQ):
-            if (!(o0->icitype() == o1->icitype() && compare(o0, o1) == 0))
+            if (o0->icitype() == o1->icitype() && compare(o0, o1) == 0)
+            {
+                USE0();
+            }
+            if (!has_user_equality(o0) && !has_user_equality(o1))
             {
                 USE1();
             }
-            USE0();
+            break;
         }
 
         // user-defined binops
         {
-            const auto t0 = o0->icitype()->name;
-            const auto t1 = o1->icitype()->name;
 #ifndef NDEBUG
-            fprintf(stderr, "BINOP: lookup_user_binop(\"%s\", \"%s\", \"%s\")\n", t0, binop_name(opof(o)->op_code), t1);
+            fprintf(stderr, "BINOP: find_user_binop(\"%s\", \"%s\", \"%s\")\n", binop_type_name(o0),
+                    binop_name(opof(o)->op_code), binop_type_name(o1));
 #endif
-            if (auto fn = lookup_user_binop(t0, binop_name(opof(o)->op_code), t1))
+            if (auto fn = find_user_binop(o0, opof(o)->op_code, o1))
             {
-                if ((o = call_user_binop(fn, o0, o1)))
+                if ((o = call_user_binop(fn, o0, o1)) == nullptr)
                 {
-                    USEo();
+                    FAIL();
                 }
+                LOOSEo();
             }
         }
+        switch (opof(o)->op_code)
+        {
+        case t_subtype(T_EQEQ):
+            USE0();
+
+        case t_subtype(T_EXCLAMEQ):
+            USE1();
+        }
 
         /*FALLTHROUGH*/
 mismatch:
@@ -836,6 +878,22 @@ mismatch:
         set_error(buf);
     }
     FAIL();
+
+    /*
+     * Integer arithmetic that overflowed, i holds the wrapped result.
+     * A user-defined operator for the ints may supply another result,
+     * such as a bignum.
+     */
+int_overflow:
+    if (auto fn = find_user_binop(o0, opof(o)->op_code, o1))
+    {
+        if ((o = call_user_binop(fn, o0, o1)) == nullptr)
+        {
+            FAIL();
+        }
+        LOOSEo();
+    }
+    goto usei;
 }
 
 #ifdef BINOPFUNC
@@ -19,11 +19,14 @@
 #include "int.h"
 #include "map.h"
 #include "mem.h"
+#include "method.h"
 #include "null.h"
 #include "op.h"
 #include "parse.h"
 #include "pcre.h"
+#include "pmap.h"
 #include "ptr.h"
+#include "pvec.h"
 #include "re.h"
 #include "set.h"
 #include "str.h"
@@ -945,25 +948,90 @@ static int f_set()
     return ret_with_decref(s);
 }
 
-static int f_keys()
+/*
+ * pmap(key, value, ...) - a new persistent map of the given entries.
+ */
+static int f_pmap()
 {
-    array *k;
+    int      nargs;
+    pmap    *p;
+    object **o;
 
-    if (NARGS() != 1)
+    if ((nargs = NARGS()) & 1)
     {
-        return argcount(1);
+        return set_error("pmap() given a key without a value");
     }
-    int n = ARG(0)->icitype()->nkeys(ARG(0));
-    if ((k = new_array(n)) == nullptr)
+    if ((p = new_pmap()) == nullptr)
+    {
+        return 1;
+    }
+    for (o = ARGS(); nargs >= 2; nargs -= 2, o -= 2)
+    {
+        if (ici_assign(p, o[0], o[-1]))
+        {
+            decref(p);
+            return 1;
+        }
+    }
+    return ret_with_decref(p);
+}
+
+/*
+ * pset(key, ...) - a new persistent set of the given keys.
+ */
+static int f_pset()
+{
+    int      nargs;
+    pmap    *p;
+    object **o;
+
+    if ((p = new_pmap(TC_PSET)) == nullptr)
     {
         return 1;
     }
-    if (ARG(0)->icitype()->keys(ARG(0), k))
+    for (nargs = NARGS(), o = ARGS(); nargs > 0; --nargs, --o)
+    {
+        if (ici_assign(p, *o, o_one))
+        {
+            decref(p);
+            return 1;
+        }
+    }
+    return ret_with_decref(p);
+}
+
+/*
+ * pvec(value, ...) - a new persistent vector of the given values.
+ */
+static int f_pvec()
+{
+    int      nargs;
+    pvec    *v;
+    object **o;
+
+    if ((v = new_pvec()) == nullptr)
     {
-        decref(k);
         return 1;
     }
-    return ret_with_decref(k);
+    for (nargs = NARGS(), o = ARGS(); nargs > 0; --nargs, --o)
+    {
+        if (v->push(*o))
+        {
+            decref(v);
+            return 1;
+        }
+    }
+    return ret_with_decref(v);
+}
+
+static ref<array> f_keys(object *o)
+{
+    auto k = make_ref(new_array(o->icitype()->nkeys(o)));
+    if (!k || o->icitype()->keys(o, k))
+    {
+        return nullptr;
+    }
+    return k;
 }
 
 static int f_copy(object *o)
@@ -992,46 +1060,38 @@ static int f_typeof()
     return ret_no_decref(ARG(0)->icitype()->ici_name());
 }
 
-static int f_len()
+static int64_t f_len(object *o)
 {
-    if (NARGS() != 1)
-    {
-        return argcount(1);
-    }
-    return int_ret(objlen(ARG(0)));
+    return objlen(o);
 }
 
-static int f_int()
+static ref<> f_int(object *o, optarg<object *> base)
 {
-    object *o;
     int64_t v;
 
-    if (NARGS() < 1)
-    {
-        return argcount(1);
-    }
-    o = ARG(0);
     if (isint(o))
     {
-        return ret_no_decref(o);
+        return ref<>(o, with_incref);
     }
     else if (isstring(o))
     {
-        int64_t base = 0;
+        int64_t b = 0;
 
-        if (NARGS() > 1)
+        if (base.given)
         {
-            if (!isint(ARG(1)))
+            if (!isint(base.value))
             {
-                return argerror(1);
+                argerror(1);
+                return nullptr;
             }
-            base = intof(ARG(1))->i_value;
-            if (base != 0 && (base < 2 || base > 36))
+            b = intof(base.value)->i_value;
+            if (b != 0 && (b < 2 || b > 36))
             {
-                return argerror(1);
+                argerror(1);
+                return nullptr;
             }
         }
-        v = xstrtol(stringof(o)->s_chars, nullptr, int(base));
+        v = xstrtol(stringof(o)->s_chars, nullptr, int(b));
         // fixme: check for errors in chars wrt. base
     }
     else if (isfloat(o))
@@ -1042,7 +1102,7 @@ static int f_int()
     {
         v = 0;
     }
-    return int_ret(v);
+    return ref<>(new_int(v));
 }
 
 static int f_float()
@@ -1151,18 +1211,11 @@ static int f_num()
     return set_error("%s is not a number", objname(n, o));
 }
 
-static int f_string()
+static ref<> f_string(object *o)
 {
-    object *o;
-
-    if (NARGS() != 1)
-    {
-        return argcount(1);
-    }
-    o = ARG(0);
     if (isstring(o))
     {
-        return ret_no_decref(o);
+        return ref<>(o, with_incref);
     }
     if (isint(o))
     {
@@ -1174,13 +1227,13 @@ static int f_string()
     }
     else if (isregexp(o))
     {
-        return ret_no_decref(regexpof(o)->r_pat);
+        return ref<>(regexpof(o)->r_pat, with_incref);
     }
     else
     {
         sprintf(buf, "[%s]", o->type_name());
     }
-    return str_ret(buf);
+    return ref<>(new_str_nul_term(buf));
 }
 
 static int f_eq()
@@ -1199,20 +1252,13 @@ static int f_eq()
     return ret_no_decref(o_zero);
 }
 
-static int f_push()
+static object *f_push(array *a, object *o)
 {
-    array  *a;
-    object *o;
-
-    if (typecheck("ao", &a, &o))
-    {
-        return 1;
-    }
     if (a->push_back(o))
     {
-        return 1;
+        return nullptr;
     }
-    return ret_no_decref(o);
+    return o;
 }
 
 static int f_rpush()
@@ -1496,6 +1542,82 @@ fail:
     return 1;
 }
 
+/*
+ * The callable of a closure's method. The subject is an array of the
+ * bound function and its bound arguments. Calls the function with the
+ * bound arguments followed by those given, in the manner of call().
+ */
+static int f_closure_invoke(object *s)
+{
+    array   *a;
+    int      nargs;  /* Number of args given to us. */
+    int      nbound; /* Number of bound args. */
+    integer *nargso;
+
+    a = arrayof(s);
+    nargs = NARGS();
+    nbound = int(a->len()) - 1;
+    /*
+     * We have...
+     *    [argn]...[arg1] [nargs] [us]
+     *
+     * We want...
+     *    [argn]...[arg1] [bound[n]]...[bound[1]] [nargs + nbound] [func]
+     */
+    if (os.push_check(nbound + 80))
+    {
+        return 1;
+    }
+    if ((nargso = new_int(nargs + nbound)) == nullptr)
+    {
+        return 1;
+    }
+    os.a_top -= 2;
+    for (int i = nbound; i > 0; --i)
+    {
+        os.push(a->get(i));
+    }
+    os.push(nargso, with_decref);
+    os.push(a->get(0));
+    xs.a_top[-1] = &o_call;
+    /*
+     * Very special return. Drops back into the execution loop with
+     * the call on the execution stack.
+     */
+    return 0;
+}
+
+static cfunc closure_invoke{SS(closure), f_closure_invoke};
+
+/*
+ * callable = closure(callable, args...)
+ *
+ * Returns a callable that calls the given callable with the given
+ * arguments followed by any given in the call. Only the callable and
+ * the arguments are retained.
+ */
+static int f_closure()
+{
+    if (NARGS() < 1)
+    {
+        return argcount(1);
+    }
+    if (!ARG(0)->can_call())
+    {
+        return argerror(0);
+    }
+    auto a = make_ref(new_array(NARGS()));
+    if (!a)
+    {
+        return 1;
+    }
+    for (int i = 0; i < NARGS(); ++i)
+    {
+        a->push(ARG(i));
+    }
+    return ret_with_decref(new_method(a, &closure_invoke));
+}
+
 static int f_fail()
 {
     const char *s = "failed";
@@ -2379,6 +2501,13 @@ static int f_del()
     {
         unassign(setof(s), o);
     }
+    else if (ispmap(s) || ispset(s))
+    {
+        if (pmap_unassign(pmapof(s), o))
+        {
+            return 1;
+        }
+    }
     else if (isarray(s))
     {
         array    *a;
@@ -2395,6 +2524,10 @@ static int f_del()
         {
             return set_error("attempt to modify to an atomic array");
         }
+        if (a->unshare())
+        {
+            return 1;
+        }
         i = intof(o)->i_value;
         n = a->len();
         if (i < 0 || i >= n)
@@ -3317,6 +3450,10 @@ static int f_sort()
     {
         return set_error("attempt to sort an atomic array");
     }
+    if (a->unshare())
+    {
+        return 1;
+    }
 
     n = a->len();
     if (a->a_bot > a->a_top)
@@ -3488,6 +3625,29 @@ static int f_reclaim()
     return null_ret();
 }
 
+/*
+ * copycounts()
+ *
+ * Returns a map of the counts of copies of maps and arrays that share
+ * the original's storage, copy-on-write: "shared", the number of copies
+ * made, "split", the number of times shared storage was split because
+ * it was to be written, and "unwritten", the difference.
+ */
+static ref<map> f_copycounts()
+{
+    ref<map> m = new_map();
+    long     shared = long(cow_shared);
+    long     split = long(cow_split);
+    long     unwritten = shared - split;
+
+    if (!m || set_val(m, SS(shared), 'i', &shared) || set_val(m, SS(split), 'i', &split) ||
+        set_val(m, SS(unwritten), 'i', &unwritten))
+    {
+        return nullptr;
+    }
+    return m;
+}
+
 static int f_abs()
 {
     if (isint(ARG(0)))
@@ -5111,24 +5271,28 @@ ICI_DEFINE_CFUNCS(std)
 {
     ICI_DEFINE_CFUNC(array, f_array),
     ICI_DEFINE_CFUNC(copy, f_copy),
+    ICI_DEFINE_CFUNC(copycounts, ICI_TYPED_CFUNC(f_copycounts)),
     ICI_DEFINE_CFUNC(exit, f_exit),
     ICI_DEFINE_CFUNC(fail, f_fail),
     ICI_DEFINE_CFUNC(float, f_float),
     ICI_DEFINE_CFUNC(float32, f_float32),
-    ICI_DEFINE_CFUNC(int, f_int),
+    ICI_DEFINE_CFUNC(int, ICI_TYPED_CFUNC(f_int)),
     ICI_DEFINE_CFUNC(eq, f_eq),
     ICI_DEFINE_CFUNC(parse, f_parse),
-    ICI_DEFINE_CFUNC(string, f_string),
+    ICI_DEFINE_CFUNC(string, ICI_TYPED_CFUNC(f_string)),
     ICI_DEFINE_CFUNC(map, f_map),
     ICI_DEFINE_CFUNC(set, f_set),
+    ICI_DEFINE_CFUNC(pmap, f_pmap),
+    ICI_DEFINE_CFUNC(pset, f_pset),
+    ICI_DEFINE_CFUNC(pvec, f_pvec),
     ICI_DEFINE_CFUNC(typeof, f_typeof),
-    ICI_DEFINE_CFUNC(push, f_push),
+    ICI_DEFINE_CFUNC(push, ICI_TYPED_CFUNC(f_push)),
     ICI_DEFINE_CFUNC(pop, f_pop),
     ICI_DEFINE_CFUNC(rpush, f_rpush),
     ICI_DEFINE_CFUNC(rpop, f_rpop),
     ICI_DEFINE_CFUNC(reserve, f_reserve),
     ICI_DEFINE_CFUNC(call, f_call),
-    ICI_DEFINE_CFUNC(keys, f_keys),
+    ICI_DEFINE_CFUNC(keys, ICI_TYPED_CFUNC(f_keys)),
     ICI_DEFINE_CFUNC(vstack, f_vstack),
     ICI_DEFINE_CFUNC(tochar, f_tochar),
     ICI_DEFINE_CFUNC(toint, f_toint),
@@ -5145,7 +5309,7 @@ ICI_DEFINE_CFUNCS(std)
     ICI_DEFINE_CFUNC(del, f_del),
     ICI_DEFINE_CFUNC(alloc, f_alloc),
     ICI_DEFINE_CFUNC(mem, f_mem),
-    ICI_DEFINE_CFUNC(len, f_len),
+    ICI_DEFINE_CFUNC(len, ICI_TYPED_CFUNC(f_len)),
     ICI_DEFINE_CFUNC(super, f_super),
     ICI_DEFINE_CFUNC(scope, f_scope),
     ICI_DEFINE_CFUNC(isatom, f_isatom),
@@ -5206,7 +5370,7 @@ ICI_DEFINE_CFUNCS(std)
     ICI_DEFINE_CFUNC2(print, f_coreici, SS(print), SS(core7)),
     ICI_DEFINE_CFUNC2(sprint, f_coreici, SS(sprint), SS(core7)),
     ICI_DEFINE_CFUNC2(println, f_coreici, SS(println), SS(core7)),
-    ICI_DEFINE_CFUNC2(closure, f_coreici, SS(closure), SS(core8)),
+    ICI_DEFINE_CFUNC(closure, f_closure),
     ICI_DEFINE_CFUNC2(format_time, f_coreici, SS(format_time), SS(core9)),
     ICI_DEFINE_CFUNC1(printf, ici_f_sprintf, 1),
     ICI_DEFINE_CFUNC(getchar, f_getchar),
@@ -4,10 +4,16 @@
 #define ICI_CFUNC_H
 
 #include "array.h"
+#include "float.h"
 #include "int.h"
+#include "map.h"
 #include "object.h"
 #include "str.h"
 
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 namespace ici
 {
 
@@ -222,6 +228,245 @@ public:
  * End of ici.h export. --ici.h-end--
  */
 
+/*
+ * Typed cfuncs.
+ *
+ * ICI_TYPED_CFUNC(f) is a cfunc implementation, for use with
+ * ICI_DEFINE_CFUNC, that calls the C++ function f with its arguments
+ * checked and converted according to f's parameter types, and returns
+ * f's result according to its return type. The checks are generated
+ * at compile time in place of a typecheck() format. For example
+ *
+ *      static object *f_push(array *a, object *o);
+ *
+ *      ICI_DEFINE_CFUNC(push, ICI_TYPED_CFUNC(f_push)),
+ *
+ * Parameters may be of type:
+ *
+ * object *             Any object, as typecheck()'s 'o'.
+ * int64_t              An int, as 'i'.
+ * double               An int or a float, as 'n'.
+ * str *                A string, as 'q'.
+ * const char *         A string's characters, as 's'.
+ * array *              An array, as 'a'.
+ * map *                A map, as 'd'.
+ * optarg<T>            An optional argument of one of the above types.
+ *                      These must follow all the others.
+ *
+ * f may return:
+ *
+ * int64_t              An int.
+ * double               A float.
+ * object *             The object, which is not decref'd. nullptr for
+ *                      an error, usual conventions.
+ * ref<T>               The object, which is decref'd. An empty ref for
+ *                      an error, usual conventions.
+ * void                 NULL.
+ *
+ * Argument count and type errors are reported as by typecheck().
+ */
+template <typename T> struct optarg
+{
+    T    value;
+    bool given;
+
+    optarg() : value(), given(false)
+    {
+    }
+};
+
+template <typename T> struct cfunc_arg;
+
+template <> struct cfunc_arg<object *>
+{
+    static bool get(object *o, object *&v)
+    {
+        v = o;
+        return true;
+    }
+};
+
+template <> struct cfunc_arg<int64_t>
+{
+    static bool get(object *o, int64_t &v)
+    {
+        if (!isint(o))
+        {
+            return false;
+        }
+        v = intof(o)->i_value;
+        return true;
+    }
+};
+
+template <> struct cfunc_arg<double>
+{
+    static bool get(object *o, double &v)
+    {
+        if (isint(o))
+        {
+            v = double(intof(o)->i_value);
+            return true;
+        }
+        if (isfloat(o))
+        {
+            v = floatof(o)->f_value;
+            return true;
+        }
+        return false;
+    }
+};
+
+template <> struct cfunc_arg<str *>
+{
+    static bool get(object *o, str *&v)
+    {
+        if (!isstring(o))
+        {
+            return false;
+        }
+        v = stringof(o);
+        return true;
+    }
+};
+
+template <> struct cfunc_arg<const char *>
+{
+    static bool get(object *o, const char *&v)
+    {
+        if (!isstring(o))
+        {
+            return false;
+        }
+        v = stringof(o)->s_chars;
+        return true;
+    }
+};
+
+template <> struct cfunc_arg<array *>
+{
+    static bool get(object *o, array *&v)
+    {
+        if (!isarray(o))
+        {
+            return false;
+        }
+        v = arrayof(o);
+        return true;
+    }
+};
+
+template <> struct cfunc_arg<map *>
+{
+    static bool get(object *o, map *&v)
+    {
+        if (!ismap(o))
+        {
+            return false;
+        }
+        v = mapof(o);
+        return true;
+    }
+};
+
+template <typename T> struct cfunc_arg<optarg<T>>
+{
+    static bool get(object *o, optarg<T> &v)
+    {
+        v.given = true;
+        return cfunc_arg<T>::get(o, v.value);
+    }
+};
+
+template <typename T> struct cfunc_isoptarg
+{
+    static constexpr int value = 0;
+};
+
+template <typename T> struct cfunc_isoptarg<optarg<T>>
+{
+    static constexpr int value = 1;
+};
+
+inline int cfunc_result(int64_t v)
+{
+    return ret_with_decref(new_int(v));
+}
+
+inline int cfunc_result(double v)
+{
+    return ret_with_decref(new_float(v));
+}
+
+inline int cfunc_result(object *o)
+{
+    return ret_no_decref(o);
+}
+
+template <typename T> inline int cfunc_result(ref<T> o)
+{
+    return ret_with_decref(o.release());
+}
+
+template <typename F, F f> struct typed_cfunc;
+
+template <typename R, typename... A, R (*f)(A...)> struct typed_cfunc<R (*)(A...), f>
+{
+    static constexpr int nargs = sizeof...(A);
+
+    template <typename... T> static constexpr int count_optargs()
+    {
+        int n = 0;
+        for (int i : {0, cfunc_isoptarg<T>::value...})
+        {
+            n += i;
+        }
+        return n;
+    }
+
+    static constexpr int nrequired = nargs - count_optargs<A...>();
+
+    template <size_t... I> static int invoke(std::index_sequence<I...>)
+    {
+        std::tuple<A...> args;
+        int              n = NARGS();
+        int              bad = -1;
+
+        (void)std::initializer_list<int>{
+            (bad < 0 && int(I) < n && !cfunc_arg<A>::get(ARG(int(I)), std::get<I>(args)) ? (bad = int(I)) : 0)...};
+        if (bad >= 0)
+        {
+            return argerror(bad);
+        }
+        return result(std::get<I>(args)...);
+    }
+
+    template <typename S = R, typename... T>
+    static typename std::enable_if<!std::is_void<S>::value, int>::type result(T &...args)
+    {
+        return cfunc_result((*f)(args...));
+    }
+
+    template <typename S = R, typename... T>
+    static typename std::enable_if<std::is_void<S>::value, int>::type result(T &...args)
+    {
+        (*f)(args...);
+        return null_ret();
+    }
+
+    static int call()
+    {
+        int n = NARGS();
+        if (n < nrequired || n > nargs)
+        {
+            return nrequired == nargs ? argcount(nargs) : argcount2(nrequired, nargs);
+        }
+        return invoke(std::index_sequence_for<A...>());
+    }
+};
+
+#define ICI_TYPED_CFUNC(FUNC) (&ici::typed_cfunc<decltype(&FUNC), &FUNC>::call)
+
 } // namespace ici
 
 #endif /* ICI_CFUNC_H */
@@ -1,5 +1,7 @@
 #define ICI_CORE
 #include "array.h"
+#include "exec.h"
+#include "float.h"
 #include "fwd.h"
 #include "int.h"
 #include "null.h"
@@ -65,6 +67,195 @@ static object *new_binop(int op, int why)
     return o;
 }
 
+/*
+ * Set by the -O command line switch. When set the parser folds constant
+ * sub-expressions with fold_expr() and drops the dead branch of an if
+ * statement whose condition is a literal.
+ *
+ * This --variable-- forms part of the --ici-api--.
+ */
+bool optimize;
+
+/*
+ * Is the expression a literal int, float or string?
+ */
+static bool isliteral(expr *e)
+{
+    return e != nullptr && (e->e_what == T_INT || e->e_what == T_FLOAT || e->e_what == T_STRING);
+}
+
+/*
+ * Can the expression, whose operands are all literals, be evaluated
+ * now? Only operators without side effects are, and those that would
+ * raise an error are left for run-time to raise it.
+ */
+static bool isfoldable(expr *e)
+{
+    if (e->e_arg[1] == nullptr)
+    {
+        switch (e->e_what)
+        {
+        case T_MINUS:
+        case T_TILDE:
+        case T_EXCLAM:
+            return e->e_arg[0]->e_what != T_STRING;
+        }
+        return false;
+    }
+    switch (e->e_what)
+    {
+    case T_SLASH:
+    case T_PERCENT:
+        if (e->e_arg[1]->e_obj == o_zero || (isfloat(e->e_arg[1]->e_obj) && floatof(e->e_arg[1]->e_obj)->f_value == 0.0))
+        {
+            return false;
+        }
+        /* Fall through. */
+    case T_ASTERIX:
+    case T_MINUS:
+    case T_GRTGRT:
+    case T_LESSLESS:
+    case T_AND:
+    case T_CARET:
+    case T_BAR:
+        return e->e_arg[0]->e_what != T_STRING && e->e_arg[1]->e_what != T_STRING;
+
+    case T_PLUS:
+    case T_LESS:
+    case T_GRT:
+    case T_LESSEQ:
+    case T_GRTEQ:
+    case T_EQEQ:
+    case T_EXCLAMEQ:
+        return (e->e_arg[0]->e_what == T_STRING) == (e->e_arg[1]->e_what == T_STRING);
+    }
+    return false;
+}
+
+/*
+ * Replace the expression 'e' with 'v', freeing its sub-expressions.
+ * Takes ownership of the reference to 'v'.
+ */
+static void replace_expr(expr *e, object *v)
+{
+    free_expr(e->e_arg[0]);
+    free_expr(e->e_arg[1]);
+    if (e->e_obj != nullptr)
+    {
+        decref(e->e_obj);
+    }
+    e->e_arg[0] = nullptr;
+    e->e_arg[1] = nullptr;
+    e->e_obj = v;
+    if (isint(v))
+    {
+        e->e_what = T_INT;
+    }
+    else if (isfloat(v))
+    {
+        e->e_what = T_FLOAT;
+    }
+    else if (isstring(v))
+    {
+        e->e_what = T_STRING;
+    }
+    else
+    {
+        e->e_what = T_CONST;
+    }
+}
+
+/*
+ * Replace the expression 'e' with its sub-expression 'sub', which has
+ * been detached from the tree.
+ */
+static void hoist_expr(expr *e, expr *sub)
+{
+    replace_expr(e, null);
+    *e = *sub;
+    ici_tfree(sub, expr);
+}
+
+/*
+ * Fold constant sub-expressions of the expression tree 'e' in place.
+ * Operators applied to literal operands are evaluated and replaced by
+ * their result, "? :" with a literal condition is replaced by the branch
+ * it selects, and "&&" and "||" with a literal left operand are replaced
+ * by the operand that gives their value. Anything that fails to
+ * evaluate is left to fail at run-time.
+ *
+ * Returns 1 on failure, 0 on success.
+ */
+int fold_expr(expr *e)
+{
+    if (e == nullptr)
+    {
+        return 0;
+    }
+    if (fold_expr(e->e_arg[0]) || fold_expr(e->e_arg[1]))
+    {
+        return 1;
+    }
+    if (e->e_what == T_QUESTION)
+    {
+        auto c = e->e_arg[1];
+        if (c->e_what != T_COLON)
+        {
+            return set_error("syntax error in \"? :\" use");
+        }
+        if (!isliteral(e->e_arg[0]))
+        {
+            return 0;
+        }
+        auto i = isfalse(e->e_arg[0]->e_obj) ? 1 : 0;
+        auto sub = c->e_arg[i];
+        c->e_arg[i] = nullptr;
+        hoist_expr(e, sub);
+        return 0;
+    }
+    if ((e->e_what == T_ANDAND || e->e_what == T_BARBAR) && isliteral(e->e_arg[0]))
+    {
+        /*
+         * The value is the left operand if it decides the result, else
+         * the right operand.
+         */
+        const auto i = isfalse(e->e_arg[0]->e_obj) == (e->e_what == T_ANDAND) ? 0 : 1;
+        auto sub = e->e_arg[i];
+        e->e_arg[i] = nullptr;
+        hoist_expr(e, sub);
+        return 0;
+    }
+    if (e->e_what == T_PLUS && e->e_arg[1] == nullptr && e->e_arg[0] != nullptr)
+    {
+        auto sub = e->e_arg[0];
+        e->e_arg[0] = nullptr;
+        hoist_expr(e, sub);
+        return 0;
+    }
+    if (!isliteral(e->e_arg[0]) || (e->e_arg[1] != nullptr && !isliteral(e->e_arg[1])) || !isfoldable(e))
+    {
+        return 0;
+    }
+    ref<array> a;
+    if ((a = new_array()) == nullptr)
+    {
+        return 1;
+    }
+    if (compile_expr(a, e, FOR_VALUE) || a->push_checked(&o_end))
+    {
+        return 1;
+    }
+    if (auto v = evaluate(a, 0))
+    {
+        replace_expr(e, v);
+    }
+    else
+    {
+        clear_error();
+    }
+    return 0;
+}
+
 /*
  * Compile the expression into the code array, for the reason given.
  * Returns 1 on failure, 0 on success.
@@ -354,6 +545,7 @@ int compile_expr(array *a, expr *e, int why)
                 decref(a1);
                 return 1;
             }
+            parse_value(e->e_obj);
             decref(a1);
         }
             /* Fall through. */
@@ -6,6 +6,7 @@
 
 #define NOEVENTS
 #define ICI_HAS_BSD_STRUCT_TM
+#define ICI_HAS_UCONTEXT
 #define CONFIG_STR "FreeBSD"
 
 #define  UNLIKELY(X) __builtin_expect((X), 0)
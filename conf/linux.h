@@ -12,6 +12,7 @@
  */
 
 #define ICI_HAS_BSD_STRUCT_TM
+#define ICI_HAS_UCONTEXT
 #define ICI_SW_CRC
 
 /*
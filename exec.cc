@@ -21,6 +21,9 @@
 #include "str.h"
 #include "userop.h"
 #include "vec.h"
+#ifndef NOPROFILE
+#include "profile.h"
+#endif
 #include <signal.h>
 
 namespace ici
@@ -337,6 +340,12 @@ object *evaluate(object *code, int n_operands)
             {
                 invoke_signal_handlers();
             }
+#ifndef NOPROFILE
+            if (UNLIKELY(profile_ticks != 0))
+            {
+                profile_sample();
+            }
+#endif
         }
 
         /*
@@ -394,6 +403,12 @@ continue_with_same_pc:
         {
         case TC_SRC:
             ex->x_src = srcof(o);
+#ifndef NOPROFILE
+            if (UNLIKELY(opcount_active))
+            {
+                opcount_line(srcof(o));
+            }
+#endif
             if (UNLIKELY(debug_active))
             {
                 xs.push(o); /* Restore formal state. */
@@ -543,6 +558,12 @@ continue_with_same_pc:
 
         case TC_OP:
 an_op:
+#ifndef NOPROFILE
+            if (UNLIKELY(opcount_active))
+            {
+                opcount_op(opof(o));
+            }
+#endif
             switch (opof(o)->op_ecode)
             {
             case OP_OTHER:
@@ -670,6 +691,39 @@ do_call:
                 // if (UNLIKELY(debug_active)) {
                 //     debugger->function_call(os.a_top[-1], ARGS(), NARGS());
                 // }
+                if ((opof(xs.a_top[-1])->op_code & OPC_TAIL_CALL) != 0 && isfunc(os.a_top[-1]) && ispc(xs.a_top[-2]) &&
+                    ismark(xs.a_top[-3]) && !debug_active
+#ifndef NOPROFILE
+                    && !profile_active
+#endif
+                )
+                {
+                    /*
+                     * A call whose result is returned, made directly from
+                     * the function's body (not within a loop, try etc.).
+                     * The caller's frame, its source marker, mark and pc on
+                     * xs and its autos on vs, is replaced by the callee's,
+                     * so tail recursion runs in constant stack space.
+                     */
+                    object *sr = xs.a_top[-4];
+
+                    xs.a_top -= 3;
+                    --vs.a_top;
+                    if (os.a_top[-1]->call(o))
+                    {
+                        if (o != nullptr)
+                        {
+                            decref(o);
+                        }
+                        goto fail;
+                    }
+                    xs.a_top[-3] = sr;
+                    if (o != nullptr)
+                    {
+                        decref(o);
+                    }
+                    continue;
+                }
                 if (os.a_top[-1]->call(o))
                 {
                     if (o != nullptr)
@@ -46,6 +46,8 @@ struct exec : object
      * End of ici.h export. --ici.h-end--
      */
     std::condition_variable *x_semaphore;
+    struct task             *x_task; /* Non-null if a green thread, see thread.cc. */
+    exec                    *x_waitnext; /* Next in x_waitfor's wait list, see thread.cc. */
     char                     x_buf[1024 - 16 * sizeof(int)]; // space for x_error
     /*
      * The following portion of this file exports to ici.h. --ici.h-start--
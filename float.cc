@@ -17,28 +17,34 @@ namespace ici
  */
 ici_float *new_float(double v)
 {
-    ici_float       *f;
-    object         **po;
-    static ici_float proto;
+    object  *o;
+    object **po;
 
-    proto.f_value = v;
-    if (auto x = atom_probe2(&proto, &po))
+    /*
+     * As new_int(), an in-line probe of the atom pool. See also the
+     * in-line float creation in binop.h.
+     */
+    const auto h = hash_float(v);
+    for (po = &atoms[atom_hash_index(h)]; (o = *po) != nullptr; --po < atoms ? po = atoms + atomsz - 1 : nullptr)
     {
-        f = floatof(x);
-        incref(f);
-        return f;
+        if (isfloat(o) && DBL_BIT_CMP(&floatof(o)->f_value, &v))
+        {
+            incref(o);
+            return floatof(o);
+        }
     }
     ++supress_collect;
-    if ((f = ici_talloc(ici_float)) == nullptr)
+    if ((o = ici_talloc(ici_float)) == nullptr)
     {
+        --supress_collect;
         return nullptr;
     }
-    set_tfnz(f, TC_FLOAT, object::O_ATOM, 1, sizeof(ici_float));
-    f->f_value = v;
-    rego(f);
+    set_tfnz(o, TC_FLOAT, object::O_ATOM, 1, sizeof(ici_float));
+    floatof(o)->f_value = v;
+    rego(o);
     --supress_collect;
-    store_atom_and_count(po, f);
-    return f;
+    store_atom_and_count(po, o);
+    return floatof(o);
 }
 
 int float_type::cmp(object *o1, object *o2)
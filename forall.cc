@@ -1,11 +1,23 @@
 #define ICI_CORE
 #include "forall.h"
+#include "array.h"
 #include "exec.h"
+#include "map.h"
 #include "null.h"
+#include "set.h"
 
 namespace ici
 {
 
+/*
+ * Maps, sets and arrays step by their types' step functions, without a
+ * virtual call. Any other type steps by its forall method.
+ */
+static int step_type(forall *fa)
+{
+    return fa->fa_aggr->icitype()->forall(fa);
+}
+
 /*
  * va vk ka kk aggr code        => (os)
  *                              => forall (xs)
@@ -32,6 +44,24 @@ int op_forall()
     fa->fa_kaggr = *--os.a_top;
     fa->fa_vkey = *--os.a_top;
     fa->fa_vaggr = *--os.a_top;
+    switch (fa->fa_aggr->o_tcode)
+    {
+    case TC_MAP:
+        fa->fa_step = map_type::step;
+        break;
+
+    case TC_SET:
+        fa->fa_step = set_type::step;
+        break;
+
+    case TC_ARRAY:
+        fa->fa_step = array_type::step;
+        break;
+
+    default:
+        fa->fa_step = step_type;
+        break;
+    }
     xs.a_top[-1] = fa;
     rego(fa);
     return 0;
@@ -44,12 +74,9 @@ int op_forall()
  */
 int exec_forall()
 {
-    forall *fa;
-    type   *t;
+    auto fa = forallof(xs.a_top[-1]);
 
-    fa = forallof(xs.a_top[-1]);
-    t = fa->fa_aggr->icitype();
-    switch (t->forall(fa))
+    switch (fa->fa_step(fa))
     {
     case 0:
         set_pc(arrayof(fa->fa_code), xs.a_top);
@@ -3,7 +3,9 @@
 #ifndef ICI_FORALL_H
 #define ICI_FORALL_H
 
+#include "map.h"
 #include "object.h"
+#include "str.h"
 
 namespace ici
 {
@@ -11,8 +13,15 @@ namespace ici
 /*
  * The following portion of this file exports to ici.h. --ici.h-start--
  */
+/*
+ * The state of a running forall loop. fa_step is chosen, by the type of
+ * the aggregate, when the loop starts. It advances fa_index to the next
+ * element and assigns the loop variables. It returns 0 if there was one,
+ * -1 at the end of the aggregate, and 1 on error, usual conventions.
+ */
 struct forall : object
 {
+    int   (*fa_step)(forall *);
     size_t  fa_index;
     object *fa_aggr;
     object *fa_code;
@@ -35,6 +44,25 @@ inline bool isforall(object *o)
  * End of ici.h export. --ici.h-end--
  */
 
+/*
+ * Assign a loop variable, as the steps of maps, sets and arrays do.
+ * The variables are almost always autos named by strings and, after
+ * the first assignment, the string's lookaside refers directly to the
+ * variable's slot. That slot is used while the lookaside stays valid
+ * (as OP_ASSIGN does) and the general assignment re-establishes it
+ * otherwise.
+ */
+inline int forall_assign(object *aggr, object *key, object *v)
+{
+    if (isstring(key) && stringof(key)->s_map == aggr && stringof(key)->s_vsver == vsver &&
+        !key->hasflag(ICI_S_LOOKASIDE_IS_ATOM))
+    {
+        stringof(key)->s_slot->sl_value = v;
+        return 0;
+    }
+    return ici_assign(aggr, key, v);
+}
+
 class forall_type : public type
 {
 public:
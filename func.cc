@@ -9,6 +9,7 @@
 #include "mark.h"
 #include "null.h"
 #include "op.h"
+#include "parse.h"
 #include "primes.h"
 #include "src.h"
 #include "str.h"
@@ -49,9 +50,17 @@ int op_return()
         debugger->function_result(os.a_top[-1]);
     }
 
-    x = xs.a_top - 1;
-    while (!ismark(*x) && --x >= xs.a_base && !(iscatcher(*x) && isnull(catcherof(*x)->c_catcher)))
-        ;
+    /*
+     * Usually the return is directly in the function's body and the
+     * function's frame, mark then pc, is just under us.
+     */
+    x = xs.a_top - 3;
+    if (x < xs.a_base || !ismark(*x))
+    {
+        x = xs.a_top - 1;
+        while (!ismark(*x) && --x >= xs.a_base && !(iscatcher(*x) && isnull(catcherof(*x)->c_catcher)))
+            ;
+    }
     if (x < xs.a_base || !ismark(*x))
     {
         return set_error("return not in function");
@@ -240,7 +249,7 @@ int func_type::call(object *o, object *subject)
     va = nullptr;
     if (UNLIKELY(n > 0))
     {
-        if (LIKELY((sl = find_raw_slot(d, SS(vargs))) != nullptr && (va = new_array(n)) != nullptr))
+        if (LIKELY(unshare(d) == 0 && (sl = find_raw_slot(d, SS(vargs))) != nullptr && (va = new_array(n)) != nullptr))
         {
             /*
              * There are left-over actual parameters and a "vargs"
@@ -319,7 +328,17 @@ int func_type::save(archiver *ar, object *o)
     {
         return 1;
     }
-    return 0;
+    /*
+     * The function's scope is saved if it is part of the archive, as
+     * for a class's methods, else it is restored as the archiver's
+     * scope.
+     */
+    object *super = f->f_autos->o_super;
+    if (super == nullptr || super == ar->scope() || !ar->saved(super))
+    {
+        super = null;
+    }
+    return ar->save(super);
 }
 
 object *func_type::restore(archiver *ar)
@@ -328,6 +347,8 @@ object *func_type::restore(archiver *ar)
     object *args = nullptr;
     object *autos = nullptr;
     object *name = nullptr;
+    object *super = nullptr;
+    objwsup *scope;
     int32_t nautos;
     func   *fn;
     object *oname;
@@ -364,19 +385,58 @@ object *func_type::restore(archiver *ar)
     {
         goto fail;
     }
+    if ((super = ar->restore()) == nullptr)
+    {
+        goto fail;
+    }
+    if (!isnull(super) && !hassuper(super))
+    {
+        set_error("unexpected function scope type (%s)", super->type_name());
+        goto fail;
+    }
+
+    if (!ismap(autos))
+    {
+        set_error("unexpected function autos type (%s)", autos->type_name());
+        goto fail;
+    }
+    scope = isnull(super) ? ar->scope() : objwsupof(super);
+    if (mapof(autos)->o_super != scope)
+    {
+        if (autos->isatom())
+        {
+            /*
+             * Functions with equal autos share the restored atom, which
+             * may not then be given a scope. Use an atom with the scope.
+             */
+            object *a;
+
+            if ((a = autos->copy()) == nullptr)
+            {
+                goto fail;
+            }
+            mapof(a)->o_super = scope;
+            decref(autos);
+            autos = atom(a, 1);
+        }
+        else
+        {
+            mapof(autos)->o_super = scope;
+        }
+    }
 
     fn->f_code = arrayof(code);
     fn->f_args = arrayof(args);
     fn->f_autos = mapof(autos);
-    fn->f_autos->o_super = ar->scope(); /* mapof(vs.a_top[-1])->o_super; */
     fn->f_name = stringof(name);
     fn->f_nautos = nautos;
 
     decref(code);
     decref(args);
     decref(autos);
+    decref(super);
 
-    if (ici_assign(ar->scope(), name, fn))
+    if (isnull(super) && ar->defines() && isstring(name) && ici_assign(ar->scope(), name, fn))
     {
         decref(name);
         decref(fn);
@@ -404,6 +464,10 @@ fail:
     {
         decref(name);
     }
+    if (super)
+    {
+        decref(super);
+    }
     return nullptr;
 }
 
@@ -411,5 +475,8 @@ op o_return{op_return};
 op o_call{OP_CALL};
 op o_method_call{OP_METHOD_CALL};
 op o_super_call{OP_SUPER_CALL};
+op o_tail_call{OP_CALL, OPC_TAIL_CALL};
+op o_tail_method_call{OP_METHOD_CALL, OPC_TAIL_CALL};
+op o_tail_super_call{OP_SUPER_CALL, OPC_TAIL_CALL};
 
 } // namespace ici
@@ -289,6 +289,7 @@ extern void       uninit();
 extern void       atexit(void (*)(), wrap *);
 extern void       uninit_compile();
 extern void       uninit_cfunc();
+extern void       uninit_userop();
 extern object    *atom_probe(object *o);
 extern object    *atom(object *, int);
 extern void       reclaim();
@@ -447,6 +448,10 @@ extern void          clear_error();
 extern void          expand_error(int, str *);
 extern int           lex(parse *, array *);
 extern int           compile_expr(array *, expr *, int);
+extern int           fold_expr(expr *);
+extern void          parse_value(object *);
+extern void          free_expr(expr *);
+extern bool          optimize;
 extern int           set_issubset(set *, set *);
 extern int           set_ispropersubset(set *, set *);
 extern int64_t       xstrtol(char const *, char **, int);
@@ -64,6 +64,12 @@ int main(int argc, char *argv[], bool enable_repl)
     {
         goto fail;
     }
+#ifndef NOPROFILE
+    if (opcount_init())
+    {
+        goto fail;
+    }
+#endif
 
     /*
      * If there are no actual arguments enter the repl if
@@ -172,6 +178,10 @@ int main(int argc, char *argv[], bool enable_repl)
                         }
                         break;
 
+                    case 'O':
+                        optimize = true;
+                        continue;
+
                     case '0':
                     case '1':
                     case '2':
@@ -356,6 +366,9 @@ int main(int argc, char *argv[], bool enable_repl)
                     }
                     break;
 
+                case 'O':
+                    continue;
+
                 case '0':
                 case '1':
                 case '2':
@@ -393,6 +406,8 @@ int main(int argc, char *argv[], bool enable_repl)
     {
         profile_return();
     }
+    profile_sample_stop();
+    opcount_report();
 #endif
 
 #ifndef NDEBUG
@@ -403,7 +418,7 @@ int main(int argc, char *argv[], bool enable_repl)
 
 usage:
     fprintf(stderr, "usage1: %s file args...\n", argv[0]);
-    fprintf(stderr, "usage2: %s [-f file] [-] [-e prog] [-#] [-l mod] [-m name] [--] args...\n", argv[0]);
+    fprintf(stderr, "usage2: %s [-O] [-f file] [-] [-e prog] [-#] [-l mod] [-m name] [--] args...\n", argv[0]);
     fprintf(stderr, "usage3: %s [-h | -? | -v]\n", argv[0]);
     if (!help)
     {
@@ -418,6 +433,8 @@ usage:
         fprintf(stderr, "usage2:\n");
         fprintf(stderr, " Makes the ICI argv from the otherwise unused arguments, then processes the\n");
         fprintf(stderr, " following options in order. Repeats are allowed.\n");
+        fprintf(stderr, " -O       Folds constant expressions and drops dead if branches when\n");
+        fprintf(stderr, "          parsing.\n");
         fprintf(stderr, " -f file  Parses the ICI code in file.\n");
         fprintf(stderr, " -        Parses ICI code from standard input.\n");
         fprintf(stderr, " -e prog  Parses the text 'prog' directly.\n");
@@ -18,7 +18,7 @@
 namespace ici
 {
 
-constexpr size_t INITIAL_ATOMSZ = 1024; // Must be power of two
+constexpr size_t INITIAL_ATOMSZ = 2048; // Must be power of two, holds the startup atoms
 constexpr size_t INITIAL_OBJS = 4096;
 
 extern cfunc *ici_funcs[];
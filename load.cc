@@ -1,10 +1,17 @@
 #define ICI_CORE
+#include "archiver.h"
+#include "array.h"
 #include "buf.h"
 #include "cfunc.h"
 #include "file.h"
+#include "int.h"
 #include "map.h"
+#include "null.h"
+#include "parse.h"
 #include "str.h"
 
+#include <sys/stat.h>
+
 namespace ici
 {
 
@@ -69,6 +76,326 @@ objwsup *outermost_writeable()
     return outer;
 }
 
+/*
+ * Module caches
+ *
+ * If the environment variable ICI_CACHE names a directory, ICI modules
+ * loaded by load(), or auto-loaded, are cached there in compiled form.
+ * Later loads of an unchanged module, as judged by its modification time
+ * and size, run the cached code rather than parsing the source. A
+ * relative ICI_CACHE is relative to each module's own directory, so
+ * ICI_CACHE=. keeps caches beside their sources.
+ *
+ * A cache holds the archived units of the module's top-level code, as
+ * saved while it was parsed (see parse.cc). Running it runs the same
+ * code, and makes the same declarations, as parsing. The initialisers
+ * of the module's variables are evaluated again each time the cache is
+ * run. Modules with other work done at parse time, by $ expressions or
+ * the initialisers of function's variables, are not cached as its
+ * results may differ from one run to the next.
+ */
+static const char cache_magic[4] = {'I', 'C', 'I', 'C'};
+
+struct cache_header
+{
+    char    c_magic[4];
+    int64_t c_mtime;
+    int64_t c_size;
+};
+
+/*
+ * Form the name of the cache for the module source file 'fname' in
+ * 'path', which must be FILENAME_MAX chars. Returns false if there is
+ * no cache.
+ */
+static bool cache_name(char *path, const char *fname)
+{
+    char        real[FILENAME_MAX];
+    const char *dir;
+    const char *base;
+    size_t      n;
+
+    if ((dir = getenv("ICI_CACHE")) == nullptr || *dir == '\0' || realpath(fname, real) == nullptr)
+    {
+        return false;
+    }
+    base = strrchr(real, '/') + 1;
+    if (*dir == '/')
+    {
+        /*
+         * A single directory for all modules, so the cache's name is the
+         * source's full path with its separators replaced.
+         */
+        n = snprintf(path, FILENAME_MAX, "%s/%sc", dir, real + 1);
+        if (n >= FILENAME_MAX)
+        {
+            return false;
+        }
+        for (char *p = path + strlen(dir) + 1; *p != '\0'; ++p)
+        {
+            if (*p == '/')
+            {
+                *p = '%';
+            }
+        }
+        return true;
+    }
+    n = snprintf(path, FILENAME_MAX, "%.*s%s/%sc", int(base - real), real, dir, base);
+    return n < FILENAME_MAX;
+}
+
+static void cache_header_for(cache_header *h, const struct stat *st)
+{
+    memset(h, 0, sizeof *h);
+    memcpy(h->c_magic, cache_magic, sizeof cache_magic);
+#if defined(__APPLE__)
+    h->c_mtime = int64_t(st->st_mtimespec.tv_sec) * 1000000000 + st->st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    h->c_mtime = int64_t(st->st_mtim.tv_sec) * 1000000000 + st->st_mtim.tv_nsec;
+#else
+    h->c_mtime = int64_t(st->st_mtime);
+#endif
+    h->c_size = int64_t(st->st_size);
+}
+
+/*
+ * Name the module's scopes as the externals of the archiver.
+ */
+static int cache_externals(archiver *ar, objwsup *autos, bool saving)
+{
+    objwsup *s = autos;
+    for (size_t i = 1; s != nullptr && i <= ARCHIVE_NEXTERNALS; ++i, s = s->o_super)
+    {
+        if (saving ? ar->save_external(s, i) : ar->restore_external(i, s))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Restore the units of a module's cache. Returns nullptr, with no error
+ * set, if the cache can't be used.
+ */
+static array *restore_cache(const char *path, const struct stat *st, objwsup *autos)
+{
+    cache_header want;
+    cache_header got;
+    FILE        *stream;
+    file        *f;
+    object      *o;
+
+    if ((stream = fopen(path, "rb")) == nullptr)
+    {
+        return nullptr;
+    }
+    cache_header_for(&want, st);
+    if (fread(&got, sizeof got, 1, stream) != 1 || memcmp(&got, &want, sizeof got) != 0)
+    {
+        fclose(stream);
+        return nullptr;
+    }
+    if ((f = new_file((char *)stream, stdio_ftype, str_get_nul_term(path), nullptr)) == nullptr)
+    {
+        fclose(stream);
+        clear_error();
+        return nullptr;
+    }
+    ref<array> units = new_array();
+    {
+        archiver ar(f, autos->o_super);
+        if (!units || !ar || cache_externals(&ar, autos, false) || ar.begin_sequence_restore())
+        {
+            units = nullptr;
+        }
+        else
+        {
+            ar.defines(false);
+            while ((o = ar.restore()) != nullptr && !isnull(o))
+            {
+                if (units->push_checked(o, with_decref))
+                {
+                    o = nullptr;
+                    break;
+                }
+            }
+            if (o == nullptr || ar.end_sequence_restore())
+            {
+                units = nullptr;
+            }
+        }
+    }
+    close_file(f);
+    decref(f);
+    clear_error();
+    return units.release();
+}
+
+/*
+ * Run the units of a module's cache in its scope. Returns 0 on success,
+ * 1 on error, usual conventions.
+ */
+static int run_cache(array *units, objwsup *autos)
+{
+    for (auto po = units->a_base; po < units->a_top; ++po)
+    {
+        if (isarray(*po))
+        {
+            vs.push(autos);
+            object *o = evaluate(*po, 0);
+            --vs.a_top;
+            if (o == nullptr)
+            {
+                return 1;
+            }
+            decref(o);
+            continue;
+        }
+        if (!isint(*po) || po + 2 >= units->a_top)
+        {
+            return set_error("invalid module cache");
+        }
+        auto kind = cache_decl_kind(intof(*po)->i_value);
+        auto level = cache_decl_level(intof(*po)->i_value);
+        auto n = po[1];
+        auto v = po[2];
+        po += 2;
+        if (level < 0 || (kind != CACHE_DECL_INIT && kind != CACHE_DECL_NOINIT && kind != CACHE_DECL_CODE))
+        {
+            return set_error("invalid module cache");
+        }
+        if (kind == CACHE_DECL_CODE)
+        {
+            /*
+             * The initialiser's code, evaluated as it was when parsed.
+             */
+            if (!isarray(v))
+            {
+                return set_error("invalid module cache");
+            }
+            vs.push(autos);
+            v = evaluate(v, 0);
+            --vs.a_top;
+            if (v == nullptr)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            incref(v);
+        }
+        objwsup *s = autos;
+        for (auto i = level; i > 0 && s != nullptr; --i)
+        {
+            s = s->o_super;
+        }
+        if (s == nullptr)
+        {
+            decref(v);
+            return set_error("invalid module cache");
+        }
+        if (kind != CACHE_DECL_NOINIT || ici_fetch_base(s, n) == null)
+        {
+            if (ici_assign_base(s, n, v))
+            {
+                decref(v);
+                return 1;
+            }
+        }
+        decref(v);
+    }
+    return 0;
+}
+
+/*
+ * Parse the module source 'f', from the file 'fname', in the scope
+ * 'autos' writing its cache to 'path'. The cache is written to a
+ * temporary file renamed into place once complete, and is abandoned
+ * on any error. Returns non-zero on error, usual conventions.
+ */
+static int parse_and_cache(file *f, objwsup *autos, const char *path, const struct stat *st)
+{
+    char         tmp[FILENAME_MAX];
+    cache_header h;
+    FILE        *stream;
+    file        *cf;
+    parse       *p;
+    object      *o;
+    bool         ok;
+
+    if (snprintf(tmp, sizeof tmp, "%s.%ld", path, long(getpid())) >= int(sizeof tmp) ||
+        (stream = fopen(tmp, "wb")) == nullptr)
+    {
+        return parse_file(f, autos);
+    }
+    cache_header_for(&h, st);
+    if (fwrite(&h, sizeof h, 1, stream) != 1 ||
+        (cf = new_file((char *)stream, stdio_ftype, str_get_nul_term(tmp), nullptr)) == nullptr)
+    {
+        fclose(stream);
+        unlink(tmp);
+        clear_error();
+        return parse_file(f, autos);
+    }
+    archiver ar(cf, autos->o_super);
+    ok = ar && !cache_externals(&ar, autos, true) && !ar.begin_sequence_save();
+    clear_error();
+    if ((p = new_parse(f)) == nullptr)
+    {
+        close_file(cf);
+        decref(cf);
+        unlink(tmp);
+        return -1;
+    }
+    p->p_archiver = ok ? &ar : nullptr;
+    vs.push(autos);
+    o = evaluate(p, 0);
+    --vs.a_top;
+    ok = p->p_archiver != nullptr;
+    p->p_archiver = nullptr;
+    decref(p);
+    if (o == nullptr)
+    {
+        close_file(cf);
+        decref(cf);
+        unlink(tmp);
+        return -1;
+    }
+    decref(o);
+    ok = ok && !ar.save(null) && !ar.end_sequence_save();
+    ok = !close_file(cf) && ok;
+    decref(cf);
+    if (!ok || rename(tmp, path) == -1)
+    {
+        unlink(tmp);
+    }
+    clear_error();
+    return 0;
+}
+
+/*
+ * Parse the ICI module source 'f', opened from the file 'fname', in the
+ * scope 'autos', using and maintaining its cache, if module caching is
+ * on. Returns non-zero on error, usual conventions.
+ */
+static int parse_module(file *f, objwsup *autos, const char *fname)
+{
+    char        path[FILENAME_MAX];
+    struct stat st;
+
+    if (!cache_name(path, fname) || stat(fname, &st) == -1)
+    {
+        return parse_file(f, autos);
+    }
+    if (auto units = make_ref(restore_cache(path, &st, autos)))
+    {
+        return run_cache(units, autos);
+    }
+    return parse_and_cache(f, autos, path, &st);
+}
+
 /*
  * any = load(string)
  *
@@ -248,7 +575,7 @@ static int f_load(...)
         }
         statics->o_super = objwsupof(externs);
         externs->o_super = outer;
-        if (parse_file(file, objwsupof(autos)) < 0)
+        if (parse_module(file, objwsupof(autos), fname))
         {
             goto fail;
         }
@@ -73,6 +73,7 @@ map *new_map()
     set_tfnz(s, TC_MAP, object::O_SUPER, 1, 0);
     s->o_super = nullptr;
     s->s_slots = nullptr;
+    s->s_shared = nullptr;
     s->s_nels = 0;
     s->s_nslots = 4; /* Must be power of 2. */
     if ((s->s_slots = (slot *)ici_nalloc(4 * sizeof(slot))) == nullptr)
@@ -158,6 +159,37 @@ static int grow_map(map *s)
     return 0;
 }
 
+/*
+ * Give the map s its own copy of the slots it shares with other copies
+ * of the map. If no other map still shares them they are simply kept.
+ * Look-asides may refer to the shared slots, so are invalidated.
+ * Returns 1 on error, usual conventions.
+ */
+int split_map(map *s)
+{
+    auto ss = s->s_shared;
+
+    if (ss->ss_nrefs > 1)
+    {
+        auto sl = (slot *)ici_nalloc(s->s_nslots * sizeof(slot));
+        if (sl == nullptr)
+        {
+            return 1;
+        }
+        memcpy(sl, s->s_slots, s->s_nslots * sizeof(slot));
+        s->s_slots = sl;
+        release_store(ss);
+        ++cow_split;
+        ++vsver;
+    }
+    else
+    {
+        ici_tfree(ss, shared_store);
+    }
+    s->s_shared = nullptr;
+    return 0;
+}
+
 /*
  * Remove the key 'k' from the ICI struct object 's', ignoring super-structs.
  *
@@ -173,6 +205,14 @@ int unassign(map *s, object *k)
     {
         return 0;
     }
+    if (s->s_shared != nullptr)
+    {
+        if (split_map(s))
+        {
+            return 1;
+        }
+        ss = find_raw_slot(s, k);
+    }
     --s->s_nels;
     sl = ss;
     /*
@@ -243,7 +283,7 @@ int map_type::fetch_super(object *o, object *k, object **v, map *b)
                     stringof(k)->s_vsver = vsver;
                     stringof(k)->s_map = b;
                     stringof(k)->s_slot = sl;
-                    if (o->isatom())
+                    if (o->isatom() || mapof(o)->s_shared != nullptr)
                     {
                         k->set(ICI_S_LOOKASIDE_IS_ATOM);
                     }
@@ -309,7 +349,11 @@ size_t map_type::mark(object *o)
  */
 void map_type::free(object *o)
 {
-    if (mapof(o)->s_slots != nullptr)
+    if (mapof(o)->s_shared != nullptr)
+    {
+        release_store(mapof(o)->s_shared);
+    }
+    else if (mapof(o)->s_slots != nullptr)
     {
         ici_nfree(mapof(o)->s_slots, mapof(o)->s_nslots * sizeof(slot));
     }
@@ -398,7 +442,27 @@ object *map_type::copy(object *o)
     ns->s_nels = 0;
     ns->s_nslots = 0;
     ns->s_slots = nullptr;
+    ns->s_shared = nullptr;
     rego(ns);
+    if (s->s_nslots > COW_MIN_SLOTS)
+    {
+        /*
+         * Share the slots, copy-on-write. Look-asides may allow writes
+         * to the slots without checking, so they are invalidated.
+         */
+        auto ss = share_store(s->s_shared, s->s_slots, s->s_nslots * sizeof(slot));
+        if (ss == nullptr)
+        {
+            goto fail;
+        }
+        s->s_shared = ss;
+        ns->s_shared = ss;
+        ns->s_slots = s->s_slots;
+        ns->s_nels = s->s_nels;
+        ns->s_nslots = s->s_nslots;
+        ++vsver;
+        return ns;
+    }
     if ((ns->s_slots = (slot *)ici_nalloc(s->s_nslots * sizeof(slot))) == nullptr)
     {
         goto fail;
@@ -406,14 +470,7 @@ object *map_type::copy(object *o)
     memcpy((char *)ns->s_slots, (char *)s->s_slots, s->s_nslots * sizeof(slot));
     ns->s_nels = s->s_nels;
     ns->s_nslots = s->s_nslots;
-    if (ns->s_nslots <= 64)
-    {
-        invalidate_map_lookaside(ns);
-    }
-    else
-    {
-        ++vsver;
-    }
+    invalidate_map_lookaside(ns);
     return ns;
 
 fail:
@@ -446,6 +503,14 @@ int map_type::assign_super(object *o, object *k, object *v, map *b)
             {
                 if (sl->sl_key == k)
                 {
+                    if (mapof(o)->s_shared != nullptr)
+                    {
+                        if (split_map(mapof(o)))
+                        {
+                            return -1;
+                        }
+                        sl = find_raw_slot(mapof(o), k);
+                    }
                     sl->sl_value = v;
                     if (b != nullptr && isstring(k))
                     {
@@ -493,6 +558,10 @@ int map_type::assign(object *o, object *k, object *v)
         stringof(k)->s_slot->sl_value = v;
         return 0;
     }
+    if (mapof(o)->s_shared != nullptr && !o->isatom() && split_map(mapof(o)))
+    {
+        return 1;
+    }
     /*
      * Look for it in the base struct.
      */
@@ -578,6 +647,10 @@ int map_type::assign_base(object *o, object *k, object *v)
     {
         return set_error("attempt to modify an atomic struct");
     }
+    if (UNLIKELY(unshare(s)))
+    {
+        return 1;
+    }
     sl = find_raw_slot(s, k);
     if (sl->sl_key != nullptr)
     {
@@ -625,30 +698,39 @@ do_assign:
 
 int map_type::forall(object *o)
 {
-    struct forall *fa = forallof(o);
-    map           *s = mapof(fa->fa_aggr);
+    return step(forallof(o));
+}
+
+/*
+ * Advance a forall loop over a map, see forall.h. This, and the steps
+ * of sets and arrays, re-read the aggregate so modification of it
+ * within the loop is safe. Elements are visited by position: an
+ * element added during the loop may or may not be visited, and
+ * removing elements of a map or set, or growing one (which re-hashes
+ * it), may move others so they are visited again, or missed. An
+ * element is read before any variable is assigned, as that may itself
+ * modify the aggregate.
+ */
+int map_type::step(struct forall *fa)
+{
+    auto s = mapof(fa->fa_aggr);
 
     while (++fa->fa_index < s->s_nslots)
     {
-        slot *sl = &s->s_slots[fa->fa_index];
-
-        if (sl->sl_key == nullptr)
+        auto sl = &s->s_slots[fa->fa_index];
+        auto k = sl->sl_key;
+        if (k == nullptr)
         {
             continue;
         }
-        if (fa->fa_vaggr != null)
+        auto v = sl->sl_value;
+        if (fa->fa_vaggr != null && forall_assign(fa->fa_vaggr, fa->fa_vkey, v))
         {
-            if (ici_assign(fa->fa_vaggr, fa->fa_vkey, sl->sl_value))
-            {
-                return 1;
-            }
+            return 1;
         }
-        if (fa->fa_kaggr != null)
+        if (fa->fa_kaggr != null && forall_assign(fa->fa_kaggr, fa->fa_kkey, k))
         {
-            if (ici_assign(fa->fa_kaggr, fa->fa_kkey, sl->sl_key))
-            {
-                return 1;
-            }
+            return 1;
         }
         return 0;
     }
@@ -693,7 +775,7 @@ object *map_type::fetch_base(object *o, object *k)
         stringof(k)->s_vsver = vsver;
         stringof(k)->s_map = mapof(o);
         stringof(k)->s_slot = sl;
-        if (o->isatom())
+        if (o->isatom() || mapof(o)->s_shared != nullptr)
         {
             k->set(ICI_S_LOOKASIDE_IS_ATOM);
         }
@@ -801,7 +883,7 @@ object *map_type::restore(archiver *ar)
             decref(key);
             goto fail1;
         }
-        failed = ici_assign(s, key, value);
+        failed = ici_assign_base(s, key, value);
         decref(key);
         decref(value);
         if (failed)
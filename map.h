@@ -20,9 +20,10 @@ struct slot
 
 struct map : objwsup
 {
-    size_t s_nels;   /* How many slots used. */
-    size_t s_nslots; /* How many slots allocated. */
-    slot  *s_slots;
+    size_t        s_nels;   /* How many slots used. */
+    size_t        s_nslots; /* How many slots allocated. */
+    slot         *s_slots;
+    shared_store *s_shared; /* Non-null if s_slots may be shared. */
 };
 
 inline map *mapof(object *o)
@@ -34,6 +35,17 @@ inline bool ismap(object *o)
     return o->hastype(TC_MAP);
 }
 
+/*
+ * Ensure the map's slots are its own, and so may be modified, before
+ * writing them directly. Returns 1 on error, usual conventions.
+ */
+int split_map(map *);
+
+inline int unshare(map *s)
+{
+    return s->s_shared != nullptr ? split_map(s) : 0;
+}
+
 class map_type : public type
 {
 public:
@@ -53,6 +65,7 @@ public:
     object       *fetch(object *o, object *k) override;
     object       *fetch_base(object *o, object *k) override;
     int           fetch_super(object *o, object *k, object **pv, map *b) override;
+    static int    step(struct forall *);
     int           save(archiver *, object *) override;
     object       *restore(archiver *) override;
     int64_t       len(object *) override;
@@ -4,6 +4,11 @@
 #include "icistr.h"
 #include <icistr-setup.h>
 
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
 extern "C" {
 #include "BigNum.h"
 #include "BigZ.h"
@@ -11,8 +16,17 @@ extern "C" {
 
 namespace {
 
+static_assert(sizeof (BigNumDigit) == 4, "int conversions assume 32-bit digits");
+
 BigZ zero;
 
+/*
+ * Products of numbers with fewer digits than this use the library's
+ * schoolbook multiply, larger ones are split, Karatsuba style, until
+ * they are this small.
+ */
+constexpr BigNumLength karatsuba_threshold = 40;
+
 void bignum_pre_free(ici::handle *h)
 {
     BzFree((BigZ)h->h_ptr);
@@ -36,6 +50,172 @@ int allocerr()
     return 1;
 }
 
+bool isbignum(ici::object *o)
+{
+    return ici::ishandleof(o, ICIS(bignum));
+}
+
+BigZ bigz(ici::object *o)
+{
+    return (BigZ)ici::handleof(o)->h_ptr;
+}
+
+BigZ from_int64(int64_t i)
+{
+    BigZ        z;
+    uint64_t    u;
+
+    if ((z = BzCreate(2)) == NULL)
+        return NULL;
+    u = i < 0 ? -uint64_t(i) : uint64_t(i);
+    z->Digits[0] = BigNumDigit(u);
+    z->Digits[1] = BigNumDigit(u >> 32);
+    BzSetSign(z, i < 0 ? BZ_MINUS : i > 0 ? BZ_PLUS : BZ_ZERO);
+    return z;
+}
+
+/*
+ * An operand of a bignum function or operator, a bignum or an int.
+ * Ints are converted to a BigZ that is freed with the operand.
+ */
+struct operand
+{
+    BigZ        z = NULL;
+    bool        owned = false;
+
+    ~operand()
+    {
+        if (owned)
+            BzFree(z);
+    }
+
+    int set(ici::object *o, int arg)
+    {
+        if (isbignum(o))
+            z = bigz(o);
+        else if (ici::isint(o))
+        {
+            if ((z = from_int64(ici::intof(o)->i_value)) == NULL)
+                return allocerr();
+            owned = true;
+        }
+        else
+            return ici::argerror(arg);
+        return 0;
+    }
+};
+
+/*
+ * Set s to x[0..lo) + x[lo..lo+hi). s has max(lo, hi) + 1 digits.
+ */
+void add_halves(BigNum s, BigNum x, BigNumLength lo, BigNumLength hi)
+{
+    if (lo >= hi)
+    {
+        BnnAssign(s, x, lo);
+        BnnAdd(s, lo + 1, x + lo, hi, 0);
+    }
+    else
+    {
+        BnnAssign(s, x + lo, hi);
+        BnnAdd(s, hi + 1, x, lo, 0);
+    }
+}
+
+/*
+ * Add the product a * b to r. r has at least al + bl digits and the
+ * sum must fit in its rl digits.
+ *
+ * Karatsuba's method splits each operand in two at h digits, a = a1.B^h
+ * + a0, and forms the product from three half sized products,
+ *
+ *      z0 = a0.b0
+ *      z2 = a1.b1
+ *      z1 = (a0 + a1)(b0 + b1) - z0 - z2
+ *      a.b = z2.B^2h + z1.B^h + z0
+ *
+ * Operands of quite different lengths are multiplied piecewise, the
+ * longer being cut into pieces the length of the shorter.
+ */
+void multiply_into(BigNum r, BigNumLength rl, BigNum a, BigNumLength al, BigNum b, BigNumLength bl)
+{
+    if (al < bl)
+    {
+        std::swap(a, b);
+        std::swap(al, bl);
+    }
+    if (bl < karatsuba_threshold)
+    {
+        BnnMultiply(r, rl, a, al, b, bl);
+        return;
+    }
+    if (al >= 2 * bl)
+    {
+        for (BigNumLength i = 0; i < al; i += bl)
+            multiply_into(r + i, rl - i, a + i, std::min(bl, al - i), b, bl);
+        return;
+    }
+
+    const BigNumLength h = al / 2;
+    const BigNumLength a1l = al - h;
+    const BigNumLength b1l = bl - h;
+    const BigNumLength sal = a1l + 1;
+    const BigNumLength sbl = std::max(h, b1l) + 1;
+    std::vector<BigNumDigit> z0(2 * h);
+    std::vector<BigNumDigit> z2(a1l + b1l);
+    std::vector<BigNumDigit> sa(sal);
+    std::vector<BigNumDigit> sb(sbl);
+    std::vector<BigNumDigit> z1(sal + sbl);
+
+    multiply_into(z0.data(), z0.size(), a, h, b, h);
+    multiply_into(z2.data(), z2.size(), a + h, a1l, b + h, b1l);
+    add_halves(sa.data(), a, h, a1l);
+    add_halves(sb.data(), b, h, b1l);
+    multiply_into(z1.data(), z1.size(), sa.data(), sal, sb.data(), sbl);
+    BnnSubtract(z1.data(), z1.size(), z0.data(), z0.size(), 1);
+    BnnSubtract(z1.data(), z1.size(), z2.data(), z2.size(), 1);
+
+    BnnAdd(r, rl, z0.data(), z0.size(), 0);
+    BnnAdd(r + 2 * h, rl - 2 * h, z2.data(), z2.size(), 0);
+    BnnAdd(r + h, rl - h, z1.data(), BnnNumDigits(z1.data(), z1.size()), 0);
+}
+
+/*
+ * Return y * z, as BzMultiply() but using multiply_into() for large
+ * numbers.
+ */
+BigZ multiply(BigZ y, BigZ z)
+{
+    BigNumLength yl;
+    BigNumLength zl;
+    BigZ         n;
+
+    yl = BzNumDigits(y);
+    zl = BzNumDigits(z);
+    if (std::min(yl, zl) < karatsuba_threshold)
+        return BzMultiply(y, z);
+    if ((n = BzCreate(yl + zl)) != NULL)
+    {
+        multiply_into(n->Digits, yl + zl, y->Digits, yl, z->Digits, zl);
+        BzSetSign(n, BzGetSign(y) * BzGetSign(z));
+    }
+    return n;
+}
+
+int ret_bignum(BigZ z)
+{
+    ici::handle *h;
+
+    if (z == NULL)
+        return allocerr();
+    if ((h = new_bignum(z)) == NULL)
+    {
+        BzFree(z);
+        return 1;
+    }
+    return ici::ret_with_decref(h);
+}
+
 int bignum_bignum(void)
 {
     BigZ        z;
@@ -49,7 +229,7 @@ int bignum_bignum(void)
         if (ici::isstring(ici::ARG(0)))
             z = BzFromString(ici::stringof(ici::ARG(0))->s_chars, 10);
         else if (ici::isint(ici::ARG(0)))
-            z = BzFromInteger(ici::intof(ici::ARG(0))->i_value);
+            z = from_int64(ici::intof(ici::ARG(0))->i_value);
         else
         {
             char n[80];
@@ -98,56 +278,163 @@ int bignum_tostring(void)
 
 int glue_N_N()
 {
-    ici::handle *a;
+    operand a;
     BigZ (*pf)(BigZ);
-    BigZ z;
 
-    if (ici::typecheck("h", ICIS(bignum), &a))
+    if (ici::NARGS() != 1)
+        return ici::argcount(1);
+    if (a.set(ici::ARG(0), 0))
         return 1;
     pf = (decltype(pf))(ici::ICI_CF_ARG1());
-    z = (*pf)((BigZ)a->h_ptr);
-    return ici::ret_with_decref(new_bignum(z));
+    return ret_bignum((*pf)(a.z));
 }
 
 int glue_NN_N()
 {
-    ici::handle *a;
-    ici::handle *b;
+    operand a;
+    operand b;
     BigZ (*pf)(BigZ, BigZ);
-    BigZ z;
 
-    if (ici::typecheck("hh", ICIS(bignum), &a, ICIS(bignum), &b))
+    if (ici::NARGS() != 2)
+        return ici::argcount(2);
+    if (a.set(ici::ARG(0), 0) || b.set(ici::ARG(1), 1))
         return 1;
     pf = (decltype(pf))(ici::ICI_CF_ARG1());
-    z = (*pf)((BigZ)a->h_ptr, (BigZ)b->h_ptr);
-    return ici::ret_with_decref(new_bignum(z));
+    return ret_bignum((*pf)(a.z, b.z));
 }
 
 int bignum_div(void)
 {
-    ici::handle *a;
-    ici::handle *b;
-    BigZ z;
+    operand a;
+    operand b;
 
-    if (ici::typecheck("hh", ICIS(bignum), &a, ICIS(bignum), &b))
+    if (ici::NARGS() != 2)
+        return ici::argcount(2);
+    if (a.set(ici::ARG(0), 0) || b.set(ici::ARG(1), 1))
         return 1;
-    if (BzCompare((BigZ)b->h_ptr, zero) == 0)
+    if (BzCompare(b.z, zero) == 0)
     {
         ici::set_error("division by zero");
         return 1;
     }
-    z = BzDiv((BigZ)a->h_ptr, (BigZ)b->h_ptr);
-    return ici::ret_with_decref(new_bignum(z));
+    return ret_bignum(BzDiv(a.z, b.z));
 }
 
 int bignum_compare(void)
 {
-    ici::handle *a;
-    ici::handle *b;
+    operand a;
+    operand b;
+
+    if (ici::NARGS() != 2)
+        return ici::argcount(2);
+    if (a.set(ici::ARG(0), 0) || b.set(ici::ARG(1), 1))
+        return 1;
+    return ici::int_ret(BzCompare(a.z, b.z));
+}
+
+/*
+ * The implementation of the arithmetic and comparison operators on
+ * bignums, and ints that overflow, as user-defined binary operators.
+ * The operator is ICI_CF_ARG1(). Arithmetic yields a bignum.
+ */
+int bignum_binop(void)
+{
+    operand     a;
+    operand     b;
+    const char  *op;
+    BigZ        z;
 
-    if (ici::typecheck("hh", ICIS(bignum), &a, ICIS(bignum), &b))
+    if (ici::NARGS() != 2)
+        return ici::argcount(2);
+    if (a.set(ici::ARG(0), 0) || b.set(ici::ARG(1), 1))
         return 1;
-    return ici::int_ret(BzCompare((BigZ)a->h_ptr, (BigZ)b->h_ptr));
+    op = (const char *)ici::ICI_CF_ARG1();
+    switch (op[0])
+    {
+    case '+':
+        return ret_bignum(BzAdd(a.z, b.z));
+
+    case '-':
+        return ret_bignum(BzSubtract(a.z, b.z));
+
+    case '*':
+        return ret_bignum(multiply(a.z, b.z));
+
+    case '/':
+    case '%':
+        if (BzCompare(b.z, zero) == 0)
+        {
+            ici::set_error(op[0] == '/' ? "division by 0" : "modulus by 0");
+            return 1;
+        }
+        z = op[0] == '/' ? BzDiv(a.z, b.z) : BzMod(a.z, b.z);
+        return ret_bignum(z);
+    }
+
+    const int cmp = BzCompare(a.z, b.z);
+    bool      r = false;
+    switch (op[0])
+    {
+    case '<':
+        r = op[1] == '=' ? cmp <= 0 : cmp < 0;
+        break;
+    case '>':
+        r = op[1] == '=' ? cmp >= 0 : cmp > 0;
+        break;
+    case '=':
+        r = cmp == 0;
+        break;
+    case '!':
+        r = cmp != 0;
+        break;
+    }
+    return ici::int_ret(r);
+}
+
+/*
+ * Define the operators on bignums, and mixed bignums and ints, and
+ * the operators used when int arithmetic overflows.
+ */
+int define_operators()
+{
+    static ICI_DEFINE_CFUNCS(operators)
+    {
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "+"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "-"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "*"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "/"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "%"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "+="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "-="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "*="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "/="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "%="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "<"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "<="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, ">"),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, ">="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "=="),
+        ICI_DEFINE_CFUNC1(bignum, bignum_binop, "!="),
+        ICI_CFUNCS_END()
+    };
+
+    for (ici::cfunc *cf = ICI_CFUNCS(operators); cf->cf_name != nullptr; ++cf)
+    {
+        const char *op = (const char *)cf->cf_arg1;
+
+        if
+        (
+            ici::define_user_binop("bignum", op, "bignum", cf)
+            ||
+            ici::define_user_binop("bignum", op, "int", cf)
+            ||
+            ici::define_user_binop("int", op, "bignum", cf)
+        )
+            return 1;
+        if (strchr("+-*/", op[0]) != nullptr && ici::define_user_binop("int", op, "int", cf))
+            return 1;
+    }
+    return 0;
 }
 
 } // anon
@@ -160,6 +447,8 @@ extern "C" ici::object *ici_bignum_init()
         return nullptr;
     BzInit();
     zero = BzFromInteger(0);
+    if (define_operators())
+        return nullptr;
     static ICI_DEFINE_CFUNCS(bignum)
     {
         ICI_DEFINE_CFUNC(bignum,   bignum_bignum),
@@ -405,7 +405,7 @@ BigNumCarry (BnnAdd) (BigNum mm, int ml, BigNum nn, int nl, BigNumCarry carryin)
     {
 	while (--nl >= 0)
 	{
-	    c += *mm + *(nn++);
+	    c += (BigNumProduct) *mm + *(nn++);
 	    *(mm++) = c;
 	    c >>= BN_DIGIT_SIZE;
 	}
@@ -490,7 +490,7 @@ BigNumCarry (BnnSubtract) (BigNum mm, int ml, BigNum nn, int nl, BigNumCarry car
 	while (--nl >= 0) 
 	{
 	    invn = *(nn++) ^ -1;
-	    c += *mm + invn;
+	    c += (BigNumProduct) *mm + invn;
 	    *(mm++) = c;
 	    c >>= BN_DIGIT_SIZE;
 	}
@@ -557,7 +557,7 @@ BigNumCarry (BnnMultiplyDigit) (BigNum pp, int pl, BigNum mm, int ml, BigNumDigi
 	while (ml != 0) 
 	{
 	    ml--;
-	    c += *pp + (d * (*(mm++)));
+	    c += *pp + ((BigNumProduct) d * (*(mm++)));
 	    *(pp++) = c;
 	    c >>= BN_DIGIT_SIZE;
 	} 
@@ -40,6 +40,8 @@
 #include <ipps.h>
 #include <ippvm.h>
 
+#include <atomic>
+
 namespace
 {
 
@@ -65,6 +67,33 @@ inline int check_error(int code, const Fn &fn)
     return fn();
 }
 
+/*
+ * Element-wise operations on vecs of at least twice this many elements
+ * are split into pieces that run on ICI's worker threads.
+ */
+constexpr size_t grain = 64 * 1024;
+
+/*
+ * Call fn(begin, n) for pieces of the range [0, size), possibly on
+ * several threads, see ici::parallel_for(), and return the status of
+ * the first failing call, or ippStsNoErr.
+ */
+template <typename Fn>
+int split(size_t size, const Fn &fn)
+{
+    std::atomic<int> status{ippStsNoErr};
+    ici::parallel_for(size, grain, [&status, &fn](size_t begin, size_t end)
+    {
+        const int error = fn(begin, int(end - begin));
+        if (error != ippStsNoErr)
+        {
+            int none = ippStsNoErr;
+            status.compare_exchange_strong(none, error);
+        }
+    });
+    return status;
+}
+
 int f_init()
 {
     const int error = ippInit();
@@ -127,50 +156,50 @@ int f_init()
 DEFINE_INPLACE_NULLARY_OP
 (
     abs,
-    error = ippsAbs_32f_I(vec->v_ptr, int(vec->v_size)),
-    error = ippsAbs_64f_I(vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsAbs_32f_I(vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsAbs_64f_I(vec->v_ptr + begin, n); })
 )
 
 DEFINE_INPLACE_NULLARY_OP
 (
     exp,
-    error = ippsExp_32f_I(vec->v_ptr, int(vec->v_size)),
-    error = ippsExp_64f_I(vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsExp_32f_I(vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsExp_64f_I(vec->v_ptr + begin, n); })
 )
 
 DEFINE_INPLACE_NULLARY_OP
 (
     ln,
-    error = ippsLn_32f_I(vec->v_ptr, int(vec->v_size)),
-    error = ippsLn_64f_I(vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsLn_32f_I(vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsLn_64f_I(vec->v_ptr + begin, n); })
 )
 
 DEFINE_INPLACE_OP
 (
     set,
-    error = ippsSet_32f(arg, vec->v_ptr, int(vec->v_size)),
-    error = ippsSet_64f(arg, vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsSet_32f(arg, vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsSet_64f(arg, vec->v_ptr + begin, n); })
 )
 
 DEFINE_INPLACE_NULLARY_OP
 (
     sqr,
-    error = ippsSqr_32f_I(vec->v_ptr, int(vec->v_size)),
-    error = ippsSqr_64f_I(vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsSqr_32f_I(vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsSqr_64f_I(vec->v_ptr + begin, n); })
 )
 
 DEFINE_INPLACE_NULLARY_OP
 (
     sqrt,
-    error = ippsSqrt_32f_I(vec->v_ptr, int(vec->v_size)),
-    error = ippsSqrt_64f_I(vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsSqrt_32f_I(vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsSqrt_64f_I(vec->v_ptr + begin, n); })
 )
 
 DEFINE_INPLACE_NULLARY_OP
 (
     zero,
-    error = ippsZero_32f(vec->v_ptr, int(vec->v_size)),
-    error = ippsZero_64f(vec->v_ptr, int(vec->v_size))
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsZero_32f(vec->v_ptr + begin, n); }),
+    error = split(vec->v_size, [&](size_t begin, int n) { return ippsZero_64f(vec->v_ptr + begin, n); })
 )
 
 #define DEFINE_UNARY_OP(FUNC, OP32, OP64)                               \
@@ -192,7 +221,11 @@ DEFINE_INPLACE_NULLARY_OP
             {                                                           \
                 return 1;                                               \
             }                                                           \
-            error = OP32(v->v_ptr, ici::vec32fof(result)->v_ptr, v->v_size); \
+            auto r = ici::vec32fof(result);                             \
+            error = split(v->v_size, [v, r](size_t begin, int n)        \
+            {                                                           \
+                return OP32(v->v_ptr + begin, r->v_ptr + begin, n);     \
+            });                                                         \
         }                                                               \
         else if (ici::isvec64f(vec))                                    \
         {                                                               \
@@ -201,7 +234,11 @@ DEFINE_INPLACE_NULLARY_OP
             {                                                           \
                 return 1;                                               \
             }                                                           \
-            error = OP64(v->v_ptr, ici::vec64fof(result)->v_ptr, v->v_size); \
+            auto r = ici::vec64fof(result);                             \
+            error = split(v->v_size, [v, r](size_t begin, int n)        \
+            {                                                           \
+                return OP64(v->v_ptr + begin, r->v_ptr + begin, n);     \
+            });                                                         \
         }                                                               \
         else                                                            \
         {                                                               \
@@ -546,11 +583,19 @@ int f_normalize()
     }
     if (ici::isvec32f(vec))
     {
-        error = ippsNormalize_32f_I(ici::vec32fof(vec)->v_ptr, ici::vec32fof(vec)->v_size, float(sub), float(div));
+        auto v = ici::vec32fof(vec);
+        error = split(v->v_size, [v, sub, div](size_t begin, int n)
+        {
+            return ippsNormalize_32f_I(v->v_ptr + begin, n, float(sub), float(div));
+        });
     }
     else if (ici::isvec64f(vec))
     {
-        error = ippsNormalize_64f_I(ici::vec64fof(vec)->v_ptr, ici::vec64fof(vec)->v_size, sub, div);
+        auto v = ici::vec64fof(vec);
+        error = split(v->v_size, [v, sub, div](size_t begin, int n)
+        {
+            return ippsNormalize_64f_I(v->v_ptr + begin, n, sub, div);
+        });
     }
     else
     {
@@ -586,7 +631,11 @@ int f_normalized()
         {
             return 1;
         }
-        error = ippsNormalize_32f(v->v_ptr, ici::vec32fof(result)->v_ptr, v->v_size, float(sub), float(div));
+        auto r = ici::vec32fof(result);
+        error = split(v->v_size, [v, r, sub, div](size_t begin, int n)
+        {
+            return ippsNormalize_32f(v->v_ptr + begin, r->v_ptr + begin, n, float(sub), float(div));
+        });
     }
     else if (ici::isvec64f(vec))
     {
@@ -595,7 +644,11 @@ int f_normalized()
         {
             return 1;
         }
-        error = ippsNormalize_64f(v->v_ptr, ici::vec64fof(result)->v_ptr, v->v_size, sub, div);
+        auto r = ici::vec64fof(result);
+        error = split(v->v_size, [v, r, sub, div](size_t begin, int n)
+        {
+            return ippsNormalize_64f(v->v_ptr + begin, r->v_ptr + begin, n, sub, div);
+        });
     }
     else
     {
@@ -628,11 +681,19 @@ int f_add()
     {
         if (ici::isvec32f(vec))
         {
-            error = ippsAddC_32f_I(float(constant), vec32fof(vec)->v_ptr, int(vec32fof(vec)->v_size));
+            auto v = vec32fof(vec);
+            error = split(v->v_size, [v, constant](size_t begin, int n)
+            {
+                return ippsAddC_32f_I(float(constant), v->v_ptr + begin, n);
+            });
         }
         else if (ici::isvec64f(vec))
         {
-            error = ippsAddC_64f_I(constant, vec64fof(vec)->v_ptr, int(vec64fof(vec)->v_size));
+            auto v = vec64fof(vec);
+            error = split(v->v_size, [v, constant](size_t begin, int n)
+            {
+                return ippsAddC_64f_I(constant, v->v_ptr + begin, n);
+            });
         }
         else
         {
@@ -665,7 +726,13 @@ int f_add()
             {
                 return 1;
             }
-            error = ippsAdd_32f(ici::vec32fof(vec)->v_ptr, ici::vec32fof(rhs)->v_ptr, r->v_ptr, int(r->v_size));
+            auto a = ici::vec32fof(vec);
+            auto b = ici::vec32fof(rhs);
+            auto d = r.get();
+            error = split(d->v_size, [a, b, d](size_t begin, int n)
+            {
+                return ippsAdd_32f(a->v_ptr + begin, b->v_ptr + begin, d->v_ptr + begin, n);
+            });
             result = r;
         }
         else
@@ -686,7 +753,13 @@ int f_add()
             {
                 return 1;
             }
-            error = ippsAdd_64f(ici::vec64fof(vec)->v_ptr, ici::vec64fof(rhs)->v_ptr, r->v_ptr, int(r->v_size));
+            auto a = ici::vec64fof(vec);
+            auto b = ici::vec64fof(rhs);
+            auto d = r.get();
+            error = split(d->v_size, [a, b, d](size_t begin, int n)
+            {
+                return ippsAdd_64f(a->v_ptr + begin, b->v_ptr + begin, d->v_ptr + begin, n);
+            });
             result = r;
         }
         else
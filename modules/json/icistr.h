@@ -0,0 +1,5 @@
+ICI_STR(decode, "decode")
+ICI_STR(encode, "encode")
+ICI_STR(eof, "eof")
+ICI_STR(read, "read")
+ICI_STR(tostring, "tostring")
@@ -0,0 +1,925 @@
+/*
+ * The json module encodes ICI data as JSON and decodes JSON into ICI
+ * data.
+ *
+ *      json.encode(any [, file [, indent]])
+ *      string = json.tostring(any [, indent])
+ *      any = json.decode(string)
+ *      any = json.read([file])
+ *      int = json.eof([file])
+ *
+ * encode() writes the JSON form of any to the file, by default the
+ * current output. Maps become objects, and must have string keys,
+ * arrays and sets become arrays and NULL becomes null. Map keys are
+ * written in no particular order. With a non-zero indent the output is
+ * spread over lines with nested values indented by that many spaces,
+ * otherwise it is as compact as possible. The text is built in memory
+ * and written in a few large writes. tostring() returns the text.
+ *
+ * decode() returns the value of the JSON text in its string argument.
+ * Objects become maps, arrays become arrays, numbers become ints if
+ * they are integers that fit, else floats, true and false become 1 and
+ * 0, and null becomes NULL.
+ *
+ * read() decodes the next JSON value from the file, by default the
+ * current input, reading only as far as the end of the value. It
+ * returns NULL at the end of the file. Successive calls read a stream
+ * of values, such as newline-delimited JSON, from any type of file,
+ * including sockets, without holding more than one value in memory.
+ * As a JSON null is also read as NULL, eof() is used to find the end
+ * of a stream that may hold them. It returns 1 if nothing but white
+ * space remains in the file, else 0, so a stream is read by:
+ *
+ *      while (!json.eof(f))
+ *          v := json.read(f);
+ *
+ * This --intro-- and --synopsis-- are part of --ici-json-- documentation.
+ */
+
+#include <ici.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_USE_SSE2
+#endif
+
+namespace
+{
+
+#include "icistr.h"
+#include <icistr-setup.h>
+
+/*
+ * Containers nested deeper than this are an error, which also stops
+ * encode() recursing forever on a cyclic structure.
+ */
+constexpr int max_depth = 512;
+
+/*
+ * encode() writes whenever this much text is waiting.
+ */
+constexpr size_t write_size = 1 << 16;
+
+/*
+ * The JSON text of a value, built in memory. If there is a file the
+ * text is written to it in large pieces as it grows.
+ */
+class encoder
+{
+public:
+    encoder(ici::file *f, int indent) : e_file(f), e_indent(indent)
+    {
+    }
+
+    int encode(ici::object *, int depth = 0);
+
+    int flush()
+    {
+        if (e_file != nullptr && !e_buf.empty())
+        {
+            if (e_file->write(e_buf.data(), long(e_buf.size())) != long(e_buf.size()))
+            {
+                return ici::set_error("failed to write JSON to %s", e_file->f_name->s_chars);
+            }
+            e_buf.clear();
+        }
+        return 0;
+    }
+
+    std::string e_buf;
+
+private:
+    int  string(ici::str *);
+    void newline(int depth)
+    {
+        if (e_indent > 0)
+        {
+            e_buf += '\n';
+            e_buf.append(size_t(depth) * e_indent, ' ');
+        }
+    }
+
+    ici::file *e_file;
+    int        e_indent;
+};
+
+int encoder::string(ici::str *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char       *p = s->s_chars;
+    const char       *end = p + s->s_nchars;
+
+    e_buf += '"';
+    while (p < end)
+    {
+        const char *q = p;
+        while (q < end && (unsigned char)*q >= 0x20 && *q != '"' && *q != '\\')
+        {
+            ++q;
+        }
+        e_buf.append(p, q - p);
+        if (q == end)
+        {
+            break;
+        }
+        e_buf += '\\';
+        switch (*q)
+        {
+        case '"':  e_buf += '"'; break;
+        case '\\': e_buf += '\\'; break;
+        case '\b': e_buf += 'b'; break;
+        case '\f': e_buf += 'f'; break;
+        case '\n': e_buf += 'n'; break;
+        case '\r': e_buf += 'r'; break;
+        case '\t': e_buf += 't'; break;
+        default:
+            e_buf += "u00";
+            e_buf += hex[(*q >> 4) & 0xF];
+            e_buf += hex[*q & 0xF];
+            break;
+        }
+        p = q + 1;
+    }
+    e_buf += '"';
+    return 0;
+}
+
+int encoder::encode(ici::object *o, int depth)
+{
+    char n[ici::objnamez];
+    char num[40];
+
+    if (depth > max_depth)
+    {
+        return ici::set_error("attempt to encode data nested more than %d deep as JSON", max_depth);
+    }
+    if (e_buf.size() >= write_size && flush())
+    {
+        return 1;
+    }
+    if (ici::isnull(o))
+    {
+        e_buf += "null";
+    }
+    else if (ici::isint(o))
+    {
+        e_buf.append(num, snprintf(num, sizeof num, "%lld", (long long)ici::intof(o)->i_value));
+    }
+    else if (ici::isfloat(o))
+    {
+        const double v = ici::floatof(o)->f_value;
+        if (!isfinite(v))
+        {
+            return ici::set_error("attempt to encode %s as JSON", ici::objname(n, o));
+        }
+        const int z = snprintf(num, sizeof num, "%.17g", v);
+        e_buf.append(num, z);
+        if (strcspn(num, ".e") == size_t(z))
+        {
+            e_buf += ".0"; /* So it decodes as a float. */
+        }
+    }
+    else if (ici::isstring(o))
+    {
+        return string(ici::stringof(o));
+    }
+    else if (ici::isarray(o))
+    {
+        auto a = ici::arrayof(o);
+        e_buf += '[';
+        for (auto e = a->astart(); e != a->alimit(); e = a->anext(e))
+        {
+            if (e != a->astart())
+            {
+                e_buf += ',';
+            }
+            newline(depth + 1);
+            if (encode(*e, depth + 1))
+            {
+                return 1;
+            }
+        }
+        if (a->len() != 0)
+        {
+            newline(depth);
+        }
+        e_buf += ']';
+    }
+    else if (ici::isset(o))
+    {
+        auto s = ici::setof(o);
+        bool sep = false;
+        e_buf += '[';
+        for (auto e = s->s_slots; e < s->s_slots + s->s_nslots; ++e)
+        {
+            if (*e == nullptr)
+            {
+                continue;
+            }
+            if (sep)
+            {
+                e_buf += ',';
+            }
+            sep = true;
+            newline(depth + 1);
+            if (encode(*e, depth + 1))
+            {
+                return 1;
+            }
+        }
+        if (sep)
+        {
+            newline(depth);
+        }
+        e_buf += ']';
+    }
+    else if (ici::ismap(o))
+    {
+        auto m = ici::mapof(o);
+        bool sep = false;
+        e_buf += '{';
+        for (auto sl = m->s_slots; sl < m->s_slots + m->s_nslots; ++sl)
+        {
+            if (sl->sl_key == nullptr)
+            {
+                continue;
+            }
+            if (!ici::isstring(sl->sl_key))
+            {
+                return ici::set_error("attempt to encode a map with a %s key as JSON", sl->sl_key->type_name());
+            }
+            if (sep)
+            {
+                e_buf += ',';
+            }
+            sep = true;
+            newline(depth + 1);
+            string(ici::stringof(sl->sl_key));
+            e_buf += e_indent > 0 ? ": " : ":";
+            if (encode(sl->sl_value, depth + 1))
+            {
+                return 1;
+            }
+        }
+        if (sep)
+        {
+            newline(depth);
+        }
+        e_buf += '}';
+    }
+    else
+    {
+        return ici::set_error("attempt to encode %s as JSON", ici::objname(n, o));
+    }
+    return 0;
+}
+
+/*
+ * Sources of JSON text for the decoder. get() returns the next byte,
+ * or EOF, and unget() pushes back the last one. plain() appends the
+ * bytes up to the next quote, backslash or control character to s.
+ */
+class string_source
+{
+public:
+    string_source(ici::str *s) : s_start(s->s_chars), s_p(s->s_chars), s_end(s->s_chars + s->s_nchars)
+    {
+    }
+
+    inline int get()
+    {
+        return s_p < s_end ? (unsigned char)*s_p++ : EOF;
+    }
+
+    inline void unget(int c)
+    {
+        if (c != EOF)
+        {
+            --s_p;
+        }
+    }
+
+    void plain(std::string &s)
+    {
+        const char *p = s_p;
+#ifdef JSON_USE_SSE2
+        /*
+         * Test sixteen bytes at a time, as most strings have no escapes
+         * and this is where decoding spends much of its time.
+         */
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i bslash = _mm_set1_epi8('\\');
+        const __m128i space = _mm_set1_epi8(0x20);
+        const __m128i sign = _mm_set1_epi8(char(0x80));
+        while (s_end - p >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            const __m128i ctl = _mm_cmplt_epi8(_mm_xor_si128(v, sign), _mm_xor_si128(space, sign));
+            const int     m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)), ctl));
+            if (m != 0)
+            {
+                p += __builtin_ctz(m);
+                s.append(s_p, p - s_p);
+                s_p = p;
+                return;
+            }
+            p += 16;
+        }
+#endif
+        while (p < s_end && (unsigned char)*p >= 0x20 && *p != '"' && *p != '\\')
+        {
+            ++p;
+        }
+        s.append(s_p, p - s_p);
+        s_p = p;
+    }
+
+    long long offset() const
+    {
+        return s_p - s_start;
+    }
+
+private:
+    const char *s_start;
+    const char *s_p;
+    const char *s_end;
+};
+
+class file_source
+{
+public:
+    file_source(ici::file *f) : f_file(f), f_offset(0)
+    {
+    }
+
+    inline int get()
+    {
+        int c = f_file->getch();
+        if (c != EOF)
+        {
+            ++f_offset;
+        }
+        return c;
+    }
+
+    inline void unget(int c)
+    {
+        if (c != EOF)
+        {
+            f_file->ungetch(c);
+            --f_offset;
+        }
+    }
+
+    void plain(std::string &s)
+    {
+        int c;
+        while ((c = get()) != EOF && c >= 0x20 && c != '"' && c != '\\')
+        {
+            s += char(c);
+        }
+        unget(c);
+    }
+
+    long long offset() const
+    {
+        return f_offset;
+    }
+
+private:
+    ici::file *f_file;
+    long long  f_offset;
+};
+
+/*
+ * A recursive descent JSON parser over a source.
+ */
+template <typename source>
+class decoder
+{
+public:
+    decoder(source &src) : d_src(src)
+    {
+    }
+
+    /*
+     * Skip white space and return the next byte, or EOF.
+     */
+    int skip()
+    {
+        int c;
+        while ((c = d_src.get()) == ' ' || c == '\n' || c == '\r' || c == '\t')
+        {
+        }
+        return c;
+    }
+
+    /*
+     * Return the value that starts with c, with one reference, or
+     * nullptr on error.
+     */
+    ici::object *value(int c, int depth = 0);
+
+    ici::object *error(const char *what)
+    {
+        ici::set_error("%s in JSON at offset %lld", what, d_src.offset() - 1);
+        return nullptr;
+    }
+
+private:
+    ici::object *literal(const char *, ici::object *);
+    ici::object *number(int);
+    ici::str    *string();
+    ici::object *array(int);
+    ici::object *object(int);
+    bool         hex4(unsigned *);
+
+    source     &d_src;
+    std::string d_buf;
+};
+
+template <typename source>
+ici::object *decoder<source>::value(int c, int depth)
+{
+    if (depth > max_depth)
+    {
+        return error("values nested too deeply");
+    }
+    switch (c)
+    {
+    case '{':
+        return object(depth);
+    case '[':
+        return array(depth);
+    case '"':
+        return string();
+    case 't':
+        return literal("rue", ici::o_one);
+    case 'f':
+        return literal("alse", ici::o_zero);
+    case 'n':
+        return literal("ull", ici::null);
+    case EOF:
+        return error("unexpected end");
+    default:
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            return number(c);
+        }
+        return error("unexpected character");
+    }
+}
+
+template <typename source>
+ici::object *decoder<source>::literal(const char *rest, ici::object *o)
+{
+    for (; *rest != '\0'; ++rest)
+    {
+        if (d_src.get() != *rest)
+        {
+            return error("bad literal");
+        }
+    }
+    o->incref();
+    return o;
+}
+
+template <typename source>
+ici::object *decoder<source>::number(int c)
+{
+    char num[512];
+    int  n = 0;
+    bool isfloat = false;
+
+    for (;; c = d_src.get())
+    {
+        if (c == '.' || c == 'e' || c == 'E')
+        {
+            isfloat = true;
+        }
+        else if (!(c >= '0' && c <= '9') && c != '-' && c != '+')
+        {
+            break;
+        }
+        if (n == sizeof num - 1)
+        {
+            return error("number too long");
+        }
+        num[n++] = char(c);
+    }
+    d_src.unget(c);
+    num[n] = '\0';
+    char *end;
+    if (!isfloat)
+    {
+        errno = 0;
+        const long long v = strtoll(num, &end, 10);
+        if (*end == '\0' && errno == 0)
+        {
+            return ici::new_int(v);
+        }
+    }
+    const double v = strtod(num, &end);
+    if (*end != '\0' || end == num)
+    {
+        return error("bad number");
+    }
+    return ici::new_float(v);
+}
+
+template <typename source>
+bool decoder<source>::hex4(unsigned *u)
+{
+    *u = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        const int c = d_src.get();
+        *u <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            *u |= c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            *u |= c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            *u |= c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename source>
+ici::str *decoder<source>::string()
+{
+    d_buf.clear();
+    for (;;)
+    {
+        d_src.plain(d_buf);
+        int c = d_src.get();
+        if (c == '"')
+        {
+            break;
+        }
+        if (c != '\\')
+        {
+            error(c == EOF ? "unterminated string" : "control character in string");
+            return nullptr;
+        }
+        switch (c = d_src.get())
+        {
+        case '"':
+        case '\\':
+        case '/': d_buf += char(c); break;
+        case 'b': d_buf += '\b'; break;
+        case 'f': d_buf += '\f'; break;
+        case 'n': d_buf += '\n'; break;
+        case 'r': d_buf += '\r'; break;
+        case 't': d_buf += '\t'; break;
+        case 'u':
+            {
+                unsigned u;
+                unsigned lo;
+                if (!hex4(&u))
+                {
+                    error("bad \\u escape");
+                    return nullptr;
+                }
+                if (u >= 0xD800 && u < 0xDC00)
+                {
+                    if (d_src.get() != '\\' || d_src.get() != 'u' || !hex4(&lo) || lo < 0xDC00 || lo >= 0xE000)
+                    {
+                        error("unpaired surrogate");
+                        return nullptr;
+                    }
+                    u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                /*
+                 * Append the UTF-8 encoding of u.
+                 */
+                if (u < 0x80)
+                {
+                    d_buf += char(u);
+                }
+                else if (u < 0x800)
+                {
+                    d_buf += char(0xC0 | (u >> 6));
+                    d_buf += char(0x80 | (u & 0x3F));
+                }
+                else if (u < 0x10000)
+                {
+                    d_buf += char(0xE0 | (u >> 12));
+                    d_buf += char(0x80 | ((u >> 6) & 0x3F));
+                    d_buf += char(0x80 | (u & 0x3F));
+                }
+                else
+                {
+                    d_buf += char(0xF0 | (u >> 18));
+                    d_buf += char(0x80 | ((u >> 12) & 0x3F));
+                    d_buf += char(0x80 | ((u >> 6) & 0x3F));
+                    d_buf += char(0x80 | (u & 0x3F));
+                }
+            }
+            break;
+        default:
+            error("bad escape");
+            return nullptr;
+        }
+    }
+    return ici::new_str(d_buf.data(), d_buf.size());
+}
+
+template <typename source>
+ici::object *decoder<source>::array(int depth)
+{
+    ici::ref<ici::array> a = ici::new_array();
+    if (!a)
+    {
+        return nullptr;
+    }
+    int c = skip();
+    if (c == ']')
+    {
+        return a.release();
+    }
+    for (;;)
+    {
+        ici::object *o;
+        if ((o = value(c, depth + 1)) == nullptr)
+        {
+            return nullptr;
+        }
+        if (a->push_checked(o, ici::with_decref))
+        {
+            return nullptr;
+        }
+        if ((c = skip()) == ']')
+        {
+            return a.release();
+        }
+        if (c != ',')
+        {
+            return error("expected , or ]");
+        }
+        c = skip();
+    }
+}
+
+template <typename source>
+ici::object *decoder<source>::object(int depth)
+{
+    ici::ref<ici::map> m = ici::new_map();
+    if (!m)
+    {
+        return nullptr;
+    }
+    int c = skip();
+    if (c == '}')
+    {
+        return m.release();
+    }
+    for (;;)
+    {
+        if (c != '"')
+        {
+            return error("expected a string key");
+        }
+        ici::ref<ici::str> k = string();
+        if (!k)
+        {
+            return nullptr;
+        }
+        if (skip() != ':')
+        {
+            return error("expected :");
+        }
+        ici::ref<> v = value(skip(), depth + 1);
+        if (!v)
+        {
+            return nullptr;
+        }
+        if (m->assign(k, v))
+        {
+            return nullptr;
+        }
+        if ((c = skip()) == '}')
+        {
+            return m.release();
+        }
+        if (c != ',')
+        {
+            return error("expected , or }");
+        }
+        c = skip();
+    }
+}
+
+/*
+ * json.encode(any [, file [, indent]])
+ *
+ * Write the JSON form of any to the file, by default the current output.
+ *
+ * This --topic-- forms part of the --ici-json-- documentation.
+ */
+int f_encode()
+{
+    ici::object *o;
+    ici::file   *f = nullptr;
+    int64_t      indent = 0;
+
+    switch (ici::NARGS())
+    {
+    case 1:
+        if (ici::typecheck("o", &o))
+        {
+            return 1;
+        }
+        break;
+    case 2:
+        if (ici::typecheck("ou", &o, &f))
+        {
+            return 1;
+        }
+        break;
+    default:
+        if (ici::typecheck("oui", &o, &f, &indent))
+        {
+            return 1;
+        }
+        break;
+    }
+    if (f == nullptr && (f = ici::need_stdout()) == nullptr)
+    {
+        return 1;
+    }
+    encoder e(f, int(indent));
+    if (e.encode(o) || e.flush())
+    {
+        return 1;
+    }
+    return ici::null_ret();
+}
+
+/*
+ * string = json.tostring(any [, indent])
+ *
+ * Return the JSON form of any.
+ *
+ * This --topic-- forms part of the --ici-json-- documentation.
+ */
+int f_tostring()
+{
+    ici::object *o;
+    int64_t      indent = 0;
+
+    if (ici::NARGS() == 1 ? ici::typecheck("o", &o) : ici::typecheck("oi", &o, &indent))
+    {
+        return 1;
+    }
+    encoder e(nullptr, int(indent));
+    if (e.encode(o))
+    {
+        return 1;
+    }
+    return ici::ret_with_decref(ici::new_str(e.e_buf.data(), e.e_buf.size()));
+}
+
+/*
+ * any = json.decode(string)
+ *
+ * Return the value of the JSON text in the string.
+ *
+ * This --topic-- forms part of the --ici-json-- documentation.
+ */
+int f_decode()
+{
+    ici::str *s;
+
+    if (ici::typecheck("o", &s))
+    {
+        return 1;
+    }
+    if (!ici::isstring(s))
+    {
+        return ici::argerror(0);
+    }
+    string_source          src(s);
+    decoder<string_source> d(src);
+    ici::ref<>             o = d.value(d.skip());
+    if (!o)
+    {
+        return 1;
+    }
+    if (d.skip() != EOF)
+    {
+        d.error("unexpected data after the value");
+        return 1;
+    }
+    return ici::ret_no_decref(o);
+}
+
+/*
+ * Get the optional file argument of read() and eof(), by default the
+ * current input. Returns nullptr on error, usual conventions.
+ */
+ici::file *file_arg()
+{
+    ici::file *f;
+
+    if (ici::NARGS() == 0)
+    {
+        return ici::need_stdin();
+    }
+    if (ici::typecheck("u", &f))
+    {
+        return nullptr;
+    }
+    return f;
+}
+
+/*
+ * any = json.read([file])
+ *
+ * Read and return the next JSON value from the file, by default the
+ * current input, or NULL at the end of the file.
+ *
+ * This --topic-- forms part of the --ici-json-- documentation.
+ */
+int f_read()
+{
+    ici::file *f;
+
+    if ((f = file_arg()) == nullptr)
+    {
+        return 1;
+    }
+    file_source          src(f);
+    decoder<file_source> d(src);
+    const int            c = d.skip();
+    if (c == EOF)
+    {
+        return ici::null_ret();
+    }
+    return ici::ret_with_decref(d.value(c));
+}
+
+/*
+ * int = json.eof([file])
+ *
+ * Skip white space in the file, by default the current input, and
+ * return 1 if the end of the file follows, else 0, in which case a
+ * following read() returns the next value.
+ *
+ * This --topic-- forms part of the --ici-json-- documentation.
+ */
+int f_eof()
+{
+    ici::file *f;
+
+    if ((f = file_arg()) == nullptr)
+    {
+        return 1;
+    }
+    file_source          src(f);
+    decoder<file_source> d(src);
+    const int            c = d.skip();
+    src.unget(c);
+    return ici::int_ret(c == EOF);
+}
+
+} // namespace
+
+extern "C" ici::object *ici_json_init()
+{
+    if (ici::check_interface(ici::version_number, ici::back_compat_version, "json"))
+    {
+        return nullptr;
+    }
+    if (init_ici_str())
+    {
+        return nullptr;
+    }
+    static ICI_DEFINE_CFUNCS(json)
+    {
+        ICI_DEFINE_CFUNC(encode, f_encode),
+        ICI_DEFINE_CFUNC(tostring, f_tostring),
+        ICI_DEFINE_CFUNC(decode, f_decode),
+        ICI_DEFINE_CFUNC(read, f_read),
+        ICI_DEFINE_CFUNC(eof, f_eof),
+        ICI_CFUNCS_END()
+    };
+    return ici::new_module(ICI_CFUNCS(json));
+}
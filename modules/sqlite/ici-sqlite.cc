@@ -19,6 +19,8 @@
 
 #include <ici.h>
 
+#include <ctype.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -47,20 +49,118 @@ void db_pre_free(ici::handle *h)
 {
     if (!isclosed(h))
     {
-	sqlite3_close(static_cast<sqlite3 *>(h->h_ptr));
+	sqlite3_close_v2(static_cast<sqlite3 *>(h->h_ptr));
     }
 }
 
+/*
+ * Handles are atoms, found by their pointer, so when SQLite reuses the
+ * memory of a closed database or statement the new one's handle is the
+ * closed one's, which must be opened again.
+ */
 ici::handle *new_db(sqlite3 *s)
 {
     if (auto h = ici::new_handle(s, ICIS(db), db_class))
     {
 	h->h_pre_free = db_pre_free;
+        h->clr(ici::handle::CLOSED);
         return h;
     }
     return nullptr;
 }
 
+/* ----------------------------------------------------------------
+ *
+ *  'stmt' object type - an ICI handle instance with a prepared
+ *  statement, a 'sqlite3_stmt *', as its pointer.  Databases are
+ *  closed with sqlite3_close_v2() so a statement outliving its 'db'
+ *  keeps the connection open until the statement is finalized.
+ *
+ */
+
+ici::objwsup *stmt_class = nullptr;
+
+/*
+ * Set in a stmt's flags while it is being stepped outside the ICI
+ * interpreter, when other threads must not use it.
+ */
+constexpr int STMT_BUSY = 0x80;
+
+void stmt_pre_free(ici::handle *h)
+{
+    if (!isclosed(h))
+    {
+        sqlite3_finalize(static_cast<sqlite3_stmt *>(h->h_ptr));
+    }
+}
+
+ici::handle *new_stmt(sqlite3_stmt *st)
+{
+    if (auto h = ici::new_handle(st, ICIS(stmt), stmt_class))
+    {
+        h->h_pre_free = stmt_pre_free;
+        h->clr(ici::handle::CLOSED);
+        return h;
+    }
+    return nullptr;
+}
+
+sqlite3_stmt *get_stmt(ici::object *inst)
+{
+    ici::handle *h;
+    void *ptr;
+
+    if (ici::handle_method_check(inst, ICIS(stmt), &h, &ptr))
+    {
+        return nullptr;
+    }
+    if (isclosed(h))
+    {
+        ici::set_error("attempt to use closed stmt");
+        return nullptr;
+    }
+    if (h->hasflag(STMT_BUSY))
+    {
+        ici::set_error("stmt in use");
+        return nullptr;
+    }
+    return static_cast<sqlite3_stmt *>(ptr);
+}
+
+/* ----------------------------------------------------------------
+ *
+ *  'cursor' object type - returned by stmt:rows(), a cursor steps
+ *  its statement as it is iterated by forall, so only one row of a
+ *  result is held at a time.
+ *
+ */
+
+struct cursor : ici::object
+{
+    ici::handle *c_stmt;  /* The stmt handle. */
+    ici::array  *c_names; /* Column names, made on the first row. */
+};
+
+inline cursor *cursorof(ici::object *o)
+{
+    return static_cast<cursor *>(o);
+}
+
+class cursor_type : public ici::type
+{
+public:
+    static int code;
+
+    cursor_type() : ici::type("cursor", sizeof (struct cursor))
+    {
+    }
+
+    size_t mark(ici::object *o) override;
+    int forall(ici::object *o) override;
+};
+
+int cursor_type::code;
+
 /* ----------------------------------------------------------------
  *
  * Module functions.
@@ -167,9 +267,12 @@ int f_open()
  *
  * A 'db' instance provides the following methods:
  *
- * - array = db:exec(string)
- *      Execute the SQL statement against the database and return an
- *      array of the "rows" returned by the statement.
+ * - array = db:exec(string [, any...])
+ *      Execute the SQL statements against the database and return an
+ *      array of the "rows" returned by the statements.
+ *
+ * - stmt = db:prepare(string)
+ *      Compile an SQL statement for repeated execution.
  *
  * - int = db:changes()
  *      Return the count of changes made by the last database operation.
@@ -198,50 +301,276 @@ sqlite3 *get_sqlite(ici::object *inst)
     return get_sqlite(inst, &_);
 }
 
-int callback(void *u, int ncols, char **cols, char **names)
+/* ----------------------------------------------------------------
+ *
+ * Statement support shared by db:exec() and the sqlite.stmt class.
+ *
+ */
+
+/*
+ * Step the statement, leaving the ICI interpreter while SQLite works
+ * so other ICI threads may run during long queries.  The statement's
+ * handle, if it has one, is marked busy meanwhile so other threads
+ * can't reset, rebind or finalize it.  Returns the SQLite result code.
+ */
+int step(sqlite3_stmt *st, ici::handle *h = nullptr)
 {
-    ici::array * rows = ici::arrayof(static_cast<ici::object *>(u));
+    if (h != nullptr)
+    {
+        h->set(STMT_BUSY);
+    }
+    auto x = ici::leave();
+    auto rc = sqlite3_step(st);
+    ici::enter(x);
+    if (h != nullptr)
+    {
+        h->clr(STMT_BUSY);
+    }
+    return rc;
+}
 
-    auto row = ici::make_ref(ici::new_map());
-    if (!row)
+/*
+ * Bind the ICI value o to the i'th (from 1) parameter of the statement.
+ * Returns 1 on error, usual conventions.
+ */
+int bind_value(sqlite3_stmt *st, int i, ici::object *o)
+{
+    int rc;
+
+    if (ici::isint(o))
     {
-	return 1;
+        rc = sqlite3_bind_int64(st, i, ici::intof(o)->i_value);
     }
-    for (int i = 0; i < ncols; ++i)
+    else if (ici::isfloat(o))
     {
-	if (cols[i] != nullptr)
-	{
-            auto col = ici::make_ref(ici::new_str_nul_term(names[i]));
-            if (!col)
+        rc = sqlite3_bind_double(st, i, ici::floatof(o)->f_value);
+    }
+    else if (ici::isstring(o))
+    {
+        rc = sqlite3_bind_text(st, i, ici::stringof(o)->s_chars, ici::stringof(o)->s_nchars, SQLITE_TRANSIENT);
+    }
+    else if (ici::ismem(o))
+    {
+        auto m = ici::memof(o);
+        rc = sqlite3_bind_blob64(st, i, m->m_base, m->m_length * m->m_accessz, SQLITE_TRANSIENT);
+    }
+    else if (ici::isnull(o))
+    {
+        rc = sqlite3_bind_null(st, i);
+    }
+    else
+    {
+        return ici::set_error("attempt to bind a %s to an SQL parameter", o->type_name());
+    }
+    if (rc != SQLITE_OK)
+    {
+        return ici::set_error("%s", sqlite3_errstr(rc));
+    }
+    return 0;
+}
+
+/*
+ * Bind the parameters of the statement from the nargs arguments at ap,
+ * which, as for ICI's ARGS(), run downwards in memory.  A single map
+ * argument binds named parameters (:name, @name or $name) by the name
+ * without its prefix, otherwise arguments are bound in order.  In that
+ * case *used is advanced by the number of arguments consumed so
+ * successive statements from one string take successive arguments.
+ * Returns 1 on error, usual conventions.
+ */
+int bind_args(sqlite3_stmt *st, ici::object **ap, int nargs, int *used)
+{
+    const int nparams = sqlite3_bind_parameter_count(st);
+
+    if (nargs == 1 && ici::ismap(ap[0]))
+    {
+        for (int i = 1; i <= nparams; ++i)
+        {
+            auto name = sqlite3_bind_parameter_name(st, i);
+            if (name == nullptr)
+            {
+                return ici::set_error("SQL parameter %d is not named", i);
+            }
+            auto k = ici::make_ref(ici::new_str_nul_term(name + 1));
+            if (!k)
             {
                 return 1;
             }
-            // TOOD: use column type to create appropriate ICI type
-            auto val = ici::make_ref(ici::new_str_nul_term(cols[i]));
-            if (!val || row->assign(col, val))
+            auto v = ici::mapof(ap[0])->fetch(k);
+            if (v == nullptr || bind_value(st, i, v))
             {
-		return 1;
+                return 1;
             }
-	}
+        }
+        *used = 1;
+        return 0;
+    }
+    if (*used + nparams > nargs)
+    {
+        return ici::set_error("%d SQL parameters but only %d arguments", *used + nparams, nargs);
+    }
+    for (int i = 1; i <= nparams; ++i)
+    {
+        if (bind_value(st, i, ap[-(*used)++]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Return an array of the statement's column names, as strings, or
+ * nullptr on error.  The array has been increfed.
+ */
+ici::array *column_names(sqlite3_stmt *st)
+{
+    const int ncols = sqlite3_column_count(st);
+
+    auto names = ici::make_ref(ici::new_array(ncols));
+    if (!names)
+    {
+        return nullptr;
+    }
+    for (int i = 0; i < ncols; ++i)
+    {
+        auto name = ici::make_ref(ici::new_str_nul_term(sqlite3_column_name(st, i)));
+        if (!name || names->push_back(name))
+        {
+            return nullptr;
+        }
+    }
+    return names.release();
+}
+
+/*
+ * Return the value of the statement's i'th column in the current row as
+ * an int, float, string or, for blobs, mem.  The object has been
+ * increfed.  Returns nullptr on error, usual conventions.
+ */
+ici::object *column_value(sqlite3_stmt *st, int i)
+{
+    switch (sqlite3_column_type(st, i))
+    {
+    case SQLITE_INTEGER:
+        return ici::new_int(sqlite3_column_int64(st, i));
+
+    case SQLITE_FLOAT:
+        return ici::new_float(sqlite3_column_double(st, i));
+
+    case SQLITE_BLOB:
+        {
+            auto p = sqlite3_column_blob(st, i);
+            const size_t n = sqlite3_column_bytes(st, i);
+            void *base = ici::ici_alloc(n == 0 ? 1 : n);
+            if (base == nullptr)
+            {
+                return nullptr;
+            }
+            memcpy(base, p, n);
+            if (auto m = ici::new_mem(base, n, 1, ici::ici_free))
+            {
+                return m;
+            }
+            ici::ici_free(base);
+            return nullptr;
+        }
+
+    case SQLITE_NULL:
+        ici::null->incref();
+        return ici::null;
+
+    default:
+        {
+            auto p = reinterpret_cast<const char *>(sqlite3_column_text(st, i));
+            return ici::new_str(p, sqlite3_column_bytes(st, i));
+        }
+    }
+}
+
+/*
+ * Return a map of the statement's current row, keyed by the column
+ * names.  NULL columns are omitted.  The map has been increfed.
+ * Returns nullptr on error, usual conventions.
+ */
+ici::map *make_row(sqlite3_stmt *st, ici::array *names)
+{
+    auto row = ici::make_ref(ici::new_map());
+    if (!row)
+    {
+        return nullptr;
+    }
+    int i = 0;
+    for (auto e = names->a_bot; e < names->a_top; ++e, ++i)
+    {
+        if (sqlite3_column_type(st, i) == SQLITE_NULL)
+        {
+            continue;
+        }
+        auto val = ici::make_ref(column_value(st, i));
+        if (!val || row->assign(*e, val))
+        {
+            return nullptr;
+        }
+    }
+    return row.release();
+}
+
+/*
+ * Run the statement to completion, pushing its rows onto the array.
+ * The statement is left reset.  Returns 1 on error, usual conventions.
+ */
+int run(sqlite3_stmt *st, ici::array *rows, ici::handle *h = nullptr)
+{
+    ici::ref<ici::array> names;
+    int rc;
+
+    while ((rc = step(st, h)) == SQLITE_ROW)
+    {
+        if (!names && !(names = column_names(st)))
+        {
+            sqlite3_reset(st);
+            return 1;
+        }
+        auto row = ici::make_ref(make_row(st, names));
+        if (!row || rows->push_checked(row))
+        {
+            sqlite3_reset(st);
+            return 1;
+        }
     }
-    return rows->push_checked(row, ici::with_decref) ? 1 : 0;
+    sqlite3_reset(st);
+    if (rc != SQLITE_DONE)
+    {
+        return ici::set_error("%s", sqlite3_errmsg(sqlite3_db_handle(st)));
+    }
+    return 0;
 }
 
 /*
- * array = db:exec(string)
+ * array = db:exec(string [, any...])
  *
  * Execute SQL statements against the database and return an array
- * with the rows resulting from those statements.
+ * with the rows resulting from those statements.  Each row is a map
+ * from column name to value, an int, float, string or, for blobs, a
+ * mem.  NULL values are omitted from the rows.
+ *
+ * Any further arguments are bound to the parameters (? and ?NNN, or
+ * :name, @name and $name) of the statements, in order.  If the only
+ * further argument is a map named parameters are bound to the value
+ * of the same name in the map.  Binding values, rather than
+ * formatting them into the SQL, avoids quoting problems and lets
+ * SQLite reuse its work.  See also db:prepare().
  *
  * This --topic-- forms part of the --ici-sqlite-- documentation.
  */
 int f_db_exec(ici::object *inst)
 {
-    char *statement;
-    char *err;
+    char *sql;
     sqlite3 *s;
+    int used = 0;
 
-    if (!(s = get_sqlite(inst)) || ici::typecheck("s", &statement))
+    if (!(s = get_sqlite(inst)) || ici::typecheck("s*", &sql))
     {
 	return 1;
     }
@@ -250,9 +579,27 @@ int f_db_exec(ici::object *inst)
     {
 	return 1;
     }
-    if (sqlite3_exec(s, statement, callback, rows.get(), &err) != SQLITE_OK)
+    for (const char *tail = sql; *tail != '\0'; )
     {
-	return ici::set_error("%s: %s", statement, err);
+        sqlite3_stmt *st;
+        if (sqlite3_prepare_v2(s, tail, -1, &st, &tail) != SQLITE_OK)
+        {
+            return ici::set_error("%s: %s", sql, sqlite3_errmsg(s));
+        }
+        if (st == nullptr) /* Whitespace or a comment. */
+        {
+            continue;
+        }
+        if (bind_args(st, ici::ARGS() - 1, ici::NARGS() - 1, &used) || run(st, rows))
+        {
+            sqlite3_finalize(st);
+            return 1;
+        }
+        sqlite3_finalize(st);
+    }
+    if (used < ici::NARGS() - 1)
+    {
+        return ici::set_error("%d arguments but only %d SQL parameters", ici::NARGS() - 1, used);
     }
     return ici::ret_no_decref(rows);
 }
@@ -273,6 +620,262 @@ int f_db_changes(ici::object *inst)
     return 1;
 }
 
+/*
+ * sqlite.stmt = db:prepare(string)
+ *
+ * Compile a single SQL statement and return it as an instance of the
+ * "sqlite.stmt" class.  A statement may be executed any number of times,
+ * with different parameters, without SQLite parsing and planning it
+ * again.  Executing one prepared insert, many times, inside a
+ * transaction is the fast way to load a table.
+ *
+ * This --topic-- forms part of the --ici-sqlite-- documentation.
+ */
+int f_db_prepare(ici::object *inst)
+{
+    char *sql;
+    sqlite3 *s;
+    sqlite3_stmt *st;
+    const char *tail;
+
+    if (!(s = get_sqlite(inst)) || ici::typecheck("s", &sql))
+    {
+        return 1;
+    }
+    if (sqlite3_prepare_v2(s, sql, -1, &st, &tail) != SQLITE_OK)
+    {
+        return ici::set_error("%s: %s", sql, sqlite3_errmsg(s));
+    }
+    if (st == nullptr)
+    {
+        return ici::set_error("%s: no SQL statement", sql);
+    }
+    while (isspace(*tail) || *tail == ';')
+    {
+        ++tail;
+    }
+    if (*tail != '\0')
+    {
+        sqlite3_finalize(st);
+        return ici::set_error("%s: more than one SQL statement", sql);
+    }
+    auto h = new_stmt(st);
+    if (h == nullptr)
+    {
+        sqlite3_finalize(st);
+        return 1;
+    }
+    return ici::ret_with_decref(h);
+}
+
+/* ----------------------------------------------------------------
+ *
+ * sqlite.stmt implementation
+ *
+ * The 'stmt' class represents a prepared statement and is the class
+ * of the object returned by db:prepare().  Where a method takes
+ * arguments they are bound to the statement's parameters as for
+ * db:exec().  Without arguments the previous bindings are used.
+ *
+ * - array = stmt:exec([any...])
+ *      Execute the statement and return an array of its rows.
+ *
+ * - cursor = stmt:rows([any...])
+ *      Return a cursor that, as it is iterated with forall, steps
+ *      the statement and yields its rows one at a time.
+ *
+ * - map = stmt:step()
+ *      Step the statement, returning the next row or NULL once there
+ *      are no more rows, after which the statement is reset.
+ *
+ * - stmt:bind(any...)
+ *      Reset the statement and bind its parameters.
+ *
+ * - stmt:reset()
+ *      Reset the statement so the next step starts from its first row.
+ *
+ * - stmt:close()
+ *      Finalize the statement. It may not be used afterwards.
+ *
+ */
+
+/*
+ * Reset the statement and, if the method was passed any arguments,
+ * bind them to its parameters.  Returns 1 on error, usual conventions.
+ */
+int rebind(sqlite3_stmt *st)
+{
+    int used = 0;
+
+    sqlite3_reset(st);
+    if (ici::NARGS() == 0)
+    {
+        return 0;
+    }
+    if (bind_args(st, ici::ARGS(), ici::NARGS(), &used))
+    {
+        return 1;
+    }
+    if (used < ici::NARGS())
+    {
+        return ici::set_error("%d arguments but only %d SQL parameters", ici::NARGS(), used);
+    }
+    return 0;
+}
+
+int f_stmt_bind(ici::object *inst)
+{
+    if (auto st = get_stmt(inst))
+    {
+        return rebind(st) ? 1 : ici::null_ret();
+    }
+    return 1;
+}
+
+int f_stmt_exec(ici::object *inst)
+{
+    auto st = get_stmt(inst);
+    if (st == nullptr || rebind(st))
+    {
+        return 1;
+    }
+    auto rows = ici::make_ref(ici::new_array());
+    if (!rows || run(st, rows, ici::handleof(inst)))
+    {
+        return 1;
+    }
+    return ici::ret_no_decref(rows);
+}
+
+int f_stmt_step(ici::object *inst)
+{
+    auto st = get_stmt(inst);
+    if (st == nullptr)
+    {
+        return 1;
+    }
+    switch (step(st, ici::handleof(inst)))
+    {
+    case SQLITE_ROW:
+        break;
+
+    case SQLITE_DONE:
+        sqlite3_reset(st);
+        return ici::null_ret();
+
+    default:
+        sqlite3_reset(st);
+        return ici::set_error("%s", sqlite3_errmsg(sqlite3_db_handle(st)));
+    }
+    auto names = ici::make_ref(column_names(st));
+    if (!names)
+    {
+        return 1;
+    }
+    return ici::ret_with_decref(make_row(st, names));
+}
+
+int f_stmt_rows(ici::object *inst)
+{
+    auto st = get_stmt(inst);
+    if (st == nullptr || rebind(st))
+    {
+        return 1;
+    }
+    auto c = ici::ici_talloc<cursor>();
+    if (c == nullptr)
+    {
+        return 1;
+    }
+    set_tfnz(c, cursor_type::code, 0, 1, 0);
+    c->c_stmt = ici::handleof(inst);
+    c->c_names = nullptr;
+    rego(c);
+    return ici::ret_with_decref(c);
+}
+
+int f_stmt_reset(ici::object *inst)
+{
+    if (auto st = get_stmt(inst))
+    {
+        sqlite3_reset(st);
+        return ici::null_ret();
+    }
+    return 1;
+}
+
+int f_stmt_close(ici::object *inst)
+{
+    if (auto st = get_stmt(inst))
+    {
+        sqlite3_finalize(st);
+        ici::handleof(inst)->set(ici::handle::CLOSED);
+        return ici::null_ret();
+    }
+    return 1;
+}
+
+size_t cursor_type::mark(ici::object *o)
+{
+    auto c = cursorof(o);
+    return type::mark(o) + c->c_stmt->mark() + ici::mark_optional(c->c_names);
+}
+
+int cursor_type::forall(ici::object *o)
+{
+    auto fa = ici::forallof(o);
+    auto c = cursorof(fa->fa_aggr);
+
+    if (isclosed(c->c_stmt))
+    {
+        return ici::set_error("attempt to use closed stmt");
+    }
+    if (c->c_stmt->hasflag(STMT_BUSY))
+    {
+        return ici::set_error("stmt in use");
+    }
+    auto st = static_cast<sqlite3_stmt *>(c->c_stmt->h_ptr);
+    switch (step(st, c->c_stmt))
+    {
+    case SQLITE_ROW:
+        break;
+
+    case SQLITE_DONE:
+        sqlite3_reset(st);
+        return -1;
+
+    default:
+        sqlite3_reset(st);
+        return ici::set_error("%s", sqlite3_errmsg(sqlite3_db_handle(st)));
+    }
+    ++fa->fa_index;
+    if (c->c_names == nullptr)
+    {
+        if ((c->c_names = column_names(st)) == nullptr)
+        {
+            return 1;
+        }
+        c->c_names->decref();
+    }
+    if (fa->fa_vaggr != ici::null)
+    {
+        auto row = ici::make_ref(make_row(st, c->c_names));
+        if (!row || ici::ici_assign(fa->fa_vaggr, fa->fa_vkey, row))
+        {
+            return 1;
+        }
+    }
+    if (fa->fa_kaggr != ici::null)
+    {
+        auto i = ici::make_ref(ici::new_int(fa->fa_index));
+        if (!i || ici::ici_assign(fa->fa_kaggr, fa->fa_kkey, i))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 } // anon namespace
 
 /* ----------------------------------------------------------------
@@ -291,6 +894,11 @@ extern "C" ici::object *ici_sqlite_init()
     {
         return nullptr;
     }
+    static cursor_type cursor_type;
+    if (!(cursor_type::code = ici::register_type(&cursor_type)))
+    {
+        return nullptr;
+    }
 
     static ICI_DEFINE_CFUNCS(sqlite)
     {
@@ -310,6 +918,7 @@ extern "C" ici::object *ici_sqlite_init()
     {
         ICI_DEFINE_CFUNC(changes, f_db_changes),
         ICI_DEFINE_CFUNC(exec, f_db_exec),
+        ICI_DEFINE_CFUNC(prepare, f_db_prepare),
         ICI_CFUNCS_END()
     };
 
@@ -320,5 +929,29 @@ extern "C" ici::object *ici_sqlite_init()
         return nullptr;
     }
 
+    /*
+     * assign_cfuncs() takes over the reference of each name, so names
+     * also used by db_methods need another.
+     */
+    ICIS(exec)->incref();
+
+    static ICI_DEFINE_CFUNCS(stmt_methods)
+    {
+        ICI_DEFINE_CFUNC(bind, f_stmt_bind),
+        ICI_DEFINE_CFUNC(close, f_stmt_close),
+        ICI_DEFINE_CFUNC(exec, f_stmt_exec),
+        ICI_DEFINE_CFUNC(reset, f_stmt_reset),
+        ICI_DEFINE_CFUNC(rows, f_stmt_rows),
+        ICI_DEFINE_CFUNC(step, f_stmt_step),
+        ICI_CFUNCS_END()
+    };
+
+    stmt_class = ici::new_class(ICI_CFUNCS(stmt_methods), module);
+    if (!stmt_class)
+    {
+        module->decref();
+        return nullptr;
+    }
+
     return module;
 }
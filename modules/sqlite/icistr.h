@@ -3,9 +3,16 @@
  *  Copyright (C) 2019 A.Newman.
  */
 
+ICI_STR(bind, "bind")
 ICI_STR(changes, "changes")
+ICI_STR(close, "close")
 ICI_STR(db, "db")
 ICI_STR(exec, "exec")
 ICI_STR(open, "open")
+ICI_STR(prepare, "prepare")
+ICI_STR(reset, "reset")
+ICI_STR(rows, "rows")
+ICI_STR(step, "step")
+ICI_STR(stmt, "stmt")
 ICI_STR(version, "version")
 ICI_STR(version_number, "version_number")
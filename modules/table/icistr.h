@@ -0,0 +1,10 @@
+ICI_STR(columns, "columns")
+ICI_STR(filter, "filter")
+ICI_STR(from_rows, "from_rows")
+ICI_STR(group, "group")
+ICI_STR(join, "join")
+ICI_STR(new, "new")
+ICI_STR(rows, "rows")
+ICI_STR(select, "select")
+ICI_STR(sort, "sort")
+ICI_STR(where, "where")
@@ -0,0 +1,1536 @@
+/*
+ * The table module provides a columnar table type for reporting and
+ * analytics over tabular data.
+ *
+ *      table = table.new(name, column [, name, column...])
+ *      table = table.from_rows(array [, names])
+ *      table = table.query(db, sql [, any...])
+ *      table = table.read_json([file])
+ *      array = table.rows(table)
+ *      array = table.columns(table)
+ *      table = table.select(table, name...)
+ *      table = table.where(table, name, op, value)
+ *      table = table.filter(table, vec)
+ *      table = table.sort(table, keys)
+ *      table = table.group(table, by, op, name [, op, name...])
+ *      table = table.join(table, table, name)
+ *
+ * A table is a set of named columns, all with one value per row.
+ * Numeric columns are held in vec64f objects and string columns as a
+ * dictionary of the distinct strings and a 32 bit code per row. A
+ * million rows is then a few flat vectors, rather than a million maps
+ * of boxed values, and the operations below are loops over those
+ * vectors. Columns of only ints, none beyond 2^53 in magnitude so
+ * that doubles hold them exactly, are read back as ints. NULL values are
+ * held as NaN, or as a NULL in the dictionary, and are left out of rows
+ * as they are for sqlite rows.
+ *
+ * Tables are not changed once made. Each operation returns a new table
+ * sharing any columns it did not change with its argument.
+ *
+ * Indexing a table with a column name returns the column's values, a
+ * vec64f or an array of strings, and indexing it with an integer
+ * returns that row as a map. len() is the number of rows and forall
+ * iterates the rows, as maps.
+ *
+ * new() makes a table from pairs of names and columns, where a column
+ * is an array of numbers or strings, or a vec32f or vec64f.
+ * from_rows() makes a table from an array of maps, such as returned
+ * by sqlite's db:exec() or json.decode(), with the given column names
+ * or else all the keys of the rows in sorted order. query() and
+ * read_json() load the results of an SQL query and a JSON array, or
+ * stream of JSON objects. rows() and columns() return the rows, as
+ * maps, and the column names.
+ *
+ * select() returns a table of just the named columns. where() returns
+ * the rows whose value in the named column compares to the value with
+ * op, one of "==", "!=", "<", "<=", ">" or ">=", and filter() the rows
+ * where the vec, with one value per row, is non-zero.
+ *
+ * sort() sorts the rows by the column named by keys, or an array of
+ * names each sorting ties of the previous. A name starting with '-'
+ * sorts in descending order. NULLs sort after all other values.
+ *
+ * group() returns a row for each distinct value of the column named by
+ * by, or combination of values of an array of names, in order of
+ * first appearance. For each op, name pair it adds a column named
+ * op_name of the op, one of "count", "sum", "mean", "min" and "max",
+ * over the group's non-NULL values of the named column.
+ *
+ * join() returns a row for each pair of rows of its tables with equal
+ * values in the named column, that neither table has NULL. The
+ * result has the first table's columns then the second's, other than
+ * the named column, and the tables must not share other names.
+ *
+ * This --intro-- and --synopsis-- are part of --ici-table-- documentation.
+ */
+
+#include <ici.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+#include "icistr.h"
+#include <icistr-setup.h>
+
+/*
+ * The kinds of column. INTEGER columns were made from ints and are
+ * held as doubles, exact up to 2^53, but read back as ints. Values
+ * beyond that, as sums may be, are read back as floats.
+ */
+enum column_kind
+{
+    NUMBER,
+    INTEGER,
+    STRING
+};
+
+/*
+ * The largest magnitude up to which doubles hold every integer.
+ */
+constexpr double max_exact_int = 9007199254740992.0; /* 2^53 */
+
+using codes = std::vector<uint32_t>;
+
+/*
+ * A column of a table. Numeric columns hold their values in c_values.
+ * String columns hold, for each row, the index into c_dict, an array
+ * of the distinct atomic strings and perhaps NULL. The values, the
+ * dictionary and the codes may be shared by several tables and are
+ * never changed.
+ *
+ * A column in a vector of columns being made into a table holds a
+ * reference to each of its objects, see drop() and new_table().
+ */
+struct column
+{
+    ici::str                    *c_name;
+    column_kind                  c_kind;
+    ici::vec64f                 *c_values;
+    ici::array                  *c_dict;
+    std::shared_ptr<const codes> c_codes;
+
+    bool isnull(size_t i) const
+    {
+        if (c_kind == STRING)
+        {
+            return ici::isnull(c_dict->a_bot[(*c_codes)[i]]);
+        }
+        return std::isnan(c_values->v_ptr[i]);
+    }
+};
+
+using columns = std::vector<column>;
+
+struct table : ici::object
+{
+    size_t   t_nrows;
+    columns *t_columns;
+};
+
+inline table *tableof(ici::object *o)
+{
+    return static_cast<table *>(o);
+}
+
+class table_type : public ici::type
+{
+public:
+    static int code;
+
+    table_type() : ici::type("table", sizeof (struct table))
+    {
+    }
+
+    size_t       mark(ici::object *o) override;
+    void         free(ici::object *o) override;
+    int64_t      len(ici::object *o) override;
+    ici::object *fetch(ici::object *o, ici::object *k) override;
+    int          forall(ici::object *o) override;
+};
+
+int table_type::code;
+
+inline bool istable(ici::object *o)
+{
+    return o->hastype(table_type::code);
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Columns and tables.
+ *
+ */
+
+/*
+ * Release the references held by the columns, which are then empty.
+ */
+void drop(columns &cols)
+{
+    for (auto &c : cols)
+    {
+        c.c_name->decref();
+        if (c.c_values != nullptr)
+        {
+            c.c_values->decref();
+        }
+        if (c.c_dict != nullptr)
+        {
+            c.c_dict->decref();
+        }
+    }
+    cols.clear();
+}
+
+/*
+ * Add to cols a column sharing everything with c.
+ */
+void share(columns &cols, const column &c)
+{
+    c.c_name->incref();
+    if (c.c_values != nullptr)
+    {
+        c.c_values->incref();
+    }
+    if (c.c_dict != nullptr)
+    {
+        c.c_dict->incref();
+    }
+    cols.push_back(c);
+}
+
+/*
+ * Add to cols a numeric column of n, as yet unset, values. Returns
+ * nullptr on error, usual conventions.
+ */
+double *add_numeric(columns &cols, ici::str *name, column_kind kind, size_t n)
+{
+    auto v = ici::new_vec64f(n == 0 ? 1 : n, n);
+    if (v == nullptr)
+    {
+        return nullptr;
+    }
+    name->incref();
+    cols.push_back(column{name, kind, v, nullptr, nullptr});
+    return v->v_ptr;
+}
+
+/*
+ * Add to cols a string column with the dictionary dict and codes.
+ */
+void add_string(columns &cols, ici::str *name, ici::array *dict, std::shared_ptr<const codes> c)
+{
+    name->incref();
+    dict->incref();
+    cols.push_back(column{name, STRING, nullptr, dict, std::move(c)});
+}
+
+/*
+ * Return a new table of nrows rows with the given columns, taking
+ * over their references. The table has been increfed. Returns nullptr
+ * on error, usual conventions.
+ */
+table *new_table(size_t nrows, columns &cols)
+{
+    auto t = ici::ici_talloc<table>();
+    if (t == nullptr)
+    {
+        drop(cols);
+        return nullptr;
+    }
+    set_tfnz(t, table_type::code, 0, 1, 0);
+    t->t_nrows = nrows;
+    t->t_columns = new columns(std::move(cols));
+    rego(t);
+    /*
+     * The table now marks the columns' objects.
+     */
+    columns held(*t->t_columns);
+    drop(held);
+    cols.clear();
+    return t;
+}
+
+/*
+ * Return the column of t with the given name, or nullptr, with an
+ * error set, if there is none.
+ */
+const column *find_column(table *t, ici::str *name)
+{
+    for (auto &c : *t->t_columns)
+    {
+        if (c.c_name == name)
+        {
+            return &c;
+        }
+    }
+    ici::set_error("table has no column \"%s\"", name->s_chars);
+    return nullptr;
+}
+
+/*
+ * Add to cols the column c reduced to the rows given by rows, in that
+ * order. Returns 1 on error, usual conventions.
+ */
+int add_gathered(columns &cols, const column &c, const std::vector<size_t> &rows)
+{
+    if (c.c_kind == STRING)
+    {
+        auto out = std::make_shared<codes>(rows.size());
+        auto &in = *c.c_codes;
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            (*out)[i] = in[rows[i]];
+        }
+        add_string(cols, c.c_name, c.c_dict, std::move(out));
+        return 0;
+    }
+    auto out = add_numeric(cols, c.c_name, c.c_kind, rows.size());
+    if (out == nullptr)
+    {
+        return 1;
+    }
+    auto in = c.c_values->v_ptr;
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        out[i] = in[rows[i]];
+    }
+    return 0;
+}
+
+/*
+ * Return a new table of the given rows of t. The table has been
+ * increfed. Returns nullptr on error, usual conventions.
+ */
+table *take(table *t, const std::vector<size_t> &rows)
+{
+    columns cols;
+
+    for (auto &c : *t->t_columns)
+    {
+        if (add_gathered(cols, c, rows))
+        {
+            drop(cols);
+            return nullptr;
+        }
+    }
+    return new_table(rows.size(), cols);
+}
+
+/*
+ * Add to cols a column made from the n ICI values at vals. Numbers make
+ * a numeric column and strings a string column, NULL is allowed in
+ * either. Returns 1 on error, usual conventions.
+ */
+int add_values(columns &cols, ici::str *name, ici::object **vals, size_t n)
+{
+    bool ints = false;
+    bool floats = false;
+    bool strings = false;
+    bool inexact = false;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto o = vals[i];
+        if (ici::isint(o))
+        {
+            ints = true;
+            const auto i = ici::intof(o)->i_value;
+            inexact |= i > int64_t(max_exact_int) || i < -int64_t(max_exact_int);
+        }
+        else if (ici::isfloat(o))
+        {
+            floats = true;
+        }
+        else if (ici::isstring(o))
+        {
+            strings = true;
+        }
+        else if (!ici::isnull(o))
+        {
+            return ici::set_error("column \"%s\" has a %s value", name->s_chars, o->type_name());
+        }
+    }
+    if (strings && (ints || floats))
+    {
+        return ici::set_error("column \"%s\" has both strings and numbers", name->s_chars);
+    }
+    if (!strings)
+    {
+        auto out = add_numeric(cols, name, ints && !floats && !inexact ? INTEGER : NUMBER, n);
+        if (out == nullptr)
+        {
+            return 1;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto o = vals[i];
+            if (ici::isint(o))
+            {
+                out[i] = double(ici::intof(o)->i_value);
+            }
+            else if (ici::isfloat(o))
+            {
+                out[i] = ici::floatof(o)->f_value;
+            }
+            else
+            {
+                out[i] = NAN;
+            }
+        }
+        return 0;
+    }
+
+    auto dict = ici::make_ref(ici::new_array());
+    if (!dict)
+    {
+        return 1;
+    }
+    auto c = std::make_shared<codes>(n);
+    std::unordered_map<ici::object *, uint32_t> index;
+    for (size_t i = 0; i < n; ++i)
+    {
+        /*
+         * Equal atomic strings are the same object so the dictionary
+         * can be indexed by address.
+         */
+        auto o = ici::atom(vals[i], 0);
+        auto e = index.find(o);
+        if (e != index.end())
+        {
+            (*c)[i] = e->second;
+            continue;
+        }
+        const auto code = uint32_t(index.size());
+        o->incref();
+        const auto failed = dict->push_back(o);
+        o->decref();
+        if (failed)
+        {
+            return 1;
+        }
+        (*c)[i] = index[o] = code;
+    }
+    add_string(cols, name, dict, std::move(c));
+    return 0;
+}
+
+/*
+ * Return the value of the i'th row of the column as an ICI object,
+ * with NaN as NULL. The object has been increfed. Returns nullptr on
+ * error, usual conventions.
+ */
+ici::object *value(const column &c, size_t i)
+{
+    ici::object *o;
+
+    if (c.c_kind == STRING)
+    {
+        o = c.c_dict->a_bot[(*c.c_codes)[i]];
+        o->incref();
+        return o;
+    }
+    const auto d = c.c_values->v_ptr[i];
+    if (std::isnan(d))
+    {
+        ici::null->incref();
+        return ici::null;
+    }
+    if (c.c_kind == INTEGER && std::fabs(d) <= max_exact_int)
+    {
+        return ici::new_int(int64_t(d));
+    }
+    return ici::new_float(d);
+}
+
+/*
+ * Return the i'th row of t as a map from column name to value, without
+ * NULL values. The map has been increfed. Returns nullptr on error.
+ */
+ici::map *make_row(table *t, size_t i)
+{
+    auto row = ici::make_ref(ici::new_map());
+    if (!row)
+    {
+        return nullptr;
+    }
+    for (auto &c : *t->t_columns)
+    {
+        if (c.isnull(i))
+        {
+            continue;
+        }
+        auto v = ici::make_ref(value(c, i));
+        if (!v || row->assign(c.c_name, v))
+        {
+            return nullptr;
+        }
+    }
+    return row.release();
+}
+
+/*
+ * Return the values of the column as a new vec64f or array of strings.
+ * The object has been increfed. Returns nullptr on error.
+ */
+ici::object *column_values(const column &c, size_t nrows)
+{
+    if (c.c_kind != STRING)
+    {
+        return ici::new_vec64f(c.c_values);
+    }
+    auto a = ici::make_ref(ici::new_array(nrows));
+    if (!a)
+    {
+        return nullptr;
+    }
+    for (auto code : *c.c_codes)
+    {
+        *a->a_top++ = c.c_dict->a_bot[code];
+    }
+    return a.release();
+}
+
+/*
+ * The key of a value for grouping and joining. Equal numbers, and the
+ * same atomic string, have the same key.
+ */
+uint64_t key_of(const column &c, size_t i)
+{
+    if (c.c_kind == STRING)
+    {
+        return uint64_t(uintptr_t(c.c_dict->a_bot[(*c.c_codes)[i]]));
+    }
+    auto d = c.c_values->v_ptr[i];
+    if (d == 0.0)
+    {
+        d = 0.0; /* -0.0 */
+    }
+    uint64_t k;
+    memcpy(&k, &d, sizeof k);
+    return k;
+}
+
+/*
+ * Mark this and referenced unmarked objects, return memory costs.
+ */
+size_t table_type::mark(ici::object *o)
+{
+    auto t = tableof(o);
+    auto mem = type::mark(o);
+    for (auto &c : *t->t_columns)
+    {
+        mem += c.c_name->mark() + ici::mark_optional(c.c_values) + ici::mark_optional(c.c_dict);
+        if (c.c_codes)
+        {
+            mem += c.c_codes->size() * sizeof (uint32_t);
+        }
+    }
+    return mem;
+}
+
+void table_type::free(ici::object *o)
+{
+    delete tableof(o)->t_columns;
+    type::free(o);
+}
+
+int64_t table_type::len(ici::object *o)
+{
+    return tableof(o)->t_nrows;
+}
+
+ici::object *table_type::fetch(ici::object *o, ici::object *k)
+{
+    auto t = tableof(o);
+    ici::object *v = nullptr;
+
+    if (ici::isint(k))
+    {
+        auto i = ici::intof(k)->i_value;
+        if (i < 0)
+        {
+            i += t->t_nrows;
+        }
+        if (i < 0 || size_t(i) >= t->t_nrows)
+        {
+            return ici::null;
+        }
+        v = make_row(t, size_t(i));
+    }
+    else if (ici::isstring(k))
+    {
+        auto c = std::find_if(t->t_columns->begin(), t->t_columns->end(), [k](const column &c)
+        {
+            return c.c_name == k;
+        });
+        if (c == t->t_columns->end())
+        {
+            return ici::null;
+        }
+        v = column_values(*c, t->t_nrows);
+    }
+    else
+    {
+        return fetch_fail(o, k);
+    }
+    if (v != nullptr)
+    {
+        v->decref();
+    }
+    return v;
+}
+
+int table_type::forall(ici::object *o)
+{
+    auto fa = ici::forallof(o);
+    auto t = tableof(fa->fa_aggr);
+
+    if (++fa->fa_index >= t->t_nrows)
+    {
+        return -1;
+    }
+    if (fa->fa_vaggr != ici::null)
+    {
+        auto row = ici::make_ref(make_row(t, fa->fa_index));
+        if (!row || ici::ici_assign(fa->fa_vaggr, fa->fa_vkey, row))
+        {
+            return 1;
+        }
+    }
+    if (fa->fa_kaggr != ici::null)
+    {
+        auto i = ici::make_ref(ici::new_int(int64_t(fa->fa_index)));
+        if (!i || ici::ici_assign(fa->fa_kaggr, fa->fa_kkey, i))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Module functions.
+ *
+ */
+
+/*
+ * Set *t to the table passed as argument i. Returns 1 on error.
+ */
+int table_arg(int i, table **t)
+{
+    if (i >= ici::NARGS())
+    {
+        return ici::argcount(i + 1);
+    }
+    if (!istable(ici::ARG(i)))
+    {
+        return ici::argerror(i);
+    }
+    *t = tableof(ici::ARG(i));
+    return 0;
+}
+
+/*
+ * Add the n names in the array, or the string, a to names. Returns 1
+ * on error, usual conventions.
+ */
+int names_of(ici::object *a, std::vector<ici::str *> &names)
+{
+    if (ici::isstring(a))
+    {
+        names.push_back(ici::stringof(a));
+        return 0;
+    }
+    if (!ici::isarray(a))
+    {
+        return ici::set_error("expected a column name or an array of names, not a %s", a->type_name());
+    }
+    for (auto e = ici::arrayof(a)->astart(); e != ici::arrayof(a)->alimit(); e = ici::arrayof(a)->anext(e))
+    {
+        if (!ici::isstring(*e))
+        {
+            return ici::set_error("a column name must be a string, not a %s", (*e)->type_name());
+        }
+        names.push_back(ici::stringof(*e));
+    }
+    return 0;
+}
+
+/*
+ * table = table.new(name, column [, name, column...])
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_new()
+{
+    columns cols;
+    size_t nrows = 0;
+
+    if (ici::NARGS() % 2 != 0)
+    {
+        return ici::set_error("table.new() given a name without a column");
+    }
+    for (int i = 0; i < ici::NARGS(); i += 2)
+    {
+        auto name = ici::ARG(i);
+        auto col = ici::ARG(i + 1);
+        size_t n;
+
+        if (!ici::isstring(name))
+        {
+            drop(cols);
+            return ici::argerror(i);
+        }
+        for (auto &c : cols)
+        {
+            if (c.c_name == name)
+            {
+                drop(cols);
+                return ici::set_error("table.new() given column \"%s\" twice", ici::stringof(name)->s_chars);
+            }
+        }
+        if (ici::isarray(col))
+        {
+            std::vector<ici::object *> vals;
+            for (auto e = ici::arrayof(col)->astart(); e != ici::arrayof(col)->alimit(); e = ici::arrayof(col)->anext(e))
+            {
+                vals.push_back(*e);
+            }
+            n = vals.size();
+            if (add_values(cols, ici::stringof(name), vals.data(), n))
+            {
+                drop(cols);
+                return 1;
+            }
+        }
+        else if (ici::isvec64f(col) || ici::isvec32f(col))
+        {
+            n = ici::vec_size(col);
+            auto out = add_numeric(cols, ici::stringof(name), NUMBER, n);
+            if (out == nullptr)
+            {
+                drop(cols);
+                return 1;
+            }
+            for (size_t j = 0; j < n; ++j)
+            {
+                out[j] = ici::isvec64f(col) ? (*ici::vec64fof(col))[j] : (*ici::vec32fof(col))[j];
+            }
+        }
+        else
+        {
+            drop(cols);
+            return ici::argerror(i + 1);
+        }
+        if (i > 0 && n != nrows)
+        {
+            drop(cols);
+            return ici::set_error("column \"%s\" has %zu values, not %zu", ici::stringof(name)->s_chars, n, nrows);
+        }
+        nrows = n;
+    }
+    return ici::ret_with_decref(new_table(nrows, cols));
+}
+
+/*
+ * table = table.from_rows(array [, names])
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_from_rows()
+{
+    ici::array *rows;
+    ici::object *which = nullptr;
+    std::vector<ici::str *> names;
+    std::vector<ici::object *> vals;
+    columns cols;
+
+    if (ici::typecheck("a", &rows))
+    {
+        if (ici::typecheck("ao", &rows, &which))
+        {
+            return 1;
+        }
+    }
+    if (which != nullptr)
+    {
+        if (names_of(which, names))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        for (auto e = rows->astart(); e != rows->alimit(); e = rows->anext(e))
+        {
+            if (!ici::ismap(*e))
+            {
+                return ici::set_error("table.from_rows() given a %s row", (*e)->type_name());
+            }
+            auto m = ici::mapof(*e);
+            for (auto sl = m->s_slots; sl < m->s_slots + m->s_nslots; ++sl)
+            {
+                if (sl->sl_key == nullptr)
+                {
+                    continue;
+                }
+                if (!ici::isstring(sl->sl_key))
+                {
+                    return ici::set_error("table.from_rows() given a row with a %s key", sl->sl_key->type_name());
+                }
+                if (std::find(names.begin(), names.end(), sl->sl_key) == names.end())
+                {
+                    names.push_back(ici::stringof(sl->sl_key));
+                }
+            }
+        }
+        std::sort(names.begin(), names.end(), [](ici::str *a, ici::str *b)
+        {
+            return strcmp(a->s_chars, b->s_chars) < 0;
+        });
+    }
+    for (auto name : names)
+    {
+        vals.clear();
+        for (auto e = rows->astart(); e != rows->alimit(); e = rows->anext(e))
+        {
+            auto v = ici::ici_fetch(*e, name);
+            if (v == nullptr)
+            {
+                drop(cols);
+                return 1;
+            }
+            vals.push_back(v);
+        }
+        if (add_values(cols, name, vals.data(), vals.size()))
+        {
+            drop(cols);
+            return 1;
+        }
+    }
+    return ici::ret_with_decref(new_table(rows->len(), cols));
+}
+
+/*
+ * array = table.rows(table)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_rows()
+{
+    table *t = nullptr;
+
+    if (table_arg(0, &t))
+    {
+        return 1;
+    }
+    auto a = ici::make_ref(ici::new_array(t->t_nrows));
+    if (!a)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < t->t_nrows; ++i)
+    {
+        auto row = make_row(t, i);
+        if (row == nullptr)
+        {
+            return 1;
+        }
+        *a->a_top++ = row;
+        row->decref();
+    }
+    return ici::ret_no_decref(a);
+}
+
+/*
+ * array = table.columns(table)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_columns()
+{
+    table *t = nullptr;
+
+    if (table_arg(0, &t))
+    {
+        return 1;
+    }
+    auto a = ici::make_ref(ici::new_array(t->t_columns->size()));
+    if (!a)
+    {
+        return 1;
+    }
+    for (auto &c : *t->t_columns)
+    {
+        *a->a_top++ = c.c_name;
+    }
+    return ici::ret_no_decref(a);
+}
+
+/*
+ * table = table.select(table, name...)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_select()
+{
+    table *t = nullptr;
+    std::vector<ici::str *> names;
+    columns cols;
+
+    if (table_arg(0, &t))
+    {
+        return 1;
+    }
+    for (int i = 1; i < ici::NARGS(); ++i)
+    {
+        if (names_of(ici::ARG(i), names))
+        {
+            return 1;
+        }
+    }
+    for (auto name : names)
+    {
+        auto c = find_column(t, name);
+        if (c == nullptr)
+        {
+            drop(cols);
+            return 1;
+        }
+        share(cols, *c);
+    }
+    return ici::ret_with_decref(new_table(t->t_nrows, cols));
+}
+
+enum comparison
+{
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE
+};
+
+/*
+ * Set *cmp to the comparison named by op. Returns 1 on error.
+ */
+int comparison_of(const char *op, comparison *cmp)
+{
+    static const struct
+    {
+        const char *name;
+        comparison  cmp;
+    } ops[] = {{"==", EQ}, {"!=", NE}, {"<", LT}, {"<=", LE}, {">", GT}, {">=", GE}};
+
+    for (auto &o : ops)
+    {
+        if (strcmp(op, o.name) == 0)
+        {
+            *cmp = o.cmp;
+            return 0;
+        }
+    }
+    return ici::set_error("\"%s\" is not a comparison", op);
+}
+
+/*
+ * Add to rows the indexes of the n values, for which compare(value, x)
+ * is true.
+ */
+template <typename compare>
+void matching(const double *values, size_t n, double x, compare cmp, std::vector<size_t> &rows)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (cmp(values[i], x))
+        {
+            rows.push_back(i);
+        }
+    }
+}
+
+/*
+ * table = table.where(table, name, op, value)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_where()
+{
+    table *t = nullptr;
+    ici::object *o;
+    char *op;
+    ici::object *x;
+    comparison cmp = EQ;
+    std::vector<size_t> rows;
+
+    if (table_arg(0, &t) || ici::typecheck("-oso", &o, &op, &x))
+    {
+        return 1;
+    }
+    if (!ici::isstring(o))
+    {
+        return ici::argerror(1);
+    }
+    auto name = ici::stringof(o);
+    auto c = find_column(t, name);
+    if (c == nullptr || comparison_of(op, &cmp))
+    {
+        return 1;
+    }
+    if (c->c_kind == STRING)
+    {
+        if (!ici::isstring(x) && !ici::isnull(x))
+        {
+            return ici::set_error("attempt to compare string column \"%s\" with a %s", name->s_chars, x->type_name());
+        }
+        /*
+         * Decide for each distinct string, then select the rows by
+         * their codes.
+         */
+        std::vector<char> keep(c->c_dict->len());
+        for (size_t i = 0; i < keep.size(); ++i)
+        {
+            auto s = c->c_dict->a_bot[i];
+            int r;
+            if (ici::isnull(s) || ici::isnull(x))
+            {
+                r = s == x ? 0 : 1;
+                if (cmp != EQ && cmp != NE)
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                r = strcmp(ici::stringof(s)->s_chars, ici::stringof(x)->s_chars);
+            }
+            switch (cmp)
+            {
+            case EQ: keep[i] = r == 0; break;
+            case NE: keep[i] = r != 0; break;
+            case LT: keep[i] = r < 0; break;
+            case LE: keep[i] = r <= 0; break;
+            case GT: keep[i] = r > 0; break;
+            case GE: keep[i] = r >= 0; break;
+            }
+        }
+        auto &in = *c->c_codes;
+        for (size_t i = 0; i < t->t_nrows; ++i)
+        {
+            if (keep[in[i]])
+            {
+                rows.push_back(i);
+            }
+        }
+    }
+    else
+    {
+        double v;
+        if (ici::isint(x))
+        {
+            v = double(ici::intof(x)->i_value);
+        }
+        else if (ici::isfloat(x))
+        {
+            v = ici::floatof(x)->f_value;
+        }
+        else
+        {
+            return ici::set_error("attempt to compare numeric column \"%s\" with a %s", name->s_chars, x->type_name());
+        }
+        auto p = c->c_values->v_ptr;
+        auto n = t->t_nrows;
+        switch (cmp)
+        {
+        case EQ: matching(p, n, v, [](double a, double b) { return a == b; }, rows); break;
+        case NE: matching(p, n, v, [](double a, double b) { return a != b; }, rows); break;
+        case LT: matching(p, n, v, [](double a, double b) { return a < b; }, rows); break;
+        case LE: matching(p, n, v, [](double a, double b) { return a <= b; }, rows); break;
+        case GT: matching(p, n, v, [](double a, double b) { return a > b; }, rows); break;
+        case GE: matching(p, n, v, [](double a, double b) { return a >= b; }, rows); break;
+        }
+    }
+    return ici::ret_with_decref(take(t, rows));
+}
+
+/*
+ * table = table.filter(table, vec)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_filter()
+{
+    table *t = nullptr;
+    ici::object *mask;
+    std::vector<size_t> rows;
+
+    if (table_arg(0, &t) || ici::typecheck("-o", &mask))
+    {
+        return 1;
+    }
+    if (!ici::isvec64f(mask) && !ici::isvec32f(mask))
+    {
+        return ici::argerror(1);
+    }
+    if (ici::vec_size(mask) != t->t_nrows)
+    {
+        return ici::set_error("filter has %zu values for %zu rows", ici::vec_size(mask), t->t_nrows);
+    }
+    for (size_t i = 0; i < t->t_nrows; ++i)
+    {
+        if (ici::isvec64f(mask) ? (*ici::vec64fof(mask))[i] != 0.0 : (*ici::vec32fof(mask))[i] != 0.0f)
+        {
+            rows.push_back(i);
+        }
+    }
+    return ici::ret_with_decref(take(t, rows));
+}
+
+/*
+ * table = table.sort(table, keys)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_sort()
+{
+    struct sort_key
+    {
+        const column     *col;
+        bool              desc;
+        std::vector<int>  rank; /* Of each string in the dictionary. */
+    };
+
+    table *t = nullptr;
+    ici::object *which;
+    std::vector<ici::str *> names;
+    std::vector<sort_key> keys;
+
+    if (table_arg(0, &t) || ici::typecheck("-o", &which) || names_of(which, names))
+    {
+        return 1;
+    }
+    for (auto name : names)
+    {
+        sort_key k;
+        ici::ref<ici::str> stripped;
+        k.desc = name->s_chars[0] == '-';
+        if (k.desc)
+        {
+            if (!(stripped = ici::new_str(name->s_chars + 1, name->s_nchars - 1)))
+            {
+                return 1;
+            }
+            name = stripped;
+        }
+        if ((k.col = find_column(t, name)) == nullptr)
+        {
+            return 1;
+        }
+        if (k.col->c_kind == STRING)
+        {
+            /*
+             * Compare strings by their rank in the sorted dictionary.
+             */
+            auto dict = k.col->c_dict->a_bot;
+            std::vector<int> order(k.col->c_dict->len());
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = int(i);
+            }
+            std::sort(order.begin(), order.end(), [dict](int a, int b)
+            {
+                if (ici::isnull(dict[a]) || ici::isnull(dict[b]))
+                {
+                    return !ici::isnull(dict[a]) && ici::isnull(dict[b]);
+                }
+                return strcmp(ici::stringof(dict[a])->s_chars, ici::stringof(dict[b])->s_chars) < 0;
+            });
+            k.rank.resize(order.size());
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                k.rank[order[i]] = int(i);
+            }
+        }
+        keys.push_back(std::move(k));
+    }
+
+    std::vector<size_t> rows(t->t_nrows);
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        rows[i] = i;
+    }
+    std::stable_sort(rows.begin(), rows.end(), [&keys](size_t a, size_t b)
+    {
+        for (auto &k : keys)
+        {
+            int r;
+            if (k.col->c_kind == STRING)
+            {
+                auto &c = *k.col->c_codes;
+                r = k.rank[c[a]] - k.rank[c[b]];
+                if (r != 0 && (k.col->isnull(a) || k.col->isnull(b)))
+                {
+                    return !k.col->isnull(a);
+                }
+            }
+            else
+            {
+                auto x = k.col->c_values->v_ptr[a];
+                auto y = k.col->c_values->v_ptr[b];
+                if (std::isnan(x) || std::isnan(y))
+                {
+                    if (std::isnan(x) != std::isnan(y))
+                    {
+                        return !std::isnan(x);
+                    }
+                    continue;
+                }
+                r = x < y ? -1 : x > y ? 1 : 0;
+            }
+            if (r != 0)
+            {
+                return k.desc ? r > 0 : r < 0;
+            }
+        }
+        return false;
+    });
+    return ici::ret_with_decref(take(t, rows));
+}
+
+/*
+ * Hash a (group, key) pair for grouping on several columns.
+ */
+struct group_hash
+{
+    size_t operator()(const std::pair<uint32_t, uint64_t> &k) const
+    {
+        return std::hash<uint64_t>()(k.second * 0x9E3779B97F4A7C15 ^ k.first);
+    }
+};
+
+/*
+ * table = table.group(table, by, op, name [, op, name...])
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_group()
+{
+    enum aggregate
+    {
+        COUNT,
+        SUM,
+        MEAN,
+        MIN,
+        MAX
+    };
+    static const char *aggregates[] = {"count", "sum", "mean", "min", "max"};
+
+    table *t = nullptr;
+    ici::object *by;
+    std::vector<ici::str *> names;
+    columns cols;
+
+    if (table_arg(0, &t) || ici::typecheck("-o*", &by) || names_of(by, names))
+    {
+        return 1;
+    }
+    if (ici::NARGS() % 2 != 0)
+    {
+        return ici::set_error("table.group() given an aggregate without a column");
+    }
+
+    /*
+     * Number the groups, in order of first appearance, one key column
+     * at a time. first[g] is the first row of group g.
+     */
+    const auto n = t->t_nrows;
+    std::vector<uint32_t> group(n, 0);
+    std::vector<size_t> first(n == 0 ? 0 : 1, 0);
+    for (auto name : names)
+    {
+        auto c = find_column(t, name);
+        if (c == nullptr)
+        {
+            return 1;
+        }
+        std::unordered_map<std::pair<uint32_t, uint64_t>, uint32_t, group_hash> ids;
+        first.clear();
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto r = ids.emplace(std::make_pair(group[i], key_of(*c, i)), uint32_t(first.size()));
+            if (r.second)
+            {
+                first.push_back(i);
+            }
+            group[i] = r.first->second;
+        }
+    }
+    const auto ngroups = first.size();
+
+    for (auto name : names)
+    {
+        if (add_gathered(cols, *find_column(t, name), first))
+        {
+            drop(cols);
+            return 1;
+        }
+    }
+    for (int i = 2; i < ici::NARGS(); i += 2)
+    {
+        if (!ici::isstring(ici::ARG(i)))
+        {
+            drop(cols);
+            return ici::argerror(i);
+        }
+        if (!ici::isstring(ici::ARG(i + 1)))
+        {
+            drop(cols);
+            return ici::argerror(i + 1);
+        }
+        auto opname = ici::stringof(ici::ARG(i))->s_chars;
+        int op = -1;
+        for (int j = 0; j < int(sizeof aggregates / sizeof aggregates[0]); ++j)
+        {
+            if (strcmp(opname, aggregates[j]) == 0)
+            {
+                op = j;
+            }
+        }
+        if (op < 0)
+        {
+            drop(cols);
+            return ici::set_error("\"%s\" is not an aggregate", opname);
+        }
+        auto c = find_column(t, ici::stringof(ici::ARG(i + 1)));
+        if (c == nullptr)
+        {
+            drop(cols);
+            return 1;
+        }
+        if (c->c_kind == STRING && op != COUNT)
+        {
+            drop(cols);
+            return ici::set_error("attempt to %s string column \"%s\"", opname, c->c_name->s_chars);
+        }
+        char buf[256];
+        snprintf(buf, sizeof buf, "%s_%s", opname, c->c_name->s_chars);
+        auto outname = ici::make_ref(ici::new_str_nul_term(buf));
+        if (!outname)
+        {
+            drop(cols);
+            return 1;
+        }
+        column_kind kind = NUMBER;
+        if (op == COUNT || (c->c_kind == INTEGER && op != MEAN))
+        {
+            kind = INTEGER;
+        }
+        auto out = add_numeric(cols, outname, kind, ngroups);
+        if (out == nullptr)
+        {
+            drop(cols);
+            return 1;
+        }
+        std::vector<size_t> count(ngroups, 0);
+        if (c->c_kind == STRING)
+        {
+            for (size_t r = 0; r < n; ++r)
+            {
+                count[group[r]] += !c->isnull(r);
+            }
+            for (size_t g = 0; g < ngroups; ++g)
+            {
+                out[g] = double(count[g]);
+            }
+            continue;
+        }
+        auto in = c->c_values->v_ptr;
+        switch (op)
+        {
+        case COUNT:
+        case SUM:
+        case MEAN:
+            std::fill(out, out + ngroups, 0.0);
+            for (size_t r = 0; r < n; ++r)
+            {
+                if (!std::isnan(in[r]))
+                {
+                    out[group[r]] += in[r];
+                    ++count[group[r]];
+                }
+            }
+            for (size_t g = 0; g < ngroups; ++g)
+            {
+                if (op == COUNT)
+                {
+                    out[g] = double(count[g]);
+                }
+                else if (op == MEAN)
+                {
+                    out[g] = count[g] == 0 ? NAN : out[g] / count[g];
+                }
+            }
+            break;
+
+        case MIN:
+        case MAX:
+            std::fill(out, out + ngroups, NAN);
+            for (size_t r = 0; r < n; ++r)
+            {
+                auto &o = out[group[r]];
+                if (!std::isnan(in[r]) && (std::isnan(o) || (op == MIN ? in[r] < o : in[r] > o)))
+                {
+                    o = in[r];
+                }
+            }
+            break;
+        }
+    }
+    return ici::ret_with_decref(new_table(ngroups, cols));
+}
+
+/*
+ * table = table.join(table, table, name)
+ *
+ * This --topic-- forms part of the --ici-table-- documentation.
+ */
+int f_join()
+{
+    table *l = nullptr;
+    table *r = nullptr;
+    ici::object *o;
+    columns cols;
+
+    if (table_arg(0, &l) || table_arg(1, &r) || ici::typecheck("--o", &o))
+    {
+        return 1;
+    }
+    if (!ici::isstring(o))
+    {
+        return ici::argerror(2);
+    }
+    auto name = ici::stringof(o);
+    auto lc = find_column(l, name);
+    auto rc = find_column(r, name);
+    if (lc == nullptr || rc == nullptr)
+    {
+        return 1;
+    }
+    if ((lc->c_kind == STRING) != (rc->c_kind == STRING))
+    {
+        return ici::set_error("attempt to join a string column \"%s\" with a numeric one", name->s_chars);
+    }
+    for (auto &c : *r->t_columns)
+    {
+        if (c.c_name != name)
+        {
+            for (auto &d : *l->t_columns)
+            {
+                if (d.c_name == c.c_name)
+                {
+                    return ici::set_error("attempt to join tables that both have column \"%s\"", c.c_name->s_chars);
+                }
+            }
+        }
+    }
+
+    /*
+     * Hash the second table's rows by key, chaining rows with the
+     * same key in order, then probe with each row of the first.
+     */
+    std::unordered_map<uint64_t, size_t> head;
+    std::vector<size_t> next(r->t_nrows);
+    const auto none = r->t_nrows;
+    for (size_t i = r->t_nrows; i-- > 0; )
+    {
+        if (rc->isnull(i))
+        {
+            continue;
+        }
+        auto e = head.emplace(key_of(*rc, i), none);
+        next[i] = e.first->second;
+        e.first->second = i;
+    }
+    std::vector<size_t> lrows;
+    std::vector<size_t> rrows;
+    for (size_t i = 0; i < l->t_nrows; ++i)
+    {
+        if (lc->isnull(i))
+        {
+            continue;
+        }
+        auto e = head.find(key_of(*lc, i));
+        if (e == head.end())
+        {
+            continue;
+        }
+        for (auto j = e->second; j != none; j = next[j])
+        {
+            lrows.push_back(i);
+            rrows.push_back(j);
+        }
+    }
+
+    for (auto &c : *l->t_columns)
+    {
+        if (add_gathered(cols, c, lrows))
+        {
+            drop(cols);
+            return 1;
+        }
+    }
+    for (auto &c : *r->t_columns)
+    {
+        if (c.c_name != name && add_gathered(cols, c, rrows))
+        {
+            drop(cols);
+            return 1;
+        }
+    }
+    return ici::ret_with_decref(new_table(lrows.size(), cols));
+}
+
+} // anon
+
+extern "C" ici::object *ici_table_init()
+{
+    static table_type table_type;
+
+    if (ici::check_interface(ici::version_number, ici::back_compat_version, "table"))
+    {
+        return nullptr;
+    }
+    if (init_ici_str())
+    {
+        return nullptr;
+    }
+    if (!(table_type::code = ici::register_type(&table_type)))
+    {
+        return nullptr;
+    }
+    static ICI_DEFINE_CFUNCS(table)
+    {
+        ICI_DEFINE_CFUNC(columns, f_columns),
+        ICI_DEFINE_CFUNC(filter, f_filter),
+        ICI_DEFINE_CFUNC(from_rows, f_from_rows),
+        ICI_DEFINE_CFUNC(group, f_group),
+        ICI_DEFINE_CFUNC(join, f_join),
+        ICI_DEFINE_CFUNC(new, f_new),
+        ICI_DEFINE_CFUNC(rows, f_rows),
+        ICI_DEFINE_CFUNC(select, f_select),
+        ICI_DEFINE_CFUNC(sort, f_sort),
+        ICI_DEFINE_CFUNC(where, f_where),
+        ICI_CFUNCS_END()
+    };
+    return ici::new_module(ICI_CFUNCS(table));
+}
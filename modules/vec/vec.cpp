@@ -7,6 +7,27 @@ namespace
 #include "icistr.h"
 #include <icistr-setup.h>
 
+/*
+ * The element-wise loops below are run in pieces of at least this
+ * many elements on ICI's worker threads, see ici::parallel_for().
+ */
+constexpr size_t grain = 64 * 1024;
+
+/*
+ * Helper for f_channel, see below.
+ */
+template <typename FLOAT>
+void copy_channel(FLOAT *out, const FLOAT *in, size_t size, size_t stride)
+{
+    ici::parallel_for(size, grain, [out, in, stride](size_t begin, size_t end)
+    {
+        for (size_t j = begin; j < end; ++j)
+        {
+            out[j] = in[j * stride];
+        }
+    });
+}
+
 /**
  * vec = vec.channel(vec, index, stride)
  *
@@ -40,10 +61,7 @@ int f_channel()
         {
             return 1;
         }
-        for (size_t i = 0, j = 0; j < size; i += stride, ++j)
-        {
-            ici::vec32fof(out)->v_ptr[j] = ici::vec32fof(vec)->v_ptr[i+channel-1];
-        }
+        copy_channel(ici::vec32fof(out)->v_ptr, ici::vec32fof(vec)->v_ptr + channel - 1, size, size_t(stride));
         ici::vec32fof(out)->resize(size);
     }
     else if (ici::isvec64f(vec))
@@ -54,10 +72,7 @@ int f_channel()
         {
             return 1;
         }
-        for (size_t i = 0, j = 0; j < size; i += stride, ++j)
-        {
-            ici::vec64fof(out)->v_ptr[j] = ici::vec64fof(vec)->v_ptr[i+channel-1];
-        }
+        copy_channel(ici::vec64fof(out)->v_ptr, ici::vec64fof(vec)->v_ptr + channel - 1, size, size_t(stride));
         ici::vec64fof(out)->resize(size);
     }
     else
@@ -73,24 +88,27 @@ int f_channel()
 template <typename VEC>
 void merge(VEC *result, size_t maxsize, ici::object **vec, size_t nvec)
 {
-    size_t j = 0;
-    for (size_t i = 0; i < maxsize; ++i)
+    ici::parallel_for(maxsize, grain, [result, vec, nvec](size_t begin, size_t end)
     {
-        for (size_t k = 0; k < nvec; ++k)
+        size_t j = begin * nvec;
+        for (size_t i = begin; i < end; ++i)
         {
-            auto v = static_cast<VEC *>(vec[-k]); // see docs for ici::NARGS()
-            if (i < v->size())
-            {
-                (*result)[j] = (*v)[i];
-            }
-            else
+            for (size_t k = 0; k < nvec; ++k)
             {
-                (*result)[j] = typename VEC::value_type(0.0);
+                auto v = static_cast<VEC *>(vec[-k]); // see docs for ici::NARGS()
+                if (i < v->size())
+                {
+                    (*result)[j] = (*v)[i];
+                }
+                else
+                {
+                    (*result)[j] = typename VEC::value_type(0.0);
+                }
+                ++j;
             }
-            ++j;
         }
-    }
-    result->resize(j);
+    });
+    result->resize(maxsize * nvec);
 }
 
 /*
@@ -112,8 +130,7 @@ int f_merge()
 
     const auto tcode = ici::ARG(0)->o_tcode;
 
-    size_t size = ici::vec_size(ici::ARG(0));
-    size_t maxsize = size;
+    size_t maxsize = ici::vec_size(ici::ARG(0));
 
     for (int i = 1; i < ici::NARGS(); ++i)
     {
@@ -130,12 +147,16 @@ int f_merge()
         {
             maxsize = z;
         }
-        const auto newsize = size + z;
-        if (newsize < size)
-        {
-            return ici::set_errorc("merged vector too large");
-        }
-        size = newsize;
+    }
+
+    /*
+     * Shorter vecs are padded with zeros so the result holds maxsize
+     * values from each.
+     */
+    const auto size = maxsize * size_t(ici::NARGS());
+    if (size / size_t(ici::NARGS()) != maxsize)
+    {
+        return ici::set_errorc("merged vector too large");
     }
 
     ici::object *result;
@@ -243,10 +264,13 @@ void normalize(FLOAT *data, size_t sz)
         avg += data[i];
     }
     avg /= sz;
-    for (size_t i = 0; i < sz; i++)
+    ici::parallel_for(sz, grain, [data, avg](size_t begin, size_t end)
     {
-        data[i] -= avg;
-    }
+        for (size_t i = begin; i < end; ++i)
+        {
+            data[i] -= avg;
+        }
+    });
     FLOAT sum = 0;
     for (size_t i = 0; i < sz; ++i)
     {
@@ -256,10 +280,13 @@ void normalize(FLOAT *data, size_t sz)
     const FLOAT dev = sqrt(sum / sz);
     if (dev != 0.0)
     {
-        for (size_t i = 0; i < sz; ++i)
+        ici::parallel_for(sz, grain, [data, dev](size_t begin, size_t end)
         {
-            data[i] /= dev;
-        }
+            for (size_t i = begin; i < end; ++i)
+            {
+                data[i] /= dev;
+            }
+        });
     }
 }
 
@@ -533,13 +533,19 @@ void collect()
      * Set ici_mem_limit (which is the point at which to trigger a
      * new call to us) to 1.5 times what is currently allocated, but
      * with a special cases for small sizes.
+     *
+     * Small heaps still get a generous limit. Numeric code creates an
+     * int or float atom for most results that are stored and a
+     * collection has to mark the whole heap to reclaim them, so
+     * collecting every few hundred Kb makes such loops spend much
+     * of their time in here.
      */
 #if ALLCOLLECT
     ici_mem_limit = 0;
 #else
-    if (ici_mem < 128 * 1024)
+    if (ici_mem < 1024 * 1024)
     {
-        ici_mem_limit = 256 * 1024;
+        ici_mem_limit = 2 * 1024 * 1024;
     }
     else
     {
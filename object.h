@@ -83,7 +83,7 @@ struct object
      */
 
     /*
-     * The generic flags that may appear in the lower 4 bits of o_flags are:
+     * The generic flags that may appear in the lower 5 bits of o_flags are:
      *
      * O_MARK           The garbage collection mark flag.
      *
@@ -97,12 +97,16 @@ struct object
      *
      * O_SUPER          This object can support a super.
      *
+     * O_WAITED         Some thread is, or may be, in waitfor() on this
+     *                  object, so wakeup() must look for it.
+     *
      * --ici-api-- continued.
      */
     static constexpr int O_MARK = (1 << 0);  /* 0x01 Garbage collection mark. */
     static constexpr int O_ATOM = (1 << 1);  /* 0x02 Is a member of the atom pool. */
     static constexpr int O_TEMP = (1 << 2);  /* 0x04 Is a re-usable temp (flag for asserts). */
     static constexpr int O_SUPER = (1 << 3); /* 0x08 Has super (is objwsup derived). */
+    static constexpr int O_WAITED = (1 << 4); /* 0x10 Is waited for, see wakeup(). */
     static constexpr int O_ICIBITS = 0x1F;   /* 0b 0001 1111 */
     static constexpr int O_USERBITS = 0xE0;  /* 0b 1110 0000 */
 
@@ -640,7 +644,13 @@ constexpr uint8_t TC_REF = 25; // serialized ref to previously saved object
 constexpr uint8_t TC_CHANNEL = 26;
 constexpr uint8_t TC_VEC32F = 27;
 constexpr uint8_t TC_VEC64F = 28;
-constexpr uint8_t TC_MAX_CORE = 28;
+constexpr uint8_t TC_ARCHIVE = 29;
+constexpr uint8_t TC_PMAP = 30;
+constexpr uint8_t TC_PSET = 31;
+constexpr uint8_t TC_PVEC = 32;
+constexpr uint8_t TC_PNODE = 33;
+constexpr uint8_t TC_PVNODE = 34;
+constexpr uint8_t TC_MAX_CORE = 34;
 // constexpr uint8_t TC_MAX_BINOP =    TC_VEC64
 
 /*
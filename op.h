@@ -113,6 +113,9 @@ extern op o_return;
 extern op o_call;
 extern op o_method_call;
 extern op o_super_call;
+extern op o_tail_call;
+extern op o_tail_method_call;
+extern op o_tail_super_call;
 extern op o_if;
 extern op o_ifnotbreak;
 extern op o_ifbreak;
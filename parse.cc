@@ -1,5 +1,6 @@
 #define ICI_CORE
 #include "parse.h"
+#include "archiver.h"
 #include "buf.h"
 #include "cfunc.h"
 #include "exec.h"
@@ -31,7 +32,7 @@ static char an_expression[] = "an expression";
  */
 static int compound_statement(parse *, map *);
 static int expression(parse *, expr **, int);
-static int const_expression(parse *, object **, int);
+static int const_expression(parse *, object **, int, array ** = nullptr);
 static int statement(parse *, array *, map *, const char *, int);
 
 #define DISASSEMBLE 0
@@ -368,6 +369,92 @@ fail:
     return -1;
 }
 
+/*
+ * Module caches
+ *
+ * When a module is parsed to write its cache, see parse_module(), the
+ * parser saves each unit of the module's top-level code to the cache as
+ * it goes, before it is run. A unit is the code array of a statement, or
+ * a declaration saved as an int giving its kind and the scope's level
+ * above the module's autos, see cache_decl(), followed by the name and
+ * the value or, for evaluated initialisers, the code to evaluate again
+ * when the cache is run.
+ *
+ * Something the cache can't represent abandons the cache, not the parse.
+ */
+static void abandon_cache(parse *p)
+{
+    p->p_archiver = nullptr;
+    clear_error();
+}
+
+static void record_code(parse *p, array *a)
+{
+    if (p->p_archiver != nullptr && p->p_module_depth == 0 && p->p_archiver->save(a))
+    {
+        abandon_cache(p);
+    }
+}
+
+static void record_decl(parse *p, objwsup *ows, object *n, object *o, int hasinit, array *code)
+{
+    objwsup *s;
+    int64_t  level;
+
+    if (p->p_archiver == nullptr || p->p_module_depth != 0)
+    {
+        return;
+    }
+    for (s = objwsupof(vs.a_top[-1]), level = 0; s != nullptr && s != ows && level < CACHE_DECL_LEVELS - 1; s = s->o_super)
+    {
+        ++level;
+    }
+    if (s != ows)
+    {
+        /*
+         * A function's own variables are saved with the function, so
+         * only if their values don't depend on when they were made.
+         */
+        if (p->p_func == nullptr || code != nullptr)
+        {
+            abandon_cache(p);
+        }
+        return;
+    }
+    ref<> l = new_int(cache_decl(code != nullptr ? CACHE_DECL_CODE : hasinit ? CACHE_DECL_INIT : CACHE_DECL_NOINIT, level));
+    if (!l || p->p_archiver->save(l) || p->p_archiver->save(n) || p->p_archiver->save(code != nullptr ? code : o))
+    {
+        abandon_cache(p);
+    }
+}
+
+/*
+ * Values computed while parsing, other than the initialisers of the
+ * module's own variables, become part of the code or data made. A
+ * cache would keep them as they were when it was written, though they
+ * may depend on the environment, other modules, or the time, so
+ * computing one abandons the cache.
+ */
+static void record_value(parse *p)
+{
+    if (p->p_archiver != nullptr)
+    {
+        abandon_cache(p);
+    }
+}
+
+/*
+ * Note a value computed at parse time by a $ expression. The parse is
+ * the object being executed when one is compiled.
+ */
+void parse_value(object *)
+{
+    if (isparse(xs.a_top[-1]))
+    {
+        record_value(parseof(xs.a_top[-1]));
+    }
+}
+
 /*
  * ows is the struct (or whatever) the idents are going into.
  */
@@ -375,11 +462,13 @@ static int data_def(parse *p, objwsup *ows)
 {
     object *o; /* The value it is initialised with. */
     object *n; /* The name. */
+    array  *code; /* The initialiser's code, if it was evaluated. */
     int     wasfunc;
     int     hasinit;
 
     n = nullptr;
     o = nullptr;
+    code = nullptr;
     wasfunc = 0;
     /*
      * Work through the list of identifiers being declared.
@@ -401,7 +490,7 @@ static int data_def(parse *p, objwsup *ows)
         switch (next(p, nullptr))
         {
         case T_EQ:
-            switch (const_expression(p, &o, T_COMMA))
+            switch (const_expression(p, &o, T_COMMA, &code))
             {
             case 0:
                 not_followed_by("ident =", an_expression);
@@ -432,6 +521,12 @@ static int data_def(parse *p, objwsup *ows)
          * Assign to the new variable if it doesn't appear to exist
          * or has an explicit initialisation.
          */
+        record_decl(p, ows, n, o, hasinit, code);
+        if (code != nullptr)
+        {
+            decref(code);
+            code = nullptr;
+        }
         if (hasinit || ici_fetch_base(ows, n) == null)
         {
             if (ici_assign_base(ows, n, o))
@@ -538,7 +633,7 @@ fail:
 /*
  * Free an exprssesion tree and decref all the objects that it references.
  */
-static void free_expr(expr *e)
+void free_expr(expr *e)
 {
     expr *e1;
 
@@ -1506,6 +1601,10 @@ static int expression(parse *p, array *a, int why, int exclude)
     case -1:
         goto fail;
     }
+    if (optimize && fold_expr(e))
+    {
+        goto fail;
+    }
     if (compile_expr(a, e, why))
     {
         goto fail;
@@ -1521,11 +1620,13 @@ fail:
 /*
  * Parse and evaluate an expected "constant" (that is, parse time evaluated)
  * expression and store the result through po. The excluded binop (see comment
- * on expr() above) is often used to exclude comma operators.
+ * on expr() above) is often used to exclude comma operators. If code is given
+ * and the expression had to be evaluated, the code evaluated is stored through
+ * it, with a reference the caller owns, otherwise it is set to nullptr.
  *
  * Usual parseing return conventions.
  */
-static int const_expression(parse *p, object **po, int exclude)
+static int const_expression(parse *p, object **po, int exclude, array **code)
 {
     expr  *e;
     array *a;
@@ -1537,6 +1638,10 @@ static int const_expression(parse *p, object **po, int exclude)
     {
         return ret;
     }
+    if (optimize && fold_expr(e))
+    {
+        goto fail;
+    }
     /*
      * If the expression is a data item that obviously requires no
      * further compilation and evaluation to arrive at its value,
@@ -1556,6 +1661,10 @@ static int const_expression(parse *p, object **po, int exclude)
 simple:
         incref(*po);
         free_expr(e);
+        if (code != nullptr)
+        {
+            *code = nullptr;
+        }
         return 1;
     }
     if ((a = new_array()) == nullptr)
@@ -1576,6 +1685,12 @@ simple:
     {
         goto fail;
     }
+    if (code != nullptr)
+    {
+        *code = a;
+        return 1;
+    }
+    record_value(p);
     decref(a);
     return 1;
 
@@ -1618,6 +1733,26 @@ fail:
     return -1;
 }
 
+/*
+ * If optimizing and the condition just compiled onto the end of the code
+ * array 'a' is a literal, pop it and return 1 if it is true or 0 if it
+ * is false. Otherwise return -1.
+ */
+static int constant_condition(array *a)
+{
+    if (!optimize || a->a_top == a->a_base)
+    {
+        return -1;
+    }
+    auto o = a->a_top[-1];
+    if (!isint(o) && !isfloat(o) && !isnull(o))
+    {
+        return -1;
+    }
+    --a->a_top;
+    return !isfalse(o);
+}
+
 /*
  * a    Code array being appended to.
  * sw   Switch structure, else nullptr.
@@ -1635,6 +1770,7 @@ static int statement(parse *p, array *a, map *sw, const char *m, int endme)
     object  *o;
     integer *i;
     int      stepz;
+    int      cond;
 
     switch (next(p, a))
     {
@@ -1801,6 +1937,7 @@ decl:
             {
                 return -1;
             }
+            cond = constant_condition(a);
             if ((a1 = new_array()) == nullptr)
             {
                 return -1;
@@ -1835,6 +1972,39 @@ decl:
             {
                 reject(p);
             }
+            if (cond != -1)
+            {
+                /*
+                 * The condition was a literal. Inline the code of the
+                 * branch it selects, less its o_end, and drop the other.
+                 */
+                array *live = cond ? a1 : a2;
+                int    rc = 0;
+                if (live != nullptr)
+                {
+                    if (a->push_check(live->len()))
+                    {
+                        rc = -1;
+                    }
+                    else
+                    {
+                        for (auto po = live->a_base; po < live->a_top - 1; ++po)
+                        {
+                            a->push(*po);
+                        }
+                    }
+                }
+                decref(a1);
+                if (a2 != nullptr)
+                {
+                    decref(a2);
+                }
+                if (rc)
+                {
+                    return -1;
+                }
+                break;
+            }
             if (a->push_check(3))
             {
                 decref(a1);
@@ -2104,7 +2274,7 @@ decl:
                 /*
                  * Now compile in the test expression.
                  */
-                if (compile_expr(a1, e, FOR_VALUE))
+                if ((optimize && fold_expr(e)) || compile_expr(a1, e, FOR_VALUE))
                 {
                     free_expr(e);
                     decref(a1);
@@ -2243,6 +2413,25 @@ decl:
                 reject(p);
                 return not_followed_by("return [expr]", "\";\"");
             }
+            /*
+             * If what is returned is the result of a call, mark the call
+             * as a tail call.
+             */
+            if (a->a_top > a->a_base)
+            {
+                if (a->a_top[-1] == &o_call)
+                {
+                    a->a_top[-1] = &o_tail_call;
+                }
+                else if (a->a_top[-1] == &o_method_call)
+                {
+                    a->a_top[-1] = &o_tail_method_call;
+                }
+                else if (a->a_top[-1] == &o_super_call)
+                {
+                    a->a_top[-1] = &o_tail_super_call;
+                }
+            }
             if (a->push_checked(&o_return))
             {
                 return -1;
@@ -2611,6 +2800,7 @@ int parse_exec()
 #if DISASSEMBLE
             disassemble(4, a);
 #endif
+            record_code(p, a);
             set_pc(a, xs.a_top);
             ++xs.a_top;
             decref(a);
@@ -2668,7 +2858,8 @@ parse *new_parse(file *f)
 size_t parse_type::mark(object *o)
 {
     auto p = parseof(o);
-    return type::mark(p) + mark_optional(p->p_func) + mark_optional(p->p_file);
+    return type::mark(p) + mark_optional(p->p_func) + mark_optional(p->p_file) +
+           (p->p_archiver != nullptr ? p->p_archiver->mark_saved() : 0);
 }
 
 /*
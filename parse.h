@@ -23,16 +23,17 @@ struct token
 
 struct parse : object
 {
-    file *p_file;
-    int   p_lineno; /* Diagnostic information. */
-    short p_sol;    /* At first char in line. */
-    short p_cr;     /* New-line caused by \r, not \n. */
-    token p_got;
-    token p_ungot;
-    func *p_func;         /* nullptr when not within scope. */
-    int   p_module_depth; /* Depth within module, 0 is file level. */
-    int   p_break_depth;
-    int   p_continue_depth;
+    file     *p_file;
+    int       p_lineno; /* Diagnostic information. */
+    short     p_sol;    /* At first char in line. */
+    short     p_cr;     /* New-line caused by \r, not \n. */
+    token     p_got;
+    token     p_ungot;
+    func     *p_func;         /* nullptr when not within scope. */
+    int       p_module_depth; /* Depth within module, 0 is file level. */
+    int       p_break_depth;
+    int       p_continue_depth;
+    archiver *p_archiver; /* Writing a module cache, else nullptr. */
 };
 
 inline parse *parseof(object *o)
@@ -176,6 +177,37 @@ constexpr int FOR_TEMP = 3;
 constexpr int OPC_COLON_CARET = 0x0001; /* It's a :^ not a : */
 constexpr int OPC_COLON_CALL = 0x0002;  /* Don't form a method, just call it. */
 
+/*
+ * Flag in the op_code field of call operators marking a call whose
+ * result is returned by the function making it. The execution loop
+ * may replace the caller's frame with the callee's.
+ */
+constexpr int OPC_TAIL_CALL = 0x0004;
+
+/*
+ * Declarations in module caches, see record_decl() and run_cache(). A
+ * declaration unit starts with an int, cache_decl(kind, level), giving
+ * what follows the name and how many scopes above the module's autos
+ * the name was declared in.
+ */
+constexpr int64_t CACHE_DECL_INIT = 0;   /* Value of an initialiser. */
+constexpr int64_t CACHE_DECL_NOINIT = 3; /* No initialiser, value is null. */
+constexpr int64_t CACHE_DECL_CODE = 6;   /* Code of an initialiser to evaluate. */
+constexpr int64_t CACHE_DECL_LEVELS = 3; /* Levels 0 to 2 are recorded. */
+
+constexpr int64_t cache_decl(int64_t kind, int64_t level)
+{
+    return kind + level;
+}
+constexpr int64_t cache_decl_kind(int64_t d)
+{
+    return d - d % CACHE_DECL_LEVELS;
+}
+constexpr int64_t cache_decl_level(int64_t d)
+{
+    return d % CACHE_DECL_LEVELS;
+}
+
 /*
  * Expression tree.  This is what the parseing functions build and
  * pass to compile_expr().
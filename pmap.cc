@@ -0,0 +1,750 @@
+#define ICI_CORE
+#include "pmap.h"
+#include "archiver.h"
+#include "array.h"
+#include "exec.h"
+#include "forall.h"
+#include "int.h"
+#include "null.h"
+#include "object.h"
+#include "primes.h"
+
+namespace ici
+{
+
+/*
+ * The number of bits set in x.
+ */
+inline uint32_t popcount(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return uint32_t(__builtin_popcount(x));
+#else
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    return (((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
+/*
+ * The hash of a key. Multiplication by an odd constant is a bijection
+ * on 64 bit values so distinct keys have distinct hashes.
+ */
+inline uint64_t phash(object *k)
+{
+    return uint64_t(uintptr_t(k)) * 0x9E3779B97F4A7C15ULL;
+}
+
+/*
+ * The bit of a node's bitmap for the hash h at the given depth. The top
+ * bits of the hash, which are the best mixed, are used first. The
+ * thirteenth level uses the last four bits.
+ */
+inline uint32_t pbit(uint64_t h, int depth)
+{
+    const int shift = 59 - 5 * depth;
+    return 1u << (uint32_t(shift >= 0 ? h >> shift : h << -shift) & 31);
+}
+
+/*
+ * The index of the slot for bit in the node n.
+ */
+inline uint32_t pindex(pnode *n, uint32_t bit)
+{
+    return popcount(n->n_bitmap & (bit - 1));
+}
+
+/*
+ * Return a new pnode with room for nslots slots. The node has one
+ * reference and is not yet registered, the caller fills in its slots
+ * then calls rego(). Returns nullptr on error, usual conventions.
+ */
+static pnode *new_pnode(uint32_t bitmap, uint32_t nslots, size_t count)
+{
+    pnode *n;
+
+    if ((n = (pnode *)ici_nalloc(sizeof(pnode) + nslots * sizeof(slot))) == nullptr)
+    {
+        return nullptr;
+    }
+    set_tfnz(n, TC_PNODE, 0, 1, 0);
+    n->n_bitmap = bitmap;
+    n->n_nslots = nslots;
+    n->n_count = count;
+    return n;
+}
+
+/*
+ * Return a copy of n with slot i set to the key k and value v, and
+ * the given count. A nullptr k makes v, a pnode, a sub-trie.
+ */
+static pnode *replace_slot(pnode *n, uint32_t i, object *k, object *v, size_t count)
+{
+    pnode *nn;
+
+    if ((nn = new_pnode(n->n_bitmap, n->n_nslots, count)) == nullptr)
+    {
+        return nullptr;
+    }
+    memcpy(nn->slots(), n->slots(), n->n_nslots * sizeof(slot));
+    nn->slots()[i].sl_key = k;
+    nn->slots()[i].sl_value = v;
+    rego(nn);
+    return nn;
+}
+
+/*
+ * Return a copy of n, which may be nullptr, with an entry for k and v
+ * at the slot for bit.
+ */
+static pnode *insert_slot(pnode *n, uint32_t bit, object *k, object *v)
+{
+    pnode   *nn;
+    uint32_t i;
+
+    if (n == nullptr)
+    {
+        if ((nn = new_pnode(bit, 1, 1)) == nullptr)
+        {
+            return nullptr;
+        }
+        nn->slots()[0].sl_key = k;
+        nn->slots()[0].sl_value = v;
+        rego(nn);
+        return nn;
+    }
+    if ((nn = new_pnode(n->n_bitmap | bit, n->n_nslots + 1, n->n_count + 1)) == nullptr)
+    {
+        return nullptr;
+    }
+    i = pindex(n, bit);
+    memcpy(nn->slots(), n->slots(), i * sizeof(slot));
+    nn->slots()[i].sl_key = k;
+    nn->slots()[i].sl_value = v;
+    memcpy(nn->slots() + i + 1, n->slots() + i, (n->n_nslots - i) * sizeof(slot));
+    rego(nn);
+    return nn;
+}
+
+/*
+ * Return a copy of n without the entry at the slot for bit, or nullptr
+ * and *empty set if there would be no slots left.
+ */
+static pnode *remove_slot(pnode *n, uint32_t bit, bool *empty)
+{
+    pnode   *nn;
+    uint32_t i;
+
+    if (n->n_nslots == 1)
+    {
+        *empty = true;
+        return nullptr;
+    }
+    if ((nn = new_pnode(n->n_bitmap & ~bit, n->n_nslots - 1, n->n_count - 1)) == nullptr)
+    {
+        return nullptr;
+    }
+    i = pindex(n, bit);
+    memcpy(nn->slots(), n->slots(), i * sizeof(slot));
+    memcpy(nn->slots() + i, n->slots() + i + 1, (n->n_nslots - i - 1) * sizeof(slot));
+    rego(nn);
+    return nn;
+}
+
+/*
+ * Find the slot holding the key k in the trie n, or return nullptr.
+ */
+static slot *find_pslot(pnode *n, object *k)
+{
+    const auto h = phash(k);
+
+    for (int depth = 0; n != nullptr; ++depth)
+    {
+        const auto bit = pbit(h, depth);
+        if ((n->n_bitmap & bit) == 0)
+        {
+            return nullptr;
+        }
+        auto sl = &n->slots()[pindex(n, bit)];
+        if (sl->sl_key == nullptr)
+        {
+            n = pnodeof(sl->sl_value);
+            continue;
+        }
+        return sl->sl_key == k ? sl : nullptr;
+    }
+    return nullptr;
+}
+
+/*
+ * Return the slot of the i'th entry of the trie n, in trie order, or
+ * nullptr if there are not that many.
+ */
+static slot *nth_pslot(pnode *n, size_t i)
+{
+    while (n != nullptr && i < n->n_count)
+    {
+        auto sl = n->slots();
+        for (;; ++sl)
+        {
+            if (sl->sl_key != nullptr)
+            {
+                if (i == 0)
+                {
+                    return sl;
+                }
+                --i;
+                continue;
+            }
+            auto c = pnodeof(sl->sl_value);
+            if (i < c->n_count)
+            {
+                n = c;
+                break;
+            }
+            i -= c->n_count;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Call f for each entry of the trie n, stopping if it returns non-zero,
+ * which is returned.
+ */
+template <typename F>
+static int each_pslot(pnode *n, F &&f)
+{
+    if (n == nullptr)
+    {
+        return 0;
+    }
+    auto sl = n->slots();
+    for (uint32_t i = 0; i < n->n_nslots; ++i, ++sl)
+    {
+        if (int r = sl->sl_key != nullptr ? f(sl) : each_pslot(pnodeof(sl->sl_value), f))
+        {
+            return r;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Return a trie that is n, which may be nullptr, with the key k, of hash
+ * h, having the value v. The result has one reference, and is n itself
+ * if n already has that entry. Only the nodes on the path to the key
+ * are new, the rest are shared with n. *old is set to the key's previous
+ * value, if it had one. Returns nullptr on error, usual conventions.
+ */
+static pnode *passign(pnode *n, object *k, object *v, uint64_t h, int depth, object **old)
+{
+    const auto bit = pbit(h, depth);
+    if (n == nullptr || (n->n_bitmap & bit) == 0)
+    {
+        return insert_slot(n, bit, k, v);
+    }
+    const auto i = pindex(n, bit);
+    auto       sl = &n->slots()[i];
+    pnode     *c;
+
+    if (sl->sl_key == k)
+    {
+        *old = sl->sl_value;
+        if (sl->sl_value == v)
+        {
+            n->incref();
+            return n;
+        }
+        return replace_slot(n, i, k, v, n->n_count);
+    }
+    if (sl->sl_key == nullptr)
+    {
+        if ((c = passign(pnodeof(sl->sl_value), k, v, h, depth + 1, old)) == nullptr)
+        {
+            return nullptr;
+        }
+        if (c == sl->sl_value)
+        {
+            c->decref();
+            n->incref();
+            return n;
+        }
+    }
+    else
+    {
+        /*
+         * Another key shares this slot. Push both down into a new
+         * sub-trie, which separates them at some lower level.
+         */
+        pnode  *c1;
+        object *o;
+
+        if ((c1 = passign(nullptr, sl->sl_key, sl->sl_value, phash(sl->sl_key), depth + 1, &o)) == nullptr)
+        {
+            return nullptr;
+        }
+        c = passign(c1, k, v, h, depth + 1, old);
+        c1->decref();
+        if (c == nullptr)
+        {
+            return nullptr;
+        }
+    }
+    auto nn = replace_slot(n, i, nullptr, c, n->n_count - (sl->sl_key == nullptr ? pnodeof(sl->sl_value)->n_count : 1) + c->n_count);
+    c->decref();
+    return nn;
+}
+
+/*
+ * Set *r to a trie that is n without the key k, of hash h. *r has one
+ * reference, and is n itself if k is not in n, or nullptr if the trie
+ * is now empty. A sub-trie left with a single entry is replaced by the
+ * entry. *old is set to the key's value, if it had one. Returns 1 on
+ * error, usual conventions.
+ */
+static int punassign(pnode *n, object *k, uint64_t h, int depth, pnode **r, object **old)
+{
+    const auto bit = pbit(h, depth);
+    bool       empty = false;
+
+    if ((n->n_bitmap & bit) == 0)
+    {
+        n->incref();
+        *r = n;
+        return 0;
+    }
+    const auto i = pindex(n, bit);
+    auto       sl = &n->slots()[i];
+
+    if (sl->sl_key == k)
+    {
+        *old = sl->sl_value;
+        *r = remove_slot(n, bit, &empty);
+        return *r == nullptr && !empty;
+    }
+    if (sl->sl_key != nullptr)
+    {
+        n->incref();
+        *r = n;
+        return 0;
+    }
+    pnode *c;
+    if (punassign(pnodeof(sl->sl_value), k, h, depth + 1, &c, old))
+    {
+        return 1;
+    }
+    if (c == sl->sl_value)
+    {
+        c->decref();
+        n->incref();
+        *r = n;
+        return 0;
+    }
+    if (c == nullptr)
+    {
+        *r = remove_slot(n, bit, &empty);
+        return *r == nullptr && !empty;
+    }
+    if (c->n_nslots == 1 && c->slots()[0].sl_key != nullptr)
+    {
+        *r = replace_slot(n, i, c->slots()[0].sl_key, c->slots()[0].sl_value, n->n_count - 1);
+    }
+    else
+    {
+        *r = replace_slot(n, i, nullptr, c, n->n_count - 1);
+    }
+    c->decref();
+    return *r == nullptr;
+}
+
+/*
+ * The contribution of an entry to the hash of a pmap. The hash is kept
+ * as the sum of these as the pmap is assigned to, so hashing a pmap,
+ * which must not look at its nodes once they may be garbage, is cheap.
+ */
+inline unsigned long entry_hash(object *k, object *v)
+{
+    return ((unsigned long)v >> 4) * MAP_PRIME_0 + ((unsigned long)k >> 4) * MAP_PRIME_1;
+}
+
+/*
+ * Return a new, empty, persistent map, or a pset if tcode is TC_PSET.
+ * The returned object has been increfed. Returns nullptr on error, usual
+ * conventions.
+ *
+ * This --func-- forms part of the --ici-api--.
+ */
+pmap *new_pmap(int tcode)
+{
+    pmap *p;
+
+    if ((p = ici_talloc(pmap)) == nullptr)
+    {
+        return nullptr;
+    }
+    set_tfnz(p, tcode, 0, 1, 0);
+    p->p_root = nullptr;
+    p->p_hash = 0;
+    rego(p);
+    return p;
+}
+
+/*
+ * Set the key k of the pmap p to v, replacing the trie of p with a new
+ * version. The previous version is unchanged and shared with any copies
+ * of p. Returns 1 on error, usual conventions.
+ */
+static int pmap_assign(pmap *p, object *k, object *v)
+{
+    pnode  *n;
+    object *old = nullptr;
+
+    if (p->isatom())
+    {
+        return set_error("attempt to modify an atomic %s", p->type_name());
+    }
+    if ((n = passign(p->p_root, k, v, phash(k), 0, &old)) == nullptr)
+    {
+        return 1;
+    }
+    if (old != nullptr)
+    {
+        p->p_hash -= entry_hash(k, old);
+    }
+    p->p_hash += entry_hash(k, v);
+    p->p_root = n;
+    n->decref();
+    return 0;
+}
+
+/*
+ * Remove the key k from the pmap, or pset, p. Returns 1 on error, usual
+ * conventions.
+ *
+ * This --func-- forms part of the --ici-api--.
+ */
+int pmap_unassign(pmap *p, object *k)
+{
+    pnode  *n;
+    object *old = nullptr;
+
+    if (p->isatom())
+    {
+        return set_error("attempt to modify an atomic %s", p->type_name());
+    }
+    if (p->p_root == nullptr)
+    {
+        return 0;
+    }
+    if (punassign(p->p_root, k, phash(k), 0, &n, &old))
+    {
+        return 1;
+    }
+    if (old != nullptr)
+    {
+        p->p_hash -= entry_hash(k, old);
+    }
+    p->p_root = n;
+    if (n != nullptr)
+    {
+        n->decref();
+    }
+    return 0;
+}
+
+/*
+ * Assign the key and value of a pmap or pset entry to the loop variables
+ * of the forall fa.
+ */
+static int forall_pslot(forall *fa, object *k, object *v)
+{
+    if (fa->fa_vaggr != null)
+    {
+        if (ici_assign(fa->fa_vaggr, fa->fa_vkey, v))
+        {
+            return 1;
+        }
+    }
+    if (fa->fa_kaggr != null)
+    {
+        if (ici_assign(fa->fa_kaggr, fa->fa_kkey, k))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Save the entries of the pmap, or the keys of the pset, p.
+ */
+static int save_pmap(archiver *ar, pmap *p, bool values)
+{
+    if (ar->save_name(p))
+    {
+        return 1;
+    }
+    const int64_t n = p->p_root == nullptr ? 0 : p->p_root->n_count;
+    if (ar->write(n))
+    {
+        return 1;
+    }
+    return each_pslot(p->p_root, [&](slot *sl) {
+        return ar->save(sl->sl_key) || (values && ar->save(sl->sl_value));
+    });
+}
+
+/*
+ * Restore a pmap, or pset, saved by save_pmap.
+ */
+static object *restore_pmap(archiver *ar, int tcode)
+{
+    ref<pmap> p;
+    int64_t   n;
+    object   *name;
+
+    if (ar->restore_name(&name))
+    {
+        return nullptr;
+    }
+    if ((p = new_pmap(tcode)) == nullptr)
+    {
+        return nullptr;
+    }
+    if (ar->record(name, p))
+    {
+        return nullptr;
+    }
+    if (ar->read(&n))
+    {
+        goto fail;
+    }
+    for (int64_t i = 0; i < n; ++i)
+    {
+        ref<> k = ar->restore();
+        if (!k)
+        {
+            goto fail;
+        }
+        if (tcode == TC_PSET)
+        {
+            if (pmap_assign(p, k, o_one))
+            {
+                goto fail;
+            }
+            continue;
+        }
+        ref<> v = ar->restore();
+        if (!v)
+        {
+            goto fail;
+        }
+        if (pmap_assign(p, k, v))
+        {
+            goto fail;
+        }
+    }
+    return p.release();
+
+fail:
+    ar->remove(name);
+    return nullptr;
+}
+
+/*
+ * Mark this and referenced unmarked objects, return memory costs.
+ * See comments on t_mark() in object.h.
+ */
+size_t pnode_type::mark(object *o)
+{
+    auto n = pnodeof(o);
+    auto mem = type::mark(o) + n->n_nslots * sizeof(slot);
+    auto sl = n->slots();
+    for (uint32_t i = 0; i < n->n_nslots; ++i, ++sl)
+    {
+        mem += mark_optional(sl->sl_key) + ici_mark(sl->sl_value);
+    }
+    return mem;
+}
+
+/*
+ * Free this object and associated memory (but not other objects).
+ * See the comments on t_free() in object.h.
+ */
+void pnode_type::free(object *o)
+{
+    ici_nfree(o, sizeof(pnode) + pnodeof(o)->n_nslots * sizeof(slot));
+}
+
+size_t pmap_type::mark(object *o)
+{
+    return type::mark(o) + mark_optional(pmapof(o)->p_root);
+}
+
+/*
+ * Returns 0 if these objects are equal, else non-zero.
+ * See the comments on t_cmp() in object.h.
+ */
+int pmap_type::cmp(object *o1, object *o2)
+{
+    auto p1 = pmapof(o1);
+    auto p2 = pmapof(o2);
+
+    if (p1->p_root == p2->p_root)
+    {
+        return 0;
+    }
+    if (p1->p_root == nullptr || p2->p_root == nullptr || p1->p_root->n_count != p2->p_root->n_count)
+    {
+        return 1;
+    }
+    if (p1->p_hash != p2->p_hash)
+    {
+        return 1;
+    }
+    return each_pslot(p1->p_root, [p2](slot *sl) {
+        auto sl2 = find_pslot(p2->p_root, sl->sl_key);
+        return sl2 == nullptr || sl2->sl_value != sl->sl_value;
+    });
+}
+
+/*
+ * Return a hash sensitive to the value of the object.
+ * See the comment on t_hash() in object.h
+ */
+unsigned long pmap_type::hash(object *o)
+{
+    return pmapof(o)->p_hash + MAP_PRIME_2;
+}
+
+/*
+ * Return a copy of the given object, or nullptr on error. The copy
+ * shares the trie so this takes constant time.
+ * See the comment on t_copy() in object.h.
+ */
+object *pmap_type::copy(object *o)
+{
+    pmap *p;
+
+    if ((p = new_pmap(o->o_tcode)) == nullptr)
+    {
+        return nullptr;
+    }
+    p->p_root = pmapof(o)->p_root;
+    p->p_hash = pmapof(o)->p_hash;
+    return p;
+}
+
+/*
+ * Assign to key k of the object o the value v. Return 1 on error, else 0.
+ * See the comment on t_assign() in object.h.
+ */
+int pmap_type::assign(object *o, object *k, object *v)
+{
+    return pmap_assign(pmapof(o), k, v);
+}
+
+/*
+ * Return the object at key k of the obejct o, or nullptr on error.
+ * See the comment on t_fetch in object.h.
+ */
+object *pmap_type::fetch(object *o, object *k)
+{
+    auto sl = find_pslot(pmapof(o)->p_root, k);
+    if (sl == nullptr)
+    {
+        return null;
+    }
+    return sl->sl_value;
+}
+
+int pmap_type::forall(object *o)
+{
+    auto fa = forallof(o);
+    auto sl = nth_pslot(pmapof(fa->fa_aggr)->p_root, ++fa->fa_index);
+    if (sl == nullptr)
+    {
+        return -1;
+    }
+    return forall_pslot(fa, sl->sl_key, sl->sl_value);
+}
+
+int pmap_type::nkeys(object *o)
+{
+    return int(len(o));
+}
+
+int pmap_type::keys(object *o, array *k)
+{
+    return each_pslot(pmapof(o)->p_root, [k](slot *sl) {
+        return k->push_back(sl->sl_key);
+    });
+}
+
+int pmap_type::save(archiver *ar, object *o)
+{
+    return save_pmap(ar, pmapof(o), true);
+}
+
+object *pmap_type::restore(archiver *ar)
+{
+    return restore_pmap(ar, TC_PMAP);
+}
+
+int64_t pmap_type::len(object *o)
+{
+    auto n = pmapof(o)->p_root;
+    return n == nullptr ? 0 : n->n_count;
+}
+
+/*
+ * Add or delete the key k from the pset based on the value of v.
+ */
+int pset_type::assign(object *o, object *k, object *v)
+{
+    if (isfalse(v))
+    {
+        return pmap_unassign(pmapof(o), k);
+    }
+    return pmap_assign(pmapof(o), k, o_one);
+}
+
+object *pset_type::fetch(object *o, object *k)
+{
+    if (find_pslot(pmapof(o)->p_root, k) == nullptr)
+    {
+        return null;
+    }
+    return o_one;
+}
+
+/*
+ * As for sets, a single loop variable is given the key.
+ */
+int pset_type::forall(object *o)
+{
+    auto fa = forallof(o);
+    auto sl = nth_pslot(pmapof(fa->fa_aggr)->p_root, ++fa->fa_index);
+    if (sl == nullptr)
+    {
+        return -1;
+    }
+    if (fa->fa_kaggr == null)
+    {
+        return forall_pslot(fa, nullptr, sl->sl_key);
+    }
+    return forall_pslot(fa, sl->sl_key, o_one);
+}
+
+int pset_type::save(archiver *ar, object *o)
+{
+    return save_pmap(ar, pmapof(o), false);
+}
+
+object *pset_type::restore(archiver *ar)
+{
+    return restore_pmap(ar, TC_PSET);
+}
+
+} // namespace ici
@@ -0,0 +1,132 @@
+// -*- mode:c++ -*-
+
+#ifndef ICI_PMAP_H
+#define ICI_PMAP_H
+
+#include "map.h"
+#include "object.h"
+
+namespace ici
+{
+
+/*
+ * The following portion of this file exports to ici.h. --ici.h-start--
+ */
+
+/*
+ * Persistent maps and sets
+ *
+ * A pmap or pset holds a hash array mapped trie (HAMT) of pnodes.
+ * Nodes are never modified once made. An assignment makes new copies of
+ * the nodes on the path to the key, so O(log n) nodes, and shares all
+ * others with the previous version. Copying a pmap or pset shares its
+ * trie, so a copy is a snapshot that later assignments to either do
+ * not affect.
+ *
+ * Keys are compared by identity, as for maps, and hashed by address.
+ * Each level of the trie consumes five bits of the hash. Hashes are a
+ * bijection of addresses so distinct keys are always separated by the
+ * last level and the trie needs no collision nodes.
+ *
+ * A pset stores its keys with the value 1.
+ */
+struct pnode : object
+{
+    uint32_t n_bitmap; /* Which hash digits are present at this level. */
+    uint32_t n_nslots; /* The number of slots, the bits in n_bitmap. */
+    size_t   n_count;  /* The number of keys in this sub-trie. */
+
+    /*
+     * The slots follow the node. A slot with a key is an entry, a slot
+     * without one has a sub-trie, a pnode, as its value.
+     */
+    inline slot *slots()
+    {
+        return reinterpret_cast<slot *>(this + 1);
+    }
+};
+
+inline pnode *pnodeof(object *o)
+{
+    return o->as<pnode>();
+}
+inline bool ispnode(object *o)
+{
+    return o->hastype(TC_PNODE);
+}
+
+struct pmap : object
+{
+    pnode        *p_root; /* The trie, or nullptr if empty. */
+    unsigned long p_hash; /* The sum of the hashes of the entries. */
+};
+
+inline pmap *pmapof(object *o)
+{
+    return o->as<pmap>();
+}
+inline bool ispmap(object *o)
+{
+    return o->hastype(TC_PMAP);
+}
+inline bool ispset(object *o)
+{
+    return o->hastype(TC_PSET);
+}
+
+/*
+ * End of ici.h export. --ici.h-end--
+ */
+
+pmap *new_pmap(int tcode = TC_PMAP);
+int   pmap_unassign(pmap *, object *);
+
+class pnode_type : public type
+{
+public:
+    pnode_type() : type("pnode", sizeof(struct pnode))
+    {
+    }
+
+    size_t mark(object *o) override;
+    void   free(object *o) override;
+};
+
+class pmap_type : public type
+{
+public:
+    pmap_type(const char *name = "pmap") : type(name, sizeof(struct pmap))
+    {
+    }
+
+    size_t        mark(object *o) override;
+    int           cmp(object *o1, object *o2) override;
+    unsigned long hash(object *o) override;
+    object       *copy(object *o) override;
+    int           assign(object *o, object *k, object *v) override;
+    object       *fetch(object *o, object *k) override;
+    int           forall(object *o) override;
+    int           nkeys(object *o) override;
+    int           keys(object *o, array *k) override;
+    int           save(archiver *, object *) override;
+    object       *restore(archiver *) override;
+    int64_t       len(object *o) override;
+};
+
+class pset_type : public pmap_type
+{
+public:
+    pset_type() : pmap_type("pset")
+    {
+    }
+
+    int     assign(object *o, object *k, object *v) override;
+    object *fetch(object *o, object *k) override;
+    int     forall(object *o) override;
+    int     save(archiver *, object *) override;
+    object *restore(archiver *) override;
+};
+
+} // namespace ici
+
+#endif /* ICI_PMAP_H */
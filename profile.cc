@@ -27,15 +27,29 @@
 #ifndef NOPROFILE
 
 #include "profile.h"
+#include "array.h"
 #include "cfunc.h"
 #include "exec.h"
 #include "func.h"
 #include "fwd.h"
+#include "int.h"
 #include "map.h"
 #include "null.h"
 #include "op.h"
+#include "src.h"
 #include "str.h"
+#include <algorithm>
+#include <chrono>
+#include <signal.h>
 #include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
 
 /* This is required for the high resolution timer. */
 #ifdef _WIN32
@@ -328,12 +342,732 @@ void profile_return()
     }
 }
 
+/*
+ * Sampling Profiler
+ * -----------------
+ *
+ * The sampling profiler uses a SIGPROF interval timer. The signal handler
+ * only counts ticks. The execution loop, when it checks for signals,
+ * notices the count and calls profile_sample() which records the current
+ * source line and the functions on the scope stack in a ring of samples.
+ * Walking the stacks from the handler itself would race with the
+ * interpreter. The ring is an ICI array, so the objects it refers to
+ * stay alive, and is folded into counts of distinct stacks when it
+ * fills. Its storage is allocated up front but its top only covers the
+ * samples taken, so the garbage collector marks no more than it must.
+ * Nothing is allocated when a sample is taken.
+ *
+ * When sampling stops the counts are written as "folded stacks", one
+ * line per distinct stack, outermost function first, the source line
+ * last, then the number of samples. As used by flame graph tools.
+ *
+ * When not sampling the only cost is the test of profile_ticks made by
+ * the execution loop along with its check for signals.
+ */
+
+/*
+ * The number of ticks since the last sample was taken.
+ */
+volatile sig_atomic_t profile_ticks = 0;
+
+/*
+ * Each sample is a fixed width record in the ring: its weight (a small
+ * int, the number of ticks it accounts for), the source line and then
+ * the innermost functions, padded with nulls.
+ */
+constexpr size_t sample_depth = 30;
+constexpr size_t sample_width = sample_depth + 2;
+constexpr size_t sample_count = 64;
+
+static array *samples;      /* The ring, while sampling. */
+static size_t sample_next;  /* Number of records in the ring. */
+static map   *sample_stacks; /* Folded stack -> number of samples. */
+static char   sample_outfile[512];
+
+#ifndef _WIN32
+static struct sigaction sample_oldact;
+
+static void sample_tick(int)
+{
+    if (profile_ticks < small_int_mask)
+    {
+        ++profile_ticks;
+    }
+}
+#endif
+
+/*
+ * Fold the samples in the ring into sample_stacks and empty the ring.
+ *
+ * Returns 0 on success, 1 on error, usual conventions.
+ */
+static int fold_samples()
+{
+    char buf[4096];
+
+    for (size_t i = 0; i < sample_next; ++i)
+    {
+        auto   rec = samples->a_base + i * sample_width;
+        auto   fp = rec + sample_width;
+        size_t n = 0;
+
+        while (fp > rec + 2 && fp[-1] == null)
+        {
+            --fp;
+        }
+        while (--fp > rec + 1 && n < sizeof buf - objnamez)
+        {
+            n += snprintf(buf + n, sizeof buf - n, "%s;", funcof(*fp)->f_name->s_chars);
+        }
+        auto sr = srcof(rec[1]);
+        snprintf(buf + n, sizeof buf - n, "%s:%d", sr->s_filename ? sr->s_filename->s_chars : "?", sr->s_lineno);
+
+        auto k = make_ref(new_str_nul_term(buf));
+        if (!k)
+        {
+            return 1;
+        }
+        auto c = ici_fetch(sample_stacks, k);
+        auto v = make_ref(new_int((isint(c) ? intof(c)->i_value : 0) + intof(rec[0])->i_value));
+        if (!v || ici_assign(sample_stacks, k, v))
+        {
+            return 1;
+        }
+    }
+    samples->a_top = samples->a_base;
+    sample_next = 0;
+    return 0;
+}
+
+/*
+ * Called by the execution loop when profile_ticks is non-zero. Records
+ * the current source line and function stack in the ring.
+ */
+void profile_sample()
+{
+    long weight = profile_ticks;
+
+    profile_ticks = 0;
+    if (samples == nullptr)
+    {
+        return;
+    }
+    auto rec = samples->a_base + sample_next * sample_width;
+    auto fp = rec + 2;
+    rec[0] = small_ints[weight & small_int_mask];
+    rec[1] = ex->x_src;
+    for (auto sp = vs.a_top; sp > vs.a_base && fp < rec + sample_width;)
+    {
+        if (ismap(*--sp))
+        {
+            auto sl = find_raw_slot(mapof(*sp), SS(_func_));
+            if (sl->sl_key != nullptr && isfunc(sl->sl_value))
+            {
+                *fp++ = sl->sl_value;
+            }
+        }
+    }
+    std::fill(fp, rec + sample_width, null);
+    samples->a_top = rec + sample_width;
+    if (++sample_next == sample_count)
+    {
+        fold_samples();
+    }
+}
+
+/*
+ * Stop sampling and write the folded stacks to the output file.
+ *
+ * Returns 0 on success, 1 on error, usual conventions.
+ */
+int profile_sample_stop()
+{
+    FILE *of;
+    int   rc;
+
+    if (samples == nullptr)
+    {
+        return 0;
+    }
+#ifndef _WIN32
+    struct itimerval it;
+    memset(&it, 0, sizeof it);
+    setitimer(ITIMER_PROF, &it, nullptr);
+    sigaction(SIGPROF, &sample_oldact, nullptr);
+#endif
+    profile_ticks = 0;
+    rc = fold_samples();
+    if (rc == 0)
+    {
+        if ((of = fopen(sample_outfile, "w")) == nullptr)
+        {
+            rc = get_last_errno("fopen", sample_outfile);
+        }
+        else
+        {
+            for (auto sl = sample_stacks->s_slots; sl < sample_stacks->s_slots + sample_stacks->s_nslots; ++sl)
+            {
+                if (sl->sl_key != nullptr)
+                {
+                    fprintf(of, "%s %lld\n", stringof(sl->sl_key)->s_chars, (long long)intof(sl->sl_value)->i_value);
+                }
+            }
+            fclose(of);
+        }
+    }
+    decref(samples);
+    decref(sample_stacks);
+    samples = nullptr;
+    sample_stacks = nullptr;
+    return rc;
+}
+
+/*
+ * sprofile(filename [, interval])
+ * sprofile()
+ *
+ * The first form starts the sampling profiler, taking a sample every
+ * 'interval' microseconds of CPU time, default 1000. The second form
+ * stops it and writes the samples, as folded stacks, to the file
+ * named when it started. Sampling that is still active when the
+ * interpreter exits is stopped, and written, then.
+ *
+ * This --topic-- forms part of the --ici-profile-- documentation.
+ */
+static int f_sprofile(...)
+{
+    char *outfile;
+    long  interval = 1000;
+
+    if (NARGS() == 0)
+    {
+        return profile_sample_stop() || null_ret();
+    }
+    if (typecheck(NARGS() > 1 ? "si" : "s", &outfile, &interval))
+    {
+        return 1;
+    }
+    if (samples != nullptr)
+    {
+        return set_error("sprofile() is already sampling");
+    }
+    if (interval <= 0)
+    {
+        return set_error("sprofile() interval must be positive");
+    }
+#ifdef _WIN32
+    return set_error("sprofile() is not supported on this platform");
+#else
+    if (strlen(outfile) >= sizeof sample_outfile)
+    {
+        return set_error("sprofile() file name too long");
+    }
+    strcpy(sample_outfile, outfile);
+    if ((sample_stacks = new_map()) == nullptr)
+    {
+        return 1;
+    }
+    if ((samples = new_array(sample_count * sample_width)) == nullptr)
+    {
+        decref(sample_stacks);
+        sample_stacks = nullptr;
+        return 1;
+    }
+    sample_next = 0;
+    profile_ticks = 0;
+
+    struct sigaction act;
+    memset(&act, 0, sizeof act);
+    act.sa_handler = sample_tick;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGPROF, &act, &sample_oldact);
+
+    struct itimerval it;
+    it.it_interval.tv_sec = interval / 1000000;
+    it.it_interval.tv_usec = interval % 1000000;
+    it.it_value = it.it_interval;
+    if (setitimer(ITIMER_PROF, &it, nullptr) == -1)
+    {
+        sigaction(SIGPROF, &sample_oldact, nullptr);
+        decref(samples);
+        decref(sample_stacks);
+        samples = nullptr;
+        sample_stacks = nullptr;
+        return get_last_errno("setitimer", nullptr);
+    }
+    return null_ret();
+#endif
+}
+
+/*
+ * Operation Counters
+ * ------------------
+ *
+ * When counting is active the execution loop calls opcount_op() for each
+ * op it executes and opcount_line() for each source line marker. Each
+ * distinct op, and each line, has a counter of executions and of cycles
+ * (the time stamp counter where available, otherwise nanoseconds). An
+ * op's cycles are those until the next op starts, a line's until the
+ * next line marker. So a line that calls a function is charged for the
+ * call up to the first line of the function.
+ *
+ * Counting is compiled in but off unless started by opcounts(1) or by
+ * setting the environment variable ICI_OPCOUNTS. In the latter case a
+ * report is written when the interpreter exits, to the file named by
+ * the variable, or to stderr if it is "-".
+ *
+ * The counters are held in native hash tables keyed by object address.
+ * The ops and srcs counted are kept in an array so they are not
+ * collected while their counters exist.
+ */
+int opcount_active = 0;
+
+namespace
+{
+
+struct opcounter
+{
+    object  *oc_key;
+    uint64_t oc_count;
+    uint64_t oc_cycles;
+};
+
+struct opcounters
+{
+    opcounter *t_slots;
+    size_t     t_nslots;
+    size_t     t_nels;
+};
+
+opcounters opcount_ops;
+opcounters opcount_lines;
+array     *opcount_keys;
+opcounter *opcount_last_op;
+opcounter *opcount_last_line;
+uint64_t   opcount_op_start;
+uint64_t   opcount_line_start;
+char       opcount_report_file[512];
+
+inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count());
+#endif
+}
+
+inline opcounter *find_counter(opcounters *t, object *k)
+{
+    auto c = t->t_slots + (ICI_PTR_HASH(k) & (t->t_nslots - 1));
+    while (c->oc_key != nullptr && c->oc_key != k)
+    {
+        if (--c < t->t_slots)
+        {
+            c = t->t_slots + t->t_nslots - 1;
+        }
+    }
+    return c;
+}
+
+void free_counters(opcounters *t)
+{
+    if (t->t_slots != nullptr)
+    {
+        ici_nfree(t->t_slots, t->t_nslots * sizeof(opcounter));
+    }
+    t->t_slots = nullptr;
+    t->t_nslots = 0;
+    t->t_nels = 0;
+}
+
+/*
+ * Return the counter for 'k', creating it if need be. Returns nullptr
+ * on error, usual conventions.
+ */
+opcounter *counter_for(opcounters *t, object *k)
+{
+    if (t->t_slots != nullptr)
+    {
+        auto c = find_counter(t, k);
+        if (c->oc_key != nullptr)
+        {
+            return c;
+        }
+    }
+    if ((t->t_nels + 1) * 2 > t->t_nslots)
+    {
+        auto old = *t;
+        t->t_nslots = old.t_nslots == 0 ? 256 : old.t_nslots * 2;
+        if ((t->t_slots = static_cast<opcounter *>(ici_nalloc(t->t_nslots * sizeof(opcounter)))) == nullptr)
+        {
+            *t = old;
+            return nullptr;
+        }
+        memset(t->t_slots, 0, t->t_nslots * sizeof(opcounter));
+        for (size_t i = 0; i < old.t_nslots; ++i)
+        {
+            if (old.t_slots[i].oc_key != nullptr)
+            {
+                *find_counter(t, old.t_slots[i].oc_key) = old.t_slots[i];
+            }
+        }
+        free_counters(&old);
+    }
+    if (opcount_keys->push_checked(k))
+    {
+        return nullptr;
+    }
+    auto c = find_counter(t, k);
+    c->oc_key = k;
+    ++t->t_nels;
+    return c;
+}
+
+const char *op_ecode_names[] = {
+    "other",     "call",           "namelvalue",  "dot",           "dotkeep",      "dotrkeep",
+    "assign",    "assign_to_name", "assignlocal", "exec",          "loop",         "rewind",
+    "endcode",   "if",             "ifelse",      "ifnotbreak",    "ifbreak",      "break",
+    "quote",     "binop",          "at",          "swap",          "binop_for_temp", "aggr_key_call",
+    "colon",     "coloncaret",     "method_call", "super_call",    "assignlocalvar", "critsect",
+    "waitfor",   "pop",            "continue",    "looper",        "andand",       "switch",
+    "switcher",  "go",
+};
+
+/*
+ * Format a name for an op into 'buf'. Binary operators include their
+ * operator and ops implemented by functions are named for the function
+ * where it is known.
+ */
+void name_op(op *o, char buf[objnamez])
+{
+    struct
+    {
+        op         *o;
+        const char *name;
+    } const funcs[] = {
+        {&o_mklvalue, "mklvalue"},
+        {&o_onerror, "onerror"},
+        {&o_return, "return"},
+        {&o_mkptr, "mkptr"},
+        {&o_openptr, "openptr"},
+        {&o_fetch, "fetch"},
+    };
+
+    if (o->op_ecode == OP_BINOP || o->op_ecode == OP_BINOP_FOR_TEMP)
+    {
+        snprintf(buf, objnamez, "%s %s", op_ecode_names[o->op_ecode], binop_name(o->op_code));
+        return;
+    }
+    if (o->op_ecode != OP_OTHER && size_t(o->op_ecode) < nels(op_ecode_names))
+    {
+        snprintf(buf, objnamez, "%s", op_ecode_names[o->op_ecode]);
+        return;
+    }
+    for (auto &f : funcs)
+    {
+        if (o->op_func == f.o->op_func)
+        {
+            snprintf(buf, objnamez, "%s", f.name);
+            return;
+        }
+    }
+    if (o->op_func == op_unary)
+    {
+        snprintf(buf, objnamez, "unary");
+    }
+    else if (o->op_func == op_for)
+    {
+        snprintf(buf, objnamez, "for");
+    }
+    else if (o->op_func == op_forall)
+    {
+        snprintf(buf, objnamez, "forall");
+    }
+    else
+    {
+        snprintf(buf, objnamez, "%s", op_ecode_names[OP_OTHER]);
+    }
+}
+
+void name_line(src *sr, char buf[objnamez])
+{
+    snprintf(buf, objnamez, "%s:%d", sr->s_filename ? sr->s_filename->s_chars : "?", sr->s_lineno);
+}
+
+/*
+ * Add a counter to the map 'm' under the given name, summing counters
+ * with the same name.
+ */
+int add_counter(map *m, const char *name, const opcounter *c)
+{
+    auto k = make_ref(new_str_nul_term(name));
+    if (!k)
+    {
+        return 1;
+    }
+    long count = long(c->oc_count);
+    long cyc = long(c->oc_cycles);
+    auto e = ici_fetch(m, k);
+    if (ismap(e))
+    {
+        auto n = ici_fetch(e, SS(count));
+        auto y = ici_fetch(e, SS(cycles));
+        count += isint(n) ? long(intof(n)->i_value) : 0;
+        cyc += isint(y) ? long(intof(y)->i_value) : 0;
+    }
+    else
+    {
+        auto v = make_ref<map>(new_map());
+        if (!v || ici_assign(m, k, v))
+        {
+            return 1;
+        }
+        e = v;
+    }
+    return set_val(objwsupof(e), SS(count), 'i', &count) || set_val(objwsupof(e), SS(cycles), 'i', &cyc);
+}
+
+map *counters_map(opcounters *t, bool ops)
+{
+    char buf[objnamez];
+
+    auto m = make_ref<map>(new_map());
+    if (!m)
+    {
+        return nullptr;
+    }
+    for (size_t i = 0; i < t->t_nslots; ++i)
+    {
+        auto c = &t->t_slots[i];
+        if (c->oc_key == nullptr)
+        {
+            continue;
+        }
+        if (ops)
+        {
+            name_op(opof(c->oc_key), buf);
+        }
+        else
+        {
+            name_line(srcof(c->oc_key), buf);
+        }
+        if (add_counter(m, buf, c))
+        {
+            return nullptr;
+        }
+    }
+    return m.release();
+}
+
+void write_counters(FILE *fp, const char *title, opcounters *t, bool ops)
+{
+    char buf[objnamez];
+
+    if (t->t_nels == 0)
+    {
+        return;
+    }
+    auto v = static_cast<opcounter *>(ici_alloc(t->t_nels * sizeof(opcounter)));
+    if (v == nullptr)
+    {
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < t->t_nslots; ++i)
+    {
+        if (t->t_slots[i].oc_key != nullptr)
+        {
+            v[n++] = t->t_slots[i];
+        }
+    }
+    std::sort(v, v + n, [](const opcounter &a, const opcounter &b) { return a.oc_cycles > b.oc_cycles; });
+    fprintf(fp, "%-16s %12s %s\n", "cycles", "count", title);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (ops)
+        {
+            name_op(opof(v[i].oc_key), buf);
+        }
+        else
+        {
+            name_line(srcof(v[i].oc_key), buf);
+        }
+        fprintf(fp, "%-16llu %12llu %s\n", (unsigned long long)v[i].oc_cycles, (unsigned long long)v[i].oc_count, buf);
+    }
+    ici_free(v);
+}
+
+} // namespace
+
+/*
+ * Called by the execution loop, when counting, for each op executed.
+ */
+void opcount_op(op *o)
+{
+    const auto now = cycles();
+    if (opcount_last_op != nullptr)
+    {
+        opcount_last_op->oc_cycles += now - opcount_op_start;
+    }
+    if ((opcount_last_op = counter_for(&opcount_ops, o)) != nullptr)
+    {
+        ++opcount_last_op->oc_count;
+    }
+    opcount_op_start = now;
+}
+
+/*
+ * Called by the execution loop, when counting, for each source line
+ * marker executed.
+ */
+void opcount_line(src *sr)
+{
+    const auto now = cycles();
+    if (opcount_last_line != nullptr)
+    {
+        opcount_last_line->oc_cycles += now - opcount_line_start;
+    }
+    if ((opcount_last_line = counter_for(&opcount_lines, sr)) != nullptr)
+    {
+        ++opcount_last_line->oc_count;
+    }
+    opcount_line_start = now;
+}
+
+/*
+ * Start counting, discarding any previous counts.
+ *
+ * Returns 0 on success, 1 on error, usual conventions.
+ */
+int opcount_start()
+{
+    opcount_active = 0;
+    free_counters(&opcount_ops);
+    free_counters(&opcount_lines);
+    opcount_last_op = nullptr;
+    opcount_last_line = nullptr;
+    if (opcount_keys == nullptr && (opcount_keys = new_array()) == nullptr)
+    {
+        return 1;
+    }
+    opcount_keys->a_top = opcount_keys->a_base;
+    opcount_active = 1;
+    return 0;
+}
+
+/*
+ * Start counting, as at interpreter start up, if the ICI_OPCOUNTS
+ * environment variable is set. The report is written by
+ * opcount_report() to the file it names.
+ */
+int opcount_init()
+{
+    auto p = getenv("ICI_OPCOUNTS");
+    if (p == nullptr || *p == '\0')
+    {
+        return 0;
+    }
+    snprintf(opcount_report_file, sizeof opcount_report_file, "%s", p);
+    return opcount_start();
+}
+
+/*
+ * Write the counters, most expensive first, if a report was asked for
+ * via ICI_OPCOUNTS.
+ */
+void opcount_report()
+{
+    FILE *fp;
+
+    opcount_active = 0;
+    if (opcount_report_file[0] == '\0')
+    {
+        return;
+    }
+    if (strcmp(opcount_report_file, "-") == 0)
+    {
+        fp = stderr;
+    }
+    else if ((fp = fopen(opcount_report_file, "w")) == nullptr)
+    {
+        return;
+    }
+    write_counters(fp, "op", &opcount_ops, true);
+    fputc('\n', fp);
+    write_counters(fp, "line", &opcount_lines, false);
+    if (fp != stderr)
+    {
+        fclose(fp);
+    }
+    opcount_report_file[0] = '\0';
+}
+
+/*
+ * opcounts(1)
+ * opcounts(0)
+ * opcounts()
+ *
+ * The first form starts counting ops and source lines, discarding any
+ * previous counts, and the second stops counting. The last returns the
+ * counts so far as a map with two keys, "ops" and "lines". Each maps
+ * names, of ops or of lines ("file:line"), to maps with the keys "count"
+ * and "cycles".
+ *
+ * This --topic-- forms part of the --ici-profile-- documentation.
+ */
+static int f_opcounts(...)
+{
+    long on;
+
+    if (NARGS() == 0)
+    {
+        auto m = make_ref<map>(new_map());
+        if (!m)
+        {
+            return 1;
+        }
+        auto ops = make_ref(counters_map(&opcount_ops, true));
+        if (!ops || set_val(m, SS(ops), 'o', ops.get()))
+        {
+            return 1;
+        }
+        auto lines = make_ref(counters_map(&opcount_lines, false));
+        if (!lines || set_val(m, SS(lines), 'o', lines.get()))
+        {
+            return 1;
+        }
+        return ret_with_decref(m.release());
+    }
+    if (typecheck("i", &on))
+    {
+        return 1;
+    }
+    if (on)
+    {
+        if (opcount_start())
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        opcount_active = 0;
+    }
+    return null_ret();
+}
+
 /*
  * ICI functions exported for profiling.
  */
 ICI_DEFINE_CFUNCS(profile)
 {
     ICI_DEFINE_CFUNC(profile, f_profile),
+    ICI_DEFINE_CFUNC(sprofile, f_sprofile),
+    ICI_DEFINE_CFUNC(opcounts, f_opcounts),
     ICI_CFUNCS_END()
 };
 
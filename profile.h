@@ -54,6 +54,25 @@ void         profile_return();
 void         profile_set_done_callback(void (*)(profilecall *));
 profilecall *profilecall_new(profilecall *called_by);
 
+/*
+ * The sampling profiler, see sprofile(). profile_ticks is non-zero when
+ * a sample is due.
+ */
+extern volatile sig_atomic_t profile_ticks;
+void                         profile_sample();
+int                          profile_sample_stop();
+
+/*
+ * Op and source line counters, see opcounts(). The execution loop calls
+ * opcount_op() and opcount_line() while opcount_active is set.
+ */
+extern int opcount_active;
+void       opcount_op(op *);
+void       opcount_line(src *);
+int        opcount_start();
+int        opcount_init();
+void       opcount_report();
+
 /*
  * End of ici.h export. --ici.h-end--
  */
@@ -0,0 +1,512 @@
+#define ICI_CORE
+#include "pvec.h"
+#include "archiver.h"
+#include "forall.h"
+#include "int.h"
+#include "null.h"
+#include "object.h"
+#include "primes.h"
+
+namespace ici
+{
+
+/*
+ * Return a new pvnode that is a copy of n, or empty if n is nullptr.
+ * The node has one reference and is not yet registered, the caller
+ * sets any slots then calls rego(). Returns nullptr on error, usual
+ * conventions.
+ */
+static pvnode *new_pvnode(pvnode *n)
+{
+    pvnode *nn;
+
+    if ((nn = ici_talloc(pvnode)) == nullptr)
+    {
+        return nullptr;
+    }
+    set_tfnz(nn, TC_PVNODE, 0, 1, 0);
+    if (n == nullptr)
+    {
+        memset(nn->v_slots, 0, sizeof nn->v_slots);
+    }
+    else
+    {
+        memcpy(nn->v_slots, n->v_slots, sizeof nn->v_slots);
+    }
+    return nn;
+}
+
+/*
+ * Return a path of new nodes, level bits high, down to the existing
+ * node n. The result has one reference.
+ */
+static pvnode *new_path(size_t level, pvnode *n)
+{
+    pvnode *c;
+    pvnode *nn;
+
+    if (level == 0)
+    {
+        n->incref();
+        return n;
+    }
+    if ((c = new_path(level - PVEC_BITS, n)) == nullptr)
+    {
+        return nullptr;
+    }
+    if ((nn = new_pvnode(nullptr)) == nullptr)
+    {
+        c->decref();
+        return nullptr;
+    }
+    nn->v_slots[0] = c;
+    rego(nn);
+    c->decref();
+    return nn;
+}
+
+/*
+ * Return a copy of the sub-trie n, level bits high, with the full tail
+ * added as the leaf for the elements from index i. The result has one
+ * reference.
+ */
+static pvnode *push_tail(size_t level, pvnode *n, pvnode *tail, size_t i)
+{
+    const auto sub = (i >> level) & PVEC_MASK;
+    pvnode    *c;
+    pvnode    *nn;
+
+    if (level == PVEC_BITS)
+    {
+        c = tail;
+        c->incref();
+    }
+    else if (n != nullptr && n->v_slots[sub] != nullptr)
+    {
+        c = push_tail(level - PVEC_BITS, pvnodeof(n->v_slots[sub]), tail, i);
+    }
+    else
+    {
+        c = new_path(level - PVEC_BITS, tail);
+    }
+    if (c == nullptr)
+    {
+        return nullptr;
+    }
+    if ((nn = new_pvnode(n)) == nullptr)
+    {
+        c->decref();
+        return nullptr;
+    }
+    nn->v_slots[sub] = c;
+    rego(nn);
+    c->decref();
+    return nn;
+}
+
+/*
+ * Return a copy of the sub-trie n, level bits high, with the element
+ * at index i set to v. The result has one reference.
+ */
+static pvnode *put_path(size_t level, pvnode *n, size_t i, object *v)
+{
+    pvnode *c = nullptr;
+    pvnode *nn;
+
+    if (level > 0)
+    {
+        c = put_path(level - PVEC_BITS, pvnodeof(n->v_slots[(i >> level) & PVEC_MASK]), i, v);
+        if (c == nullptr)
+        {
+            return nullptr;
+        }
+        v = c;
+    }
+    if ((nn = new_pvnode(n)) == nullptr)
+    {
+        if (c != nullptr)
+        {
+            c->decref();
+        }
+        return nullptr;
+    }
+    nn->v_slots[(i >> level) & PVEC_MASK] = v;
+    rego(nn);
+    if (c != nullptr)
+    {
+        c->decref();
+    }
+    return nn;
+}
+
+/*
+ * Append o to the pvec. Returns 1 on error, usual conventions.
+ */
+int pvec::push(object *o)
+{
+    pvnode *t;
+
+    if (v_count - tailoff() < PVEC_WIDTH)
+    {
+        if ((t = new_pvnode(v_tail)) == nullptr)
+        {
+            return 1;
+        }
+        t->v_slots[v_count & PVEC_MASK] = o;
+        rego(t);
+        v_tail = t;
+        v_hash += elem_hash(v_count, o);
+        ++v_count;
+        t->decref();
+        return 0;
+    }
+    /*
+     * The tail is full. Move it into the trie, adding a level above the
+     * root if the trie is full, and start a new tail.
+     */
+    pvnode *r;
+    size_t  shift = v_shift;
+    if ((v_count >> PVEC_BITS) > (size_t(1) << v_shift))
+    {
+        pvnode *p;
+
+        if ((p = new_path(v_shift, v_tail)) == nullptr)
+        {
+            return 1;
+        }
+        if ((r = new_pvnode(nullptr)) == nullptr)
+        {
+            p->decref();
+            return 1;
+        }
+        r->v_slots[0] = v_root;
+        r->v_slots[1] = p;
+        rego(r);
+        p->decref();
+        shift += PVEC_BITS;
+    }
+    else if ((r = push_tail(v_shift, v_root, v_tail, v_count - 1)) == nullptr)
+    {
+        return 1;
+    }
+    if ((t = new_pvnode(nullptr)) == nullptr)
+    {
+        r->decref();
+        return 1;
+    }
+    t->v_slots[0] = o;
+    rego(t);
+    v_root = r;
+    v_tail = t;
+    v_shift = shift;
+    v_hash += elem_hash(v_count, o);
+    ++v_count;
+    r->decref();
+    t->decref();
+    return 0;
+}
+
+/*
+ * Set the i'th element, which must be in range, to o. Returns 1 on
+ * error, usual conventions.
+ */
+int pvec::put(size_t i, object *o)
+{
+    pvnode *n;
+    object *old;
+
+    if ((old = get(i)) == o)
+    {
+        return 0;
+    }
+    if (i >= tailoff())
+    {
+        if ((n = new_pvnode(v_tail)) == nullptr)
+        {
+            return 1;
+        }
+        n->v_slots[i & PVEC_MASK] = o;
+        rego(n);
+        v_tail = n;
+    }
+    else
+    {
+        if ((n = put_path(v_shift, v_root, i, o)) == nullptr)
+        {
+            return 1;
+        }
+        v_root = n;
+    }
+    v_hash += elem_hash(i, o) - elem_hash(i, old);
+    n->decref();
+    return 0;
+}
+
+/*
+ * Return a new, empty, persistent vector. The returned object has been
+ * increfed. Returns nullptr on error, usual conventions.
+ *
+ * This --func-- forms part of the --ici-api--.
+ */
+pvec *new_pvec()
+{
+    pvec *v;
+
+    if ((v = ici_talloc(pvec)) == nullptr)
+    {
+        return nullptr;
+    }
+    set_tfnz(v, TC_PVEC, 0, 1, 0);
+    v->v_count = 0;
+    v->v_shift = PVEC_BITS;
+    v->v_root = nullptr;
+    v->v_tail = nullptr;
+    v->v_hash = 0;
+    rego(v);
+    return v;
+}
+
+/*
+ * Mark this and referenced unmarked objects, return memory costs.
+ * See comments on t_mark() in object.h.
+ */
+size_t pvnode_type::mark(object *o)
+{
+    auto mem = type::mark(o);
+    for (auto e : pvnodeof(o)->v_slots)
+    {
+        mem += mark_optional(e);
+    }
+    return mem;
+}
+
+size_t pvec_type::mark(object *o)
+{
+    auto v = pvecof(o);
+    return type::mark(o) + mark_optional(v->v_root) + mark_optional(v->v_tail);
+}
+
+/*
+ * Returns 0 if these objects are equal, else non-zero.
+ * See the comments on t_cmp() in object.h.
+ */
+int pvec_type::cmp(object *o1, object *o2)
+{
+    auto v1 = pvecof(o1);
+    auto v2 = pvecof(o2);
+
+    if (v1 == v2)
+    {
+        return 0;
+    }
+    if (v1->v_count != v2->v_count || v1->v_hash != v2->v_hash)
+    {
+        return 1;
+    }
+    if (v1->v_root == v2->v_root && v1->v_tail == v2->v_tail)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < v1->v_count; ++i)
+    {
+        if (v1->get(i) != v2->get(i))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Return a hash sensitive to the value of the object.
+ * See the comment on t_hash() in object.h
+ */
+unsigned long pvec_type::hash(object *o)
+{
+    return pvecof(o)->v_hash + ARRAY_PRIME;
+}
+
+/*
+ * Return a copy of the given object, or nullptr on error. The copy
+ * shares the nodes so this takes constant time.
+ * See the comment on t_copy() in object.h.
+ */
+object *pvec_type::copy(object *o)
+{
+    pvec *v;
+
+    if ((v = new_pvec()) == nullptr)
+    {
+        return nullptr;
+    }
+    v->v_count = pvecof(o)->v_count;
+    v->v_shift = pvecof(o)->v_shift;
+    v->v_root = pvecof(o)->v_root;
+    v->v_tail = pvecof(o)->v_tail;
+    v->v_hash = pvecof(o)->v_hash;
+    return v;
+}
+
+/*
+ * Assign to key k of the object o the value v. Return 1 on error, else 0.
+ * See the comment on t_assign() in object.h.
+ *
+ * As for arrays, a negative index counts from the end and assigning
+ * past the end extends the pvec, with NULLs if needed.
+ */
+int pvec_type::assign(object *o, object *k, object *v)
+{
+    auto    pv = pvecof(o);
+    int64_t i;
+
+    if (o->isatom())
+    {
+        return set_error("attempt to assign to an atomic pvec");
+    }
+    if (!isint(k))
+    {
+        return assign_fail(o, k, v);
+    }
+    i = intof(k)->i_value;
+    if (i < 0)
+    {
+        i += pv->v_count;
+        if (i < 0)
+        {
+            return set_error("index %lld out of range for pvec", (long long)intof(k)->i_value);
+        }
+    }
+    if (size_t(i) < pv->v_count)
+    {
+        return pv->put(size_t(i), v);
+    }
+    while (pv->v_count < size_t(i))
+    {
+        if (pv->push(null))
+        {
+            return 1;
+        }
+    }
+    return pv->push(v);
+}
+
+object *pvec_type::fetch(object *o, object *k)
+{
+    auto    v = pvecof(o);
+    int64_t i;
+
+    if (!isint(k))
+    {
+        return fetch_fail(o, k);
+    }
+    if ((i = intof(k)->i_value) < 0)
+    {
+        i += v->v_count;
+    }
+    if (i < 0 || size_t(i) >= v->v_count)
+    {
+        return null;
+    }
+    return v->get(size_t(i));
+}
+
+int pvec_type::forall(object *o)
+{
+    auto     fa = forallof(o);
+    auto     v = pvecof(fa->fa_aggr);
+    integer *i;
+
+    if (++fa->fa_index >= v->v_count)
+    {
+        return -1;
+    }
+    if (fa->fa_vaggr != null)
+    {
+        if (ici_assign(fa->fa_vaggr, fa->fa_vkey, v->get(fa->fa_index)))
+        {
+            return 1;
+        }
+    }
+    if (fa->fa_kaggr != null)
+    {
+        if ((i = make_ref(new_int((long)fa->fa_index))) == nullptr)
+        {
+            return 1;
+        }
+        if (ici_assign(fa->fa_kaggr, fa->fa_kkey, i))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pvec_type::save(archiver *ar, object *o)
+{
+    auto v = pvecof(o);
+    if (ar->save_name(o))
+    {
+        return 1;
+    }
+    const int64_t len = v->v_count;
+    if (ar->write(len))
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < v->v_count; ++i)
+    {
+        if (ar->save(v->get(i)))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+object *pvec_type::restore(archiver *ar)
+{
+    ref<pvec> v;
+    int64_t   len;
+    object   *name;
+
+    if (ar->restore_name(&name))
+    {
+        return nullptr;
+    }
+    if ((v = new_pvec()) == nullptr)
+    {
+        return nullptr;
+    }
+    if (ar->record(name, v))
+    {
+        return nullptr;
+    }
+    if (ar->read(&len))
+    {
+        goto fail;
+    }
+    for (int64_t i = 0; i < len; ++i)
+    {
+        ref<> o = ar->restore();
+        if (!o)
+        {
+            goto fail;
+        }
+        if (v->push(o))
+        {
+            goto fail;
+        }
+    }
+    return v.release();
+
+fail:
+    ar->remove(name);
+    return nullptr;
+}
+
+int64_t pvec_type::len(object *o)
+{
+    return pvecof(o)->v_count;
+}
+
+} // namespace ici
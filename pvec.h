@@ -0,0 +1,136 @@
+// -*- mode:c++ -*-
+
+#ifndef ICI_PVEC_H
+#define ICI_PVEC_H
+
+#include "object.h"
+
+namespace ici
+{
+
+/*
+ * The following portion of this file exports to ici.h. --ici.h-start--
+ */
+
+/*
+ * Persistent vectors
+ *
+ * A pvec is a sequence of objects held in a radix trie of pvnodes, each
+ * of 32 slots, and a tail pvnode holding the last, up to, 32 elements.
+ * As for pmaps nodes are never modified once made. Replacing an element
+ * copies the nodes on its path and appending copies the tail, or, when
+ * the tail is full, moves it into the trie. Copying a pvec shares its
+ * nodes, so a copy is a snapshot.
+ *
+ * v_shift is five times the number of levels of the trie above its
+ * leaves. The trie holds the elements before the tail, the first
+ * v_count - len(tail) elements. v_hash is kept as elements are set so
+ * hashing never needs to look at the nodes, which the garbage collector
+ * may have freed when it unatoms a pvec.
+ */
+constexpr size_t PVEC_BITS = 5;
+constexpr size_t PVEC_WIDTH = 1 << PVEC_BITS;
+constexpr size_t PVEC_MASK = PVEC_WIDTH - 1;
+
+struct pvnode : object
+{
+    object *v_slots[PVEC_WIDTH];
+};
+
+inline pvnode *pvnodeof(object *o)
+{
+    return o->as<pvnode>();
+}
+
+struct pvec : object
+{
+    size_t        v_count;
+    size_t        v_shift;
+    pvnode       *v_root; /* The trie, or nullptr if empty. */
+    pvnode       *v_tail; /* The tail, or nullptr if empty. */
+    unsigned long v_hash; /* The sum of elem_hash() of the elements. */
+
+    /*
+     * The index of the first element in the tail.
+     */
+    inline size_t tailoff() const
+    {
+        return v_count < PVEC_WIDTH ? 0 : ((v_count - 1) >> PVEC_BITS) << PVEC_BITS;
+    }
+
+    /*
+     * Return the i'th element, which must be in range.
+     */
+    inline object *get(size_t i) const
+    {
+        if (i >= tailoff())
+        {
+            return v_tail->v_slots[i & PVEC_MASK];
+        }
+        auto n = v_root;
+        for (auto level = v_shift; level > 0; level -= PVEC_BITS)
+        {
+            n = pvnodeof(n->v_slots[(i >> level) & PVEC_MASK]);
+        }
+        return n->v_slots[i & PVEC_MASK];
+    }
+
+    /*
+     * The contribution of the element o at index i to v_hash.
+     */
+    static inline unsigned long elem_hash(size_t i, object *o)
+    {
+        return ICI_PTR_HASH(o) * (2 * i + 1);
+    }
+
+    int push(object *);
+    int put(size_t, object *);
+};
+
+inline pvec *pvecof(object *o)
+{
+    return o->as<pvec>();
+}
+inline bool ispvec(object *o)
+{
+    return o->hastype(TC_PVEC);
+}
+
+/*
+ * End of ici.h export. --ici.h-end--
+ */
+
+pvec *new_pvec();
+
+class pvnode_type : public type
+{
+public:
+    pvnode_type() : type("pvnode", sizeof(struct pvnode))
+    {
+    }
+
+    size_t mark(object *o) override;
+};
+
+class pvec_type : public type
+{
+public:
+    pvec_type() : type("pvec", sizeof(struct pvec))
+    {
+    }
+
+    size_t        mark(object *o) override;
+    int           cmp(object *o1, object *o2) override;
+    unsigned long hash(object *o) override;
+    object       *copy(object *o) override;
+    int           assign(object *o, object *k, object *v) override;
+    object       *fetch(object *o, object *k) override;
+    int           forall(object *o) override;
+    int           save(archiver *, object *) override;
+    object       *restore(archiver *) override;
+    int64_t       len(object *o) override;
+};
+
+} // namespace ici
+
+#endif /* ICI_PVEC_H */
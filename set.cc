@@ -308,40 +308,38 @@ object *set_type::fetch(object *o, object *k)
 
 int set_type::forall(object *o)
 {
-    auto     fa = forallof(o);
-    set     *s;
-    object **sl;
+    return step(forallof(o));
+}
+
+/*
+ * Advance a forall loop over a set, see map_type::step().
+ */
+int set_type::step(struct forall *fa)
+{
+    auto s = setof(fa->fa_aggr);
 
-    s = setof(fa->fa_aggr);
     while (++fa->fa_index < s->s_nslots)
     {
-        if (*(sl = &s->s_slots[fa->fa_index]) == nullptr)
+        auto k = s->s_slots[fa->fa_index];
+        if (k == nullptr)
         {
             continue;
         }
         if (fa->fa_kaggr == null)
         {
-            if (fa->fa_vaggr != null)
+            if (fa->fa_vaggr != null && forall_assign(fa->fa_vaggr, fa->fa_vkey, k))
             {
-                if (ici_assign(fa->fa_vaggr, fa->fa_vkey, *sl))
-                {
-                    return 1;
-                }
+                return 1;
             }
+            return 0;
         }
-        else
+        if (fa->fa_vaggr != null && forall_assign(fa->fa_vaggr, fa->fa_vkey, o_one))
         {
-            if (fa->fa_vaggr != null)
-            {
-                if (ici_assign(fa->fa_vaggr, fa->fa_vkey, o_one))
-                {
-                    return 1;
-                }
-            }
-            if (ici_assign(fa->fa_kaggr, fa->fa_kkey, *sl))
-            {
-                return 1;
-            }
+            return 1;
+        }
+        if (forall_assign(fa->fa_kaggr, fa->fa_kkey, k))
+        {
+            return 1;
         }
         return 0;
     }
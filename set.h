@@ -49,6 +49,7 @@ public:
     int64_t       len(object *) override;
     int           nkeys(object *) override;
     int           keys(object *, array *) override;
+    static int    step(struct forall *);
 };
 
 /*
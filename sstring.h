@@ -79,6 +79,7 @@ SSTRING(cmp, "cmp")
 SSTRING(connect, "connect")
 SSTRING(continue, "continue")
 SSTRING(copy, "copy")
+SSTRING(copycounts, "copycounts")
 SSTRING(core, "core")
 SSTRING(core1, "core1")
 SSTRING(core2, "core2")
@@ -87,9 +88,9 @@ SSTRING(core4, "core4")
 SSTRING(core5, "core5")
 SSTRING(core6, "core6")
 SSTRING(core7, "core7")
-SSTRING(core8, "core8")
 SSTRING(core9, "core9")
 SSTRING(cos, "cos")
+SSTRING(count, "count")
 SSTRING(cpu, "cpu")
 SSTRING(cputime, "cputime")
 SSTRING(creat, "creat")
@@ -97,6 +98,7 @@ SSTRING(critsect, "critsect")
 SSTRING(ctime, "ctime")
 SSTRING(cur, "cur")
 SSTRING(currentfile, "currentfile")
+SSTRING(cycles, "cycles")
 SSTRING(data, "data")
 SSTRING(day, "day")
 SSTRING(debug, "debug")
@@ -202,6 +204,7 @@ SSTRING(keys, "keys")
 SSTRING(kill, "kill")
 SSTRING(len, "len")
 SSTRING(line, "line")
+SSTRING(lines, "lines")
 SSTRING(link, "link")
 SSTRING(listen, "listen")
 SSTRING(load, "load")
@@ -229,6 +232,8 @@ SSTRING(mode, "mode")
 SSTRING(module, "module")
 SSTRING(month, "month")
 SSTRING(mopen, "mopen")
+SSTRING(mrestore, "mrestore")
+SSTRING(msave, "msave")
 SSTRING(msg, "msg")
 SSTRING(mtime, "mtime")
 SSTRING(n, "n")
@@ -246,8 +251,12 @@ SSTRING(null, "null")
 SSTRING(num, "num")
 SSTRING(onerror, "onerror")
 SSTRING(op, "op")
+SSTRING(opcounts, "opcounts")
 SSTRING(open, "open")
 SSTRING(options, "options")
+SSTRING(ops, "ops")
+SSTRING(parmap, "parmap")
+SSTRING(parreduce, "parreduce")
 SSTRING(parse, "parse")
 SSTRING(parseopen, "parseopen")
 SSTRING(parser, "parser")
@@ -262,6 +271,7 @@ SSTRING(pfopen, "pfopen")
 SSTRING(pi, "pi")
 SSTRING(pid, "pid")
 SSTRING(pipe, "pipe")
+SSTRING(pmap, "pmap")
 SSTRING(pop, "pop")
 SSTRING(pow, "pow")
 SSTRING(print, "print")
@@ -270,11 +280,13 @@ SSTRING(println, "println")
 SSTRING(prof, "prof")
 SSTRING(profile, "profile")
 SSTRING(properties, "properties")
+SSTRING(pset, "pset")
 SSTRING(ptr, "ptr")
 SSTRING(push, "push")
 SSTRING(put, "put")
 SSTRING(putenv, "putenv")
 SSTRING(puts, "puts")
+SSTRING(pvec, "pvec")
 SSTRING(rand, "rand")
 SSTRING(raw, "raw")
 SSTRING(rdev, "rdev")
@@ -323,6 +335,7 @@ SSTRING(setpgrp, "setpgrp")
 SSTRING(setrlimit, "setrlimit")
 SSTRING(setsockopt, "setsockopt")
 SSTRING(setuid, "setuid")
+SSTRING(shared, "shared")
 SSTRING(shell, "shell")
 SSTRING(shutdown, "shutdown")
 SSTRING(signal, "signal")
@@ -341,6 +354,7 @@ SSTRING(socketpair, "socketpair")
 SSTRING(sopen, "sopen")
 SSTRING(sort, "sort")
 SSTRING(spawn, "spawn")
+SSTRING(sprofile, "sprofile")
 SSTRING(spawnp, "spawnp")
 SSTRING(split, "split")
 SSTRING(sprint, "sprint")
@@ -386,6 +400,7 @@ SSTRING(unique, "unique")
 SSTRING(unknown_method, "unknown_method")
 SSTRING(unlck, "unlck")
 SSTRING(unlink, "unlink")
+SSTRING(unwritten, "unwritten")
 SSTRING(usec, "usec")
 SSTRING(usleep, "usleep")
 SSTRING(value, "value")
@@ -72,8 +72,9 @@ inline bool isstring(object *o)
 
 /*
  * This flag (in o_flags) indicates that the lookup-lookaside mechanism
- * is referencing an atomic struct.  It is stored in the allowed area of
- * o_flags.
+ * is referencing an atomic struct, or one whose slots are shared, so the
+ * slot may not be assigned through it.  It is stored in the allowed area
+ * of o_flags.
  */
 constexpr int ICI_S_LOOKASIDE_IS_ATOM = 0x20;
 
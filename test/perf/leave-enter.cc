@@ -0,0 +1,64 @@
+/*
+ * The cost of leave()/enter() round trips, as made around blocking
+ * calls, both back into the same exec, as when a thread re-enters
+ * without contention, and alternating between two execs, as when
+ * other ICI threads ran meanwhile. Build against an ICI build
+ * directory, which has ici.h and the library, and run it with ICIPATH
+ * set to find ici-core.ici:
+ *
+ *     c++ -std=c++14 -O2 -I$build leave-enter.cc -L$build -lici
+ *     ICIPATH=$src LD_LIBRARY_PATH=$build ./a.out [n]
+ */
+#include "ici.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace ici;
+
+static double ns_per(long n, std::chrono::steady_clock::time_point t)
+{
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - t;
+    return d.count() / n;
+}
+
+int main(int argc, char *argv[])
+{
+    long  n = argc > 1 ? atol(argv[1]) : 10000000;
+    exec *x1;
+    exec *x2;
+
+    if (init())
+    {
+        fprintf(stderr, "%s\n", ex->x_error);
+        return 1;
+    }
+    x1 = ex;
+    if ((x2 = new_exec()) == nullptr)
+    {
+        fprintf(stderr, "%s\n", ex->x_error);
+        return 1;
+    }
+
+    auto t = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+    {
+        enter(leave());
+    }
+    printf("leave/enter, same exec: %.1f ns\n", ns_per(n, t));
+
+    t = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i += 2)
+    {
+        leave();
+        enter(x2);
+        leave();
+        enter(x1);
+    }
+    printf("leave/enter, switching exec: %.1f ns\n", ns_per(n, t));
+
+    decref(x2);
+    uninit();
+    return 0;
+}
@@ -4,16 +4,277 @@
 #include "exec.h"
 #include "fwd.h"
 #include "op.h"
+#include "workers.h"
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
+
+#ifdef ICI_HAS_UCONTEXT
+#include <sys/mman.h>
+#include <ucontext.h>
+#endif
 
 namespace ici
 {
 
-std::mutex       ici_mutex;
-std::atomic<int> ici_n_active_threads;
+std::mutex ici_mutex;
+
+/*
+ * The number of threads blocked on the ICI mutex in enter(), or
+ * yield(), so yield() knows if there are any to yield to. A thread
+ * that gets the mutex without waiting doesn't touch it.
+ */
+static std::atomic<int> n_entering;
+
+static void lock_ici_mutex()
+{
+    if (!ici_mutex.try_lock())
+    {
+        ++n_entering;
+        ici_mutex.lock();
+        --n_entering;
+    }
+}
+
+#ifdef ICI_HAS_UCONTEXT
+/*
+ * Green threads
+ *
+ * Threads started by go() are tasks, an exec with a native stack of its
+ * own, run by a few carrier threads rather than each having an OS
+ * thread. A task that waits, in waitfor(), or yields to other tasks,
+ * switches back to its carrier's scheduler, which runs another ready
+ * task. So a waiting task costs its exec and stack, not an OS thread,
+ * and may later be resumed by any carrier.
+ *
+ * The ICI mutex still serialises ICI code, so a single carrier would
+ * do, except that a task that leaves the mutex domain, to block in a
+ * read say, keeps its carrier. Carriers are started as needed so that
+ * ready tasks don't wait on those.
+ */
+
+/*
+ * Task stacks are as large as the usual native thread stack, as
+ * native code, regular expression matching say, may recurse deeply.
+ * They are only reserved, pages are used as touched, and returned
+ * when a task finishes. The lowest task_guard_size bytes are
+ * inaccessible so an overflow faults rather than running into other
+ * memory.
+ */
+constexpr size_t task_stack_size = 8 * 1024 * 1024;
+constexpr size_t task_guard_size = 64 * 1024;
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+struct carrier;
+
+struct task
+{
+    ucontext_t t_context;
+    void      *t_stack;
+    carrier   *t_carrier; /* The carrier running the task. */
+    bool       t_waiting; /* Switched out by waitfor(), until wakeup(). */
+    bool       t_blocked; /* Between leave() and enter(). */
+};
+
+/*
+ * What a carrier does once its task has switched back to it. The task
+ * holds the ICI mutex until then, so it can't be woken, and resumed by
+ * another carrier, before its context has been saved.
+ */
+enum
+{
+    TA_WAIT,  /* Release the ICI mutex. */
+    TA_YIELD, /* Make the task ready and release the ICI mutex. */
+    TA_EXIT,  /* Release the ICI mutex and free the task. */
+};
+
+struct carrier
+{
+    ucontext_t c_context;
+    task      *c_task;
+    int        c_action; /* A TA_* value. */
+};
+
+/*
+ * The scheduler's state. Ready tasks are queued in the order they
+ * became ready. It is allocated, and never freed, as idle carriers are
+ * still waiting on it when static destructors run at exit. s_mutex is
+ * taken after, never before, the ICI mutex.
+ */
+struct scheduler
+{
+    std::mutex              s_mutex;
+    std::condition_variable s_cv; /* Signalled when a task is made ready. */
+    std::deque<exec *>      s_ready;
+    std::vector<void *>     s_stacks; /* Stacks of finished tasks, for reuse. */
+    size_t                  s_carriers = 0;
+    size_t                  s_idle = 0;    /* Carriers waiting for a task. */
+    size_t                  s_blocked = 0; /* Carriers whose task has left. */
+};
+
+static scheduler          *sched;
+static std::atomic<size_t> n_ready_tasks;
+
+static void carrier_main();
+
+/*
+ * Start a carrier if there are ready tasks but none able to run them.
+ * Called with s_mutex held.
+ */
+static void start_carrier_if_needed()
+{
+    if (sched->s_ready.empty() || sched->s_idle != 0 || sched->s_carriers != sched->s_blocked)
+    {
+        return;
+    }
+    try
+    {
+        std::thread(carrier_main).detach();
+        ++sched->s_carriers;
+    }
+    catch (...)
+    {
+        /* The task waits for a carrier to come free. */
+    }
+}
+
+/*
+ * Queue the task x to be run by a carrier.
+ */
+static void make_ready(exec *x)
+{
+    std::lock_guard<std::mutex> lock(sched->s_mutex);
+    sched->s_ready.push_back(x);
+    ++n_ready_tasks;
+    if (sched->s_idle != 0)
+    {
+        sched->s_cv.notify_one();
+    }
+    else
+    {
+        start_carrier_if_needed();
+    }
+}
+
+/*
+ * Note that the task t's carrier is, or is no longer, tied up in the
+ * native code between leave() and enter().
+ */
+static void set_blocked(task *t, bool blocked)
+{
+    std::lock_guard<std::mutex> lock(sched->s_mutex);
+    t->t_blocked = blocked;
+    if (blocked)
+    {
+        ++sched->s_blocked;
+        start_carrier_if_needed();
+    }
+    else
+    {
+        --sched->s_blocked;
+    }
+}
+
+/*
+ * Switch from the task t back to its carrier, which then does action.
+ * Returns when the task is next run, perhaps by another carrier.
+ */
+static void switch_to_carrier(task *t, int action)
+{
+    carrier *c = t->t_carrier;
+    c->c_action = action;
+    swapcontext(&t->t_context, &c->c_context);
+}
+
+static void carrier_main()
+{
+    carrier                      c;
+    std::unique_lock<std::mutex> lock(sched->s_mutex);
+
+    for (;;)
+    {
+        while (sched->s_ready.empty())
+        {
+            ++sched->s_idle;
+            sched->s_cv.wait(lock);
+            --sched->s_idle;
+        }
+        exec *x = sched->s_ready.front();
+        sched->s_ready.pop_front();
+        --n_ready_tasks;
+        lock.unlock();
+
+        c.c_task = x->x_task;
+        c.c_task->t_carrier = &c;
+        swapcontext(&c.c_context, &c.c_task->t_context);
+        switch (c.c_action)
+        {
+        case TA_YIELD:
+            make_ready(x);
+            ici_mutex.unlock();
+            break;
+
+        case TA_EXIT:
+            ici_mutex.unlock();
+            madvise(c.c_task->t_stack, task_stack_size, MADV_DONTNEED);
+            lock.lock();
+            sched->s_stacks.push_back(c.c_task->t_stack);
+            delete c.c_task;
+            continue;
+
+        default:
+            ici_mutex.unlock();
+            break;
+        }
+        lock.lock();
+    }
+}
+#endif /* ICI_HAS_UCONTEXT */
+
+/*
+ * The stacks of ex stay in the static copies os, xs and vs when it
+ * leaves. They are only copied back to ex's own arrays when a
+ * different exec enters, so a thread that re-enters before any other
+ * has run, the usual case around blocking calls, copies nothing.
+ * Nothing else uses ex's stacks meanwhile, and the garbage collector
+ * only runs once another exec has entered, so ex is alive until then.
+ */
+static void switch_stacks(exec *x)
+{
+    if (ex != nullptr)
+    {
+        os.decref();
+        xs.decref();
+        vs.decref();
+        *ex->x_os = os;
+        *ex->x_xs = xs;
+        *ex->x_vs = vs;
+        ex->x_count = exec_count;
+    }
+    ex = x;
+    os = *x->x_os;
+    xs = *x->x_xs;
+    vs = *x->x_vs;
+    exec_count = x->x_count;
+    x->x_os->a_base = nullptr;
+    x->x_xs->a_base = nullptr;
+    x->x_vs->a_base = nullptr;
+    os.incref();
+    xs.incref();
+    vs.incref();
+}
 
 /*
  * Leave code that uses ICI data. ICI data refers to *any* ICI objects
@@ -44,28 +305,18 @@ std::atomic<int> ici_n_active_threads;
 
 static exec *leave_locked()
 {
-    exec *x = ex;
-    if (!x->x_critsect)
-    {
-        /*
-         * Restore the copies of our stack arrays that are cached
-         * in static locations back to the execution context.
-         */
-        os.decref();
-        xs.decref();
-        vs.decref();
-        *x->x_os = os;
-        *x->x_xs = xs;
-        *x->x_vs = vs;
-        x->x_count = exec_count;
-        --ici_n_active_threads;
-    }
-    return x;
+    return ex;
 }
 
 exec *leave()
 {
     auto x = leave_locked();
+#ifdef ICI_HAS_UCONTEXT
+    if (x->x_task != nullptr && !x->x_critsect)
+    {
+        set_blocked(x->x_task, true);
+    }
+#endif
     ici_mutex.unlock();
     return x;
 }
@@ -91,8 +342,13 @@ void enter(exec *x)
 {
     if (!x->x_critsect)
     {
-        ++ici_n_active_threads;
-        ici_mutex.lock();
+#ifdef ICI_HAS_UCONTEXT
+        if (x->x_task != nullptr && x->x_task->t_blocked)
+        {
+            set_blocked(x->x_task, false);
+        }
+#endif
+        lock_ici_mutex();
         if (x != ex)
         {
             /*
@@ -101,18 +357,8 @@ void enter(exec *x)
              * global cached copies (which we do to save a level of
              * indirection on all accesses).
              */
-            ex = x;
-            os = *x->x_os;
-            xs = *x->x_xs;
-            vs = *x->x_vs;
-            exec_count = x->x_count;
+            switch_stacks(x);
         }
-        x->x_os->a_base = nullptr;
-        x->x_xs->a_base = nullptr;
-        x->x_vs->a_base = nullptr;
-        os.incref();
-        xs.incref();
-        vs.incref();
     }
 }
 
@@ -133,41 +379,114 @@ void yield()
     exec *x;
 
     x = ex;
-    if (ici_n_active_threads > 1 && x->x_critsect == 0)
+#ifdef ICI_HAS_UCONTEXT
+    if (x->x_task != nullptr && n_ready_tasks != 0 && x->x_critsect == 0)
+    {
+        (void)leave_locked();
+        switch_to_carrier(x->x_task, TA_YIELD);
+        enter(x);
+        return;
+    }
+#endif
+    if (n_entering != 0 && x->x_critsect == 0)
     {
-        os.decref();
-        xs.decref();
-        vs.decref();
-        *x->x_os = os;
-        *x->x_xs = xs;
-        *x->x_vs = vs;
-        x->x_count = exec_count;
         ici_mutex.unlock();
         std::this_thread::yield();
-        ici_mutex.lock();
+        lock_ici_mutex();
         if (x != ex)
         {
-            /*
-             * This really is a change of contexts. Set the global
-             * context pointer, and move the stack arrays to the
-             * global cached copies (which we do to save a level of
-             * indirection on all accesses.
-             */
-            ex = x;
-            os = *x->x_os;
-            xs = *x->x_xs;
-            vs = *x->x_vs;
-            exec_count = x->x_count;
+            switch_stacks(x);
+        }
+    }
+}
+
+/*
+ * After waiting on a condition variable with the ICI mutex adopted by
+ * lock, as waitfor() does, the mutex is held again. Outside a critical
+ * section it is released with lock and re-acquired by enter(). In one
+ * enter() does nothing, so keep the mutex and restore x's stacks here,
+ * as other threads may have run meanwhile.
+ */
+static void keep_critsect_mutex(exec *x, std::unique_lock<std::mutex> &lock)
+{
+    if (x->x_critsect)
+    {
+        lock.release();
+        if (x != ex)
+        {
+            switch_stacks(x);
         }
-        x->x_os->a_base = nullptr;
-        x->x_xs->a_base = nullptr;
-        x->x_vs->a_base = nullptr;
-        os.incref();
-        xs.incref();
-        vs.incref();
     }
 }
 
+/*
+ * Threads waiting in waitfor() are found by wakeup() through a hash
+ * table, keyed by the address of the object waited for, of lists of
+ * execs linked through x_waitnext. Objects that are waited for have
+ * the O_WAITED flag, so a wakeup() of anything else is a flag test.
+ * The table doubles when the waiters outnumber its slots.
+ */
+static std::vector<exec *> wait_table(64);
+static size_t              n_waiters;
+
+static size_t wait_slot(object *o)
+{
+    return ICI_PTR_HASH(o) & (wait_table.size() - 1);
+}
+
+static void add_waiter(exec *x, object *o)
+{
+    if (++n_waiters > wait_table.size())
+    {
+        std::vector<exec *> old(wait_table.size() * 2);
+        old.swap(wait_table);
+        for (auto y : old)
+        {
+            while (y != nullptr)
+            {
+                auto next = y->x_waitnext;
+                auto &slot = wait_table[wait_slot(y->x_waitfor)];
+                y->x_waitnext = slot;
+                slot = y;
+                y = next;
+            }
+        }
+    }
+    auto &slot = wait_table[wait_slot(o)];
+    x->x_waitfor = o;
+    x->x_waitnext = slot;
+    slot = x;
+    o->set(object::O_WAITED);
+}
+
+/*
+ * Remove x from the waiters for its x_waitfor, clearing O_WAITED if
+ * none remain.
+ */
+static void remove_waiter(exec *x)
+{
+    object *o = x->x_waitfor;
+    bool    waited = false;
+
+    for (exec **xp = &wait_table[wait_slot(o)]; *xp != nullptr;)
+    {
+        if (*xp == x)
+        {
+            *xp = x->x_waitnext;
+            continue;
+        }
+        waited |= (*xp)->x_waitfor == o;
+        xp = &(*xp)->x_waitnext;
+    }
+    if (!waited)
+    {
+        o->clr(object::O_WAITED);
+    }
+    x->x_waitnext = nullptr;
+    x->x_waitfor = nullptr;
+    --n_waiters;
+}
+
 /*
  * Wait for the given object to be signaled. This is the core primitive of
  * the waitfor ICI language construct. However this function only does the
@@ -194,15 +513,45 @@ int waitfor(object *o)
     const char *e;
 
     e = nullptr;
-    ex->x_waitfor = o;
+    add_waiter(ex, o);
     x = leave_locked();
+#ifdef ICI_HAS_UCONTEXT
+    if (x->x_task != nullptr && !x->x_critsect)
+    {
+        x->x_task->t_waiting = true;
+        switch_to_carrier(x->x_task, TA_WAIT);
+    }
+    else
+#endif
     {
+#ifdef ICI_HAS_UCONTEXT
+        /*
+         * A task in a critical section waits on its carrier's thread,
+         * which must be counted as blocked so the tasks queued behind
+         * it get another carrier.
+         */
+        if (x->x_task != nullptr)
+        {
+            set_blocked(x->x_task, true);
+        }
+#endif
         // we need a lock<> to invoke cv's wait(), adopt ici_mutex
         std::unique_lock<std::mutex> lock(ici_mutex, std::adopt_lock);
         assert(lock.owns_lock());
         x->x_semaphore->wait(lock);
+#ifdef ICI_HAS_UCONTEXT
+        if (x->x_task != nullptr && x->x_task->t_blocked)
+        {
+            set_blocked(x->x_task, false);
+        }
+#endif
+        keep_critsect_mutex(x, lock);
     }
     enter(x);
+    if (x->x_waitfor != nullptr)
+    {
+        remove_waiter(x); /* A spurious wakeup. */
+    }
     if ((e = x->x_error) != nullptr)
     {
         return set_error("%s", e);
@@ -218,30 +567,47 @@ int waitfor(object *o)
  */
 int wakeup(object *o)
 {
-    exec *x;
+    exec **xp;
+    exec  *x;
 
-    for (x = execs; x != nullptr; x = x->x_next)
+    if (!o->hasflag(object::O_WAITED))
+    {
+        return 0;
+    }
+    o->clr(object::O_WAITED);
+    for (xp = &wait_table[wait_slot(o)]; (x = *xp) != nullptr;)
     {
-        if (x->x_waitfor == o)
+        if (x->x_waitfor != o)
+        {
+            xp = &x->x_waitnext;
+            continue;
+        }
+        *xp = x->x_waitnext;
+        x->x_waitnext = nullptr;
+        x->x_waitfor = nullptr;
+        --n_waiters;
+#ifdef ICI_HAS_UCONTEXT
+        if (x->x_task != nullptr && x->x_task->t_waiting)
         {
-            x->x_waitfor = nullptr;
-            x->x_semaphore->notify_all();
+            x->x_task->t_waiting = false;
+            make_ready(x);
+            continue;
         }
+#endif
+        x->x_semaphore->notify_all();
     }
     return 0;
 }
 
 /*
- * Entry point for a new thread. The passed argument is the pointer
- * to the execution context (ex_t *). It has one ref count that is
- * now considered to be owned by this function. The operand stack
- * of the new context has the ICI function to be called configured on
- * it.
+ * Run a thread started by go(), x, to completion. x has one ref count
+ * that is now considered to be owned by this function. The operand
+ * stack of x has the ICI function to be called configured on it.
+ * Returns with the ICI mutex held.
  */
-static void ici_thread_base(void *arg)
+static void run_thread(exec *x)
 {
-    exec *x = (exec *)arg;
-    int   n_ops;
+    int n_ops;
 
     enter(x);
     n_ops = os.a_top - os.a_base;
@@ -258,8 +624,84 @@ static void ici_thread_base(void *arg)
     }
     wakeup(x);
     decref(x);
+}
+
+#ifdef ICI_HAS_UCONTEXT
+/*
+ * Entry point for a task. The exec's address is passed in two halves
+ * as makecontext() only passes ints.
+ */
+static void task_base(unsigned int lo, unsigned int hi)
+{
+    exec *x = (exec *)((uintptr_t)hi << 16 << 16 | lo);
+    task *t = x->x_task;
+
+    run_thread(x);
+    x->x_task = nullptr;
+    (void)leave_locked();
+    switch_to_carrier(t, TA_EXIT);
+}
+
+/*
+ * Make x, set up as for run_thread(), a task and queue it to run.
+ * Returns non-zero on error, usual conventions.
+ */
+static int start_task(exec *x)
+{
+    task *t;
+
+    if (sched == nullptr)
+    {
+        sched = new scheduler;
+    }
+    if ((t = new (std::nothrow) task()) == nullptr)
+    {
+        return set_error("ran out of memory");
+    }
+    {
+        std::lock_guard<std::mutex> lock(sched->s_mutex);
+        if (!sched->s_stacks.empty())
+        {
+            t->t_stack = sched->s_stacks.back();
+            sched->s_stacks.pop_back();
+        }
+    }
+    if (t->t_stack == nullptr)
+    {
+        t->t_stack = mmap(nullptr, task_stack_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (t->t_stack == MAP_FAILED)
+        {
+            delete t;
+            return get_last_errno("mmap", nullptr);
+        }
+        if (mprotect(t->t_stack, task_guard_size, PROT_NONE) != 0)
+        {
+            munmap(t->t_stack, task_stack_size);
+            delete t;
+            return get_last_errno("mprotect", nullptr);
+        }
+    }
+    getcontext(&t->t_context);
+    t->t_context.uc_stack.ss_sp = (char *)t->t_stack + task_guard_size;
+    t->t_context.uc_stack.ss_size = task_stack_size - task_guard_size;
+    t->t_context.uc_link = nullptr;
+    makecontext(&t->t_context, (void (*)())task_base, 2, (unsigned int)(uintptr_t)x,
+                (unsigned int)((uintptr_t)x >> 16 >> 16));
+    x->x_task = t;
+    make_ready(x);
+    return 0;
+}
+#else
+/*
+ * Entry point for a new thread.
+ */
+static void ici_thread_base(exec *x)
+{
+    run_thread(x);
     (void)leave();
 }
+#endif
 
 /*
  * From ICI: exec = go(callable, arg1, arg2, ...)
@@ -311,11 +753,19 @@ static int f_go(...)
      * it's own reference.
      */
     incref(x);
+#ifdef ICI_HAS_UCONTEXT
+    if (start_task(x))
+    {
+        decref(x);
+        goto fail;
+    }
+#else
     {
         // TODO: try/catch
         std::thread t([x]() { ici_thread_base(x); });
         t.detach();
     }
+#endif
     return ret_with_decref(x);
 
 fail:
@@ -323,6 +773,348 @@ fail:
     return 1;
 }
 
+/*
+ * The ICI thread pool used by parmap() and parreduce(). Its threads
+ * are started on first use, each with an exec of its own that it keeps
+ * for its life, and run chunks of the items of the tasks queued on
+ * pool_tasks. Everything here is protected by the ICI mutex.
+ */
+struct pool_task
+{
+    object           *t_fn;
+    array            *t_items;  /* A private copy of the items. */
+    array            *t_out;    /* Results, or one accumulator per chunk. */
+    bool              t_reduce;
+    size_t            t_n;
+    size_t            t_chunk;
+    size_t            t_nchunks;
+    size_t            t_next = 0;   /* The next chunk to be taken. */
+    size_t            t_active = 0; /* Threads running chunks. */
+    bool              t_failed = false;
+    std::string       t_error;
+    std::condition_variable t_idle; /* Signalled when t_active is zero. */
+};
+
+static std::vector<pool_task *>  pool_tasks;
+static std::condition_variable *pool_cv; /* Never freed, see start_pool(). */
+static size_t                   pool_size;
+
+/*
+ * Wait on cv with the ICI mutex released, as waitfor() does.
+ */
+static void pool_wait(std::condition_variable &cv)
+{
+    exec *x = leave_locked();
+#ifdef ICI_HAS_UCONTEXT
+    if (x->x_task != nullptr)
+    {
+        set_blocked(x->x_task, true);
+    }
+#endif
+    {
+        std::unique_lock<std::mutex> lock(ici_mutex, std::adopt_lock);
+        cv.wait(lock);
+#ifdef ICI_HAS_UCONTEXT
+        if (x->x_task != nullptr && x->x_task->t_blocked)
+        {
+            set_blocked(x->x_task, false);
+        }
+#endif
+        keep_critsect_mutex(x, lock);
+    }
+    enter(x);
+}
+
+/*
+ * Run chunk c of task t. In a map each item is replaced by the
+ * function's result. In a reduce the items of the chunk are folded
+ * into its accumulator. Returns non-zero on error, usual conventions.
+ */
+static int pool_run_chunk(pool_task *t, size_t c)
+{
+    const size_t begin = c * t->t_chunk;
+    const size_t end = std::min(t->t_n, begin + t->t_chunk);
+    object     **items = t->t_items->a_base;
+    object      *r;
+
+    if (!t->t_reduce)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (call(t->t_fn, "o=o", &r, items[i]))
+            {
+                return 1;
+            }
+            items[i] = r;
+            decref(r);
+        }
+        return 0;
+    }
+    t->t_out->a_base[c] = items[begin];
+    for (size_t i = begin + 1; i < end; ++i)
+    {
+        if (call(t->t_fn, "o=oo", &r, t->t_out->a_base[c], items[i]))
+        {
+            return 1;
+        }
+        t->t_out->a_base[c] = r;
+        decref(r);
+    }
+    return 0;
+}
+
+/*
+ * Take and run chunks of t until there are none left, or one fails.
+ */
+static void pool_run(pool_task *t)
+{
+    ++t->t_active;
+    while (!t->t_failed && t->t_next < t->t_nchunks)
+    {
+        if (pool_run_chunk(t, t->t_next++) && !t->t_failed)
+        {
+            t->t_failed = true;
+            t->t_error = ex->x_error != nullptr ? ex->x_error : "failed";
+        }
+    }
+    if (--t->t_active == 0)
+    {
+        t->t_idle.notify_all();
+    }
+}
+
+static void pool_worker(exec *x)
+{
+    enter(x);
+    for (;;)
+    {
+        pool_task *t = nullptr;
+        for (auto p : pool_tasks)
+        {
+            if (!p->t_failed && p->t_next < p->t_nchunks)
+            {
+                t = p;
+                break;
+            }
+        }
+        if (t == nullptr)
+        {
+            pool_wait(*pool_cv);
+            continue;
+        }
+        pool_run(t);
+    }
+}
+
+/*
+ * Start the pool, as many threads as parallel_for() uses. The threads
+ * still wait on pool_cv when the program exits, so it isn't freed.
+ */
+static int start_pool()
+{
+    if (pool_cv != nullptr)
+    {
+        return 0;
+    }
+    pool_cv = new std::condition_variable;
+    for (size_t n = nworkers(); pool_size < n; ++pool_size)
+    {
+        exec *x;
+
+        if ((x = new_exec()) == nullptr)
+        {
+            return 1;
+        }
+        x->x_src = ex->x_src;
+        try
+        {
+            std::thread t([x]() { pool_worker(x); });
+            t.detach();
+        }
+        catch (...)
+        {
+            decref(x);
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Run the function over items on the pool and the calling thread,
+ * in chunks, and wait for them to finish. Returns the array of
+ * results, or chunk accumulators, or nullptr on error. It is
+ * not increfed.
+ */
+static array *pool_apply(object *fn, array *items, bool reduce)
+{
+    pool_task t;
+    array    *copy;
+    array    *out;
+    size_t    i;
+
+    if (start_pool())
+    {
+        return nullptr;
+    }
+    t.t_n = items->len();
+    if ((copy = new_array(t.t_n)) == nullptr)
+    {
+        return nullptr;
+    }
+    for (i = 0; i < t.t_n; ++i)
+    {
+        copy->push(items->get(i));
+    }
+    /*
+     * Several chunks per thread so those that start late, or have
+     * slow items, are balanced out by the others.
+     */
+    t.t_chunk = std::max<size_t>(1, t.t_n / ((pool_size + 1) * 4));
+    t.t_nchunks = (t.t_n + t.t_chunk - 1) / t.t_chunk;
+    out = copy;
+    if (reduce)
+    {
+        if ((out = new_array(t.t_nchunks)) == nullptr)
+        {
+            decref(copy);
+            return nullptr;
+        }
+        for (i = 0; i < t.t_nchunks; ++i)
+        {
+            out->push(null);
+        }
+    }
+    t.t_fn = fn;
+    t.t_items = copy;
+    t.t_out = out;
+    t.t_reduce = reduce;
+
+    pool_tasks.push_back(&t);
+    pool_cv->notify_all();
+    pool_run(&t);
+    pool_tasks.erase(std::find(pool_tasks.begin(), pool_tasks.end(), &t));
+    while (t.t_active != 0)
+    {
+        pool_wait(t.t_idle);
+    }
+
+    decref(copy);
+    if (reduce)
+    {
+        decref(out);
+    }
+    if (t.t_failed)
+    {
+        set_error("%s", t.t_error.c_str());
+        return nullptr;
+    }
+    return out;
+}
+
+/*
+ * array = parmap(array, callable)
+ *
+ * Return an array of the results of calling the callable with each
+ * element of the array, in order. The calls are made, a chunk of
+ * elements at a time, by the threads of the ICI thread pool and the
+ * calling thread. Unlike go(), the pool's threads are started once,
+ * so this suits many small calls. The callable should not depend on
+ * the order the calls are made. If any fails, parmap fails with its
+ * error.
+ */
+static int f_parmap(...)
+{
+    array  *items;
+    object *fn;
+    array  *out;
+
+    if (typecheck("ao", &items, &fn))
+    {
+        return 1;
+    }
+    if (!fn->can_call())
+    {
+        return argerror(1);
+    }
+    if ((out = pool_apply(fn, items, false)) == nullptr)
+    {
+        return 1;
+    }
+    return ret_no_decref(out);
+}
+
+/*
+ * any = parreduce(array, callable [, initial])
+ *
+ * Combine the elements of the array with the callable, of two
+ * arguments, as parmap() runs calls. Each thread reduces a contiguous
+ * chunk of the elements and the chunk results are then combined in
+ * order, so the callable must be associative, but needn't commute.
+ * The initial value, if given, is combined with the first. Returns
+ * the initial value, or NULL, if the array is empty.
+ */
+static int f_parreduce(...)
+{
+    array  *items;
+    object *fn;
+    object *acc;
+    object *r;
+    array  *out;
+
+    switch (NARGS())
+    {
+    case 2:
+        if (typecheck("ao", &items, &fn))
+        {
+            return 1;
+        }
+        acc = nullptr;
+        break;
+
+    case 3:
+        if (typecheck("aoo", &items, &fn, &acc))
+        {
+            return 1;
+        }
+        break;
+
+    default:
+        return argcount(2);
+    }
+    if (!fn->can_call())
+    {
+        return argerror(1);
+    }
+    if (items->len() == 0)
+    {
+        return ret_no_decref(acc != nullptr ? acc : null);
+    }
+    if ((out = pool_apply(fn, items, true)) == nullptr)
+    {
+        return 1;
+    }
+    incref(out);
+    for (object **p = out->a_base; p < out->a_top; ++p)
+    {
+        if (acc == nullptr)
+        {
+            acc = *p;
+            continue;
+        }
+        if (call(fn, "o=oo", &r, acc, *p))
+        {
+            decref(out);
+            return 1;
+        }
+        out->a_base[0] = r;
+        decref(r);
+        acc = r;
+    }
+    decref(out);
+    return ret_no_decref(acc);
+}
+
 static int f_wakeup(...)
 {
     if (NARGS() != 1)
@@ -339,6 +1131,8 @@ static int f_wakeup(...)
 ICI_DEFINE_CFUNCS(thread)
 {
     ICI_DEFINE_CFUNC(go, f_go),
+    ICI_DEFINE_CFUNC(parmap, f_parmap),
+    ICI_DEFINE_CFUNC(parreduce, f_parreduce),
     ICI_DEFINE_CFUNC(wakeup, f_wakeup),
     ICI_CFUNCS_END()
 };
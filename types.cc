@@ -1,5 +1,6 @@
 #define ICI_CORE
 #include "types.h"
+#include "archive.h"
 #include "array.h"
 #include "catcher.h"
 #include "cfunc.h"
@@ -19,8 +20,10 @@
 #include "op.h"
 #include "parse.h"
 #include "pc.h"
+#include "pmap.h"
 #include "profile.h"
 #include "ptr.h"
+#include "pvec.h"
 #include "re.h"
 #include "set.h"
 #include "src.h"
@@ -70,6 +73,12 @@ type *types[max_types] =
     instanceof<channel_type>(),
     instanceof <vec32f_type>(),
     instanceof <vec64f_type>(),
+    instanceof<archive_type>(),
+    instanceof<pmap_type>(),
+    instanceof<pset_type>(),
+    instanceof<pvec_type>(),
+    instanceof<pnode_type>(),
+    instanceof<pvnode_type>(),
     nullptr
 };
 
@@ -85,6 +85,7 @@ void uninit()
     /* Call uninitialisation functions for compulsory bits of ICI. */
     uninit_compile();
     uninit_cfunc();
+    uninit_userop();
 
     /*
      * Do a GC to free things that might require reference to the
@@ -3,15 +3,83 @@
 #include "cfunc.h"
 #include "func.h"
 #include "fwd.h"
+#include "handle.h"
 #include "map.h"
 #include "null.h"
 #include "str.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace ici
 {
 
 map *userops = nullptr;
 
+/*
+ * The dispatch cache. Operators are defined by type names so the
+ * first lookup of a combination of operand types and operator
+ * resolves the names, as lookup_user_binop(), and caches the result,
+ * which may be that there is no operator. Entries are keyed by the
+ * operand types' keys, see type_key(), and the op code. Defining an
+ * operator empties the cache.
+ */
+struct binop_cache_entry
+{
+    uintptr_t c_lhs;
+    uintptr_t c_rhs;
+    int       c_op; /* -1 if unused */
+    object   *c_fn; /* nullptr if there is no operator */
+};
+
+constexpr size_t binop_cache_size = 256;
+
+static binop_cache_entry binop_cache[binop_cache_size];
+
+/*
+ * The handle names used as keys in the dispatch cache. Each holds
+ * one reference, however many entries use it, so its address stays
+ * a valid key. There are as many as there are types of named handle
+ * used with operators, so few.
+ */
+static std::vector<str *> binop_key_names;
+
+/*
+ * Return the key of the type of o for the dispatch cache. This is the
+ * type code, other than for named handles which have their name, a
+ * str, see binop_key_names. Type codes are less than 256 so they
+ * can't be confused with pointers.
+ */
+static uintptr_t type_key(object *o)
+{
+    if (ishandle(o) && handleof(o)->h_name != nullptr)
+    {
+        return uintptr_t(handleof(o)->h_name);
+    }
+    return o->o_tcode;
+}
+
+static void hold_key(uintptr_t k)
+{
+    if (k > 0xFF)
+    {
+        auto s = reinterpret_cast<str *>(k);
+        if (std::find(binop_key_names.begin(), binop_key_names.end(), s) == binop_key_names.end())
+        {
+            incref(s);
+            binop_key_names.push_back(s);
+        }
+    }
+}
+
+static void clear_binop_cache()
+{
+    for (auto &e : binop_cache)
+    {
+        e.c_op = -1;
+    }
+}
+
 static str *make_key(const char *t1, const char *binop, const char *t2)
 {
     char      buf[100]; // really 30 _ max(binop_name) + 30
@@ -19,7 +87,7 @@ static str *make_key(const char *t1, const char *binop, const char *t2)
     return new_str(buf, n);
 }
 
-int define_user_binop(const char *t1, const char *binop, const char *t2, func *fn)
+int define_user_binop(const char *t1, const char *binop, const char *t2, object *fn)
 {
     if (!userops)
     {
@@ -27,13 +95,22 @@ int define_user_binop(const char *t1, const char *binop, const char *t2, func *f
         {
             return 1;
         }
+        for (auto &e : binop_cache)
+        {
+            e.c_op = -1;
+        }
     }
 
     ref<str> k = make_key(t1, binop, t2);
-    return userops->assign(k, fn);
+    if (userops->assign(k, fn))
+    {
+        return 1;
+    }
+    clear_binop_cache();
+    return 0;
 }
 
-func *lookup_user_binop(const char *t1, const char *binop, const char *t2)
+object *lookup_user_binop(const char *t1, const char *binop, const char *t2)
 {
     if (!userops)
     {
@@ -46,16 +123,54 @@ func *lookup_user_binop(const char *t1, const char *binop, const char *t2)
         {
             return nullptr;
         }
-        if (isfunc(r))
+        if (isfunc(r) || iscfunc(r))
         {
-            return funcof(r);
+            return r;
         }
-        set_error("%*s is %s, not a string", k->s_nchars, k->s_chars, r->icitype()->name);
+        set_error("%*s is %s, not a function", k->s_nchars, k->s_chars, r->icitype()->name);
     }
     return nullptr;
 }
 
-object *call_user_binop(func *fn, object *lhs, object *rhs)
+object *find_user_binop(object *lhs, int op, object *rhs)
+{
+    if (!userops)
+    {
+        return nullptr;
+    }
+    const auto k0 = type_key(lhs);
+    const auto k1 = type_key(rhs);
+    auto      &e = binop_cache[(k0 * 31 + k1 * 7 + unsigned(op)) % binop_cache_size];
+    if (e.c_op == op && e.c_lhs == k0 && e.c_rhs == k1)
+    {
+        return e.c_fn;
+    }
+    auto fn = lookup_user_binop(binop_type_name(lhs), binop_name(op), binop_type_name(rhs));
+    hold_key(k0);
+    hold_key(k1);
+    e.c_lhs = k0;
+    e.c_rhs = k1;
+    e.c_op = op;
+    e.c_fn = fn;
+    return fn;
+}
+
+void uninit_userop()
+{
+    clear_binop_cache();
+    for (auto s : binop_key_names)
+    {
+        decref(s);
+    }
+    binop_key_names.clear();
+    if (userops != nullptr)
+    {
+        decref(userops);
+        userops = nullptr;
+    }
+}
+
+object *call_user_binop(object *fn, object *lhs, object *rhs)
 {
     object *o;
     if (call(fn, "o=oo", &o, lhs, rhs))
@@ -65,16 +180,25 @@ object *call_user_binop(func *fn, object *lhs, object *rhs)
     return o;
 }
 
+const char *binop_type_name(object *o)
+{
+    if (ishandle(o) && handleof(o)->h_name != nullptr)
+    {
+        return handleof(o)->h_name->s_chars;
+    }
+    return o->icitype()->name;
+}
+
 int f_binop()
 {
     char *t1, *binop, *t2;
-    func *fn;
+    object *fn;
 
     if (typecheck("ssso", &t1, &binop, &t2, &fn))
     {
         return 1;
     }
-    if (!isfunc(fn))
+    if (!isfunc(fn) && !iscfunc(fn))
     {
         return argerror(3);
     }
@@ -17,16 +17,24 @@ namespace ici
  * be called to implement an operator defined by the types and
  * operator given as arguments.
  *
- * It is not possible to implement defined operators, e.g. "int + int"
- * (an implementation artefact, user operators being used when other
- * operator combinations have not been matched).
+ * User operators are used when other operator combinations have not
+ * been matched so it is not, in general, possible to re-define the
+ * built-in operators. The exception is the integer arithmetic
+ * operators, "int + int", "int - int", "int * int" and "int / int"
+ * (and their assigning forms, "int += int" etc.). When the result of
+ * one of these overflows a user operator for it, if defined, is
+ * called to produce the result. Without one the result wraps.
  *
  * Arguments are:
  *
  *      type1   The ici type name of the LHS
  *      binop   The operaor string (ref binop_name() [arith.cc])
  *      type2   The ici type name of the RHS
- *      fn      The function called to perform the operation.
+ *      fn      The function called to perform the operation, an
+ *              ICI func or a cfunc.
+ *
+ * The type name of a handle is its name, as given to new_handle(),
+ * if it has one. See binop_type_name().
  *
  * Operator functions are called with the two "sides" as arguments,
  * left then right as per-convention. The function's result is the
@@ -36,19 +44,48 @@ namespace ici
  *
  * Returns 0 for success, non-zero for failure, usual conventions.
  */
-int define_user_binop(const char *, const char *, const char *, func *);
+int define_user_binop(const char *, const char *, const char *, object *);
 
 /*
  * Lookup a user-defined operator given the type1/binop/type2 arguments
  * used to define it. Returns nullptr if no function is found.
  */
-func *lookup_user_binop(const char *, const char *, const char *);
+object *lookup_user_binop(const char *, const char *, const char *);
+
+/*
+ * Return the user-defined operator for the operator op, an op code
+ * as given to binop_name(), applied to lhs and rhs, or nullptr if
+ * there is none. Unlike lookup_user_binop() this caches its result
+ * by the types of the operands so repeated operations, including
+ * those with no operator, don't look up the names each time.
+ */
+object *find_user_binop(object *, int, object *);
 
 /*
  * Call the user-defined binop function and return the result
- * or nullptr upon failure, usual conventions.
+ * or nullptr upon failure, usual conventions. The result has
+ * been increfed.
  */
-object *call_user_binop(func *, object *, object *);
+object *call_user_binop(object *, object *, object *);
+
+/*
+ * Return the type name used to look up user-defined operators
+ * for the object o. This is the name of its type other than for
+ * named handles which use their name.
+ */
+const char *binop_type_name(object *);
+
+/*
+ * Return true if user-defined operators are consulted for
+ * the equality operators, == and !=, when given the object o.
+ * The equality of built-in types is always decided by the
+ * built-in comparison so we avoid looking up operators for
+ * the most common comparisons.
+ */
+inline bool has_user_equality(object *o)
+{
+    return o->o_tcode == TC_HANDLE || o->o_tcode > TC_MAX_CORE;
+}
 
 /*
  * End of ici.h export. --ici.h-end--
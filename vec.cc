@@ -8,6 +8,7 @@
 #include "map.h"
 #include "null.h"
 #include "str.h"
+#include "workers.h"
 
 #ifdef ICI_VEC_USE_IPP
 #include <ippcore.h>
@@ -64,143 +65,117 @@ template <typename vec_type> inline size_t vecmemuse(vec_type *vec)
 namespace ici
 {
 
-template struct vec<TC_VEC32F, float>;
-template struct vec<TC_VEC64F, double>;
+/*
+ * Vecs of at least twice this many elements are filled and operated
+ * on in pieces, of at least this many elements, on the worker threads,
+ * see parallel_for(). Smaller ones aren't worth handing off.
+ */
+constexpr size_t vec_grain = 64 * 1024;
 
+// The element-wise kernels applied to each piece.
+//
 #ifdef ICI_VEC_USE_IPP
-template <> void vec<TC_VEC32F, float>::fill(float value, size_t ofs, size_t lim)
-{
-    ippsSet_32f(value, &v_ptr[ofs], lim - ofs);
-    v_size = lim;
-}
-
-template <> void vec<TC_VEC32F, float>::fill(float value, size_t ofs)
-{
-    fill(value, ofs, v_capacity);
-}
-
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator=(float value)
-{
-    fill(value);
-    return *this;
-}
-
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator+=(const vec &rhs)
+inline void vec_set(float v, float *d, size_t n)
 {
-    ippsAdd_32f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator-=(const vec &rhs)
-{
-    ippsSub_32f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator*=(const vec &rhs)
-{
-    ippsMul_32f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator/=(const vec &rhs)
-{
-    ippsDiv_32f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
+    ippsSet_32f(v, d, int(n));
 }
-
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator+=(value_type value)
+inline void vec_set(double v, double *d, size_t n)
 {
-    ippsAddC_32f_I(value, v_ptr, v_size);
-    return *this;
+    ippsSet_64f(v, d, int(n));
 }
 
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator-=(value_type value)
+#define define_vec_kernels(NAME, OP, IPPNAME)                                                                          \
+    inline void NAME(const float *s, float *d, size_t n)                                                               \
+    {                                                                                                                  \
+        ipps##IPPNAME##_32f_I(s, d, int(n));                                                                           \
+    }                                                                                                                  \
+    inline void NAME(const double *s, double *d, size_t n)                                                             \
+    {                                                                                                                  \
+        ipps##IPPNAME##_64f_I(s, d, int(n));                                                                           \
+    }                                                                                                                  \
+    inline void NAME(float v, float *d, size_t n)                                                                      \
+    {                                                                                                                  \
+        ipps##IPPNAME##C_32f_I(v, d, int(n));                                                                          \
+    }                                                                                                                  \
+    inline void NAME(double v, double *d, size_t n)                                                                    \
+    {                                                                                                                  \
+        ipps##IPPNAME##C_64f_I(v, d, int(n));                                                                          \
+    }
+#else
+template <typename T> inline void vec_set(T v, T *d, size_t n)
 {
-    ippsSubC_32f_I(value, v_ptr, v_size);
-    return *this;
+    for (size_t i = 0; i < n; ++i)
+    {
+        d[i] = v;
+    }
 }
 
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator*=(value_type value)
-{
-    ippsMulC_32f_I(value, v_ptr, v_size);
-    return *this;
-}
+#define define_vec_kernels(NAME, OP, IPPNAME)                                                                          \
+    template <typename T> inline void NAME(const T *s, T *d, size_t n)                                                 \
+    {                                                                                                                  \
+        for (size_t i = 0; i < n; ++i)                                                                                 \
+        {                                                                                                              \
+            d[i] OP s[i];                                                                                              \
+        }                                                                                                              \
+    }                                                                                                                  \
+    template <typename T> inline void NAME(T v, T *d, size_t n)                                                        \
+    {                                                                                                                  \
+        for (size_t i = 0; i < n; ++i)                                                                                 \
+        {                                                                                                              \
+            d[i] OP v;                                                                                                 \
+        }                                                                                                              \
+    }
+#endif
 
-template <> vec<TC_VEC32F, float> &vec<TC_VEC32F, float>::operator/=(value_type value)
-{
-    ippsDivC_32f_I(value, v_ptr, v_size);
-    return *this;
-}
+define_vec_kernels(vec_add, +=, Add)
+define_vec_kernels(vec_sub, -=, Sub)
+define_vec_kernels(vec_mul, *=, Mul)
+define_vec_kernels(vec_div, /=, Div)
 
-// TC_VEC64F -------------------------------------------------------
+#undef define_vec_kernels
 
-template <> void vec<TC_VEC64F, double>::fill(double value, size_t ofs, size_t lim)
+template <int TC, typename T> void vec<TC, T>::fill(value_type value, size_t ofs, size_t lim)
 {
-    ippsSet_64f(value, &v_ptr[ofs], lim - ofs);
+    const auto d = v_ptr + ofs;
+    parallel_for(lim - ofs, vec_grain, [d, value](size_t b, size_t e) { vec_set(value, d + b, e - b); });
     v_size = lim;
 }
 
-template <> void vec<TC_VEC64F, double>::fill(double value, size_t ofs)
+template <int TC, typename T> void vec<TC, T>::fill(value_type value, size_t ofs)
 {
     fill(value, ofs, v_capacity);
 }
 
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator=(double value)
+template <int TC, typename T> vec<TC, T> &vec<TC, T>::operator=(value_type value)
 {
     fill(value);
     return *this;
 }
 
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator+=(const vec &rhs)
-{
-    ippsAdd_64f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator-=(const vec &rhs)
-{
-    ippsSub_64f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator*=(const vec &rhs)
-{
-    ippsMul_64f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator/=(const vec &rhs)
-{
-    ippsDiv_64f_I(rhs.v_ptr, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator+=(value_type value)
-{
-    ippsAddC_64f_I(value, v_ptr, v_size);
-    return *this;
-}
-
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator-=(value_type value)
-{
-    ippsSubC_64f_I(value, v_ptr, v_size);
-    return *this;
-}
+#define define_vec_ops(OP, KERNEL)                                                                                     \
+    template <int TC, typename T> vec<TC, T> &vec<TC, T>::operator OP(const vec &rhs)                                  \
+    {                                                                                                                  \
+        const auto d = v_ptr;                                                                                          \
+        const auto s = rhs.v_ptr;                                                                                      \
+        parallel_for(v_size, vec_grain, [d, s](size_t b, size_t e) { KERNEL(s + b, d + b, e - b); });                  \
+        return *this;                                                                                                  \
+    }                                                                                                                  \
+    template <int TC, typename T> vec<TC, T> &vec<TC, T>::operator OP(value_type value)                                \
+    {                                                                                                                  \
+        const auto d = v_ptr;                                                                                          \
+        parallel_for(v_size, vec_grain, [d, value](size_t b, size_t e) { KERNEL(value, d + b, e - b); });              \
+        return *this;                                                                                                  \
+    }
 
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator*=(value_type value)
-{
-    ippsMulC_64f_I(value, v_ptr, v_size);
-    return *this;
-}
+define_vec_ops(+=, vec_add)
+define_vec_ops(-=, vec_sub)
+define_vec_ops(*=, vec_mul)
+define_vec_ops(/=, vec_div)
 
-template <> vec<TC_VEC64F, double> &vec<TC_VEC64F, double>::operator/=(value_type value)
-{
-    ippsDivC_64f_I(value, v_ptr, v_size);
-    return *this;
-}
+#undef define_vec_ops
 
-#endif // ICI_VEC_USE_IPP
+template struct vec<TC_VEC32F, float>;
+template struct vec<TC_VEC64F, double>;
 
 namespace
 {
@@ -249,6 +224,28 @@ template <typename vec_type> vec_type *new_vec(size_t capacity, size_t size, obj
     return v;
 }
 
+//  Create a vec whose data is owned by some other object, e.g. the
+//  mapping of an indexed archive. The vec references the owner to
+//  keep the data alive and does not free it.
+//
+template <typename vec_type>
+vec_type *new_vec(typename vec_type::value_type *ptr, size_t size, object *props, object *owner)
+{
+    auto v = ici_talloc<vec_type>();
+    if (!v)
+    {
+        return nullptr;
+    }
+    v->set_tfnz(vec_type::type_code, 0, 1, 0);
+    v->v_ptr = ptr;
+    v->v_capacity = size;
+    v->v_size = size;
+    v->v_props = mapof(props);
+    v->v_parent = owner;
+    rego(v);
+    return v;
+}
+
 // Create a vec that is a copy of some other vec.
 //
 template <typename vec_type> vec_type *new_vec(vec_type *other)
@@ -437,7 +434,10 @@ template <typename vec_type> int assign_vec(vec_type *f, object *k, object *v)
         {
             (*f)[ofs] = static_cast<value_type>(floatof(v)->f_value);
         }
-        ++f->v_size;
+        if (f->v_size == static_cast<size_t>(ofs))
+        {
+            ++f->v_size;
+        }
         return 0;
     }
 
@@ -520,18 +520,17 @@ template <typename vec_type> int save_vec(archiver *ar, vec_type *f)
     {
         return 1;
     }
-    for (size_t i = 0; i < f->v_size; ++i)
+    if (ar->align(sizeof *f->v_ptr))
     {
-        if (ar->write(f->v_ptr[i]))
-        {
-            return 1;
-        }
+        return 1;
     }
-    return 0;
+    return ar->write(f->v_ptr, f->v_size);
 }
 
 template <typename vec_type> object *restore_vec(archiver *ar)
 {
+    using value_type = typename vec_type::value_type;
+
     object *oname;
     int64_t capacity;
     int64_t size;
@@ -564,19 +563,32 @@ template <typename vec_type> object *restore_vec(archiver *ar)
         set_error("size greater than capacity");
         return nullptr;
     }
-    auto f = make_ref(new_vec<vec_type>(capacity, size, props));
-    if (ar->record(oname, f))
+    if (ar->align(sizeof(value_type)))
     {
         return nullptr;
     }
-    for (size_t i = 0; i < f->v_size; ++i)
+    if (size == capacity)
     {
-        if (ar->read(&f->v_ptr[i]))
+        if (auto p = ar->mapped(size * sizeof(value_type)))
         {
-            return nullptr;
+            auto f = make_ref(new_vec<vec_type>(static_cast<value_type *>(p), size, props, ar->owner()));
+            if (!f || ar->record(oname, f))
+            {
+                return nullptr;
+            }
+            return f.release();
         }
     }
-    return f;
+    auto f = make_ref(new_vec<vec_type>(capacity, size, props));
+    if (ar->record(oname, f))
+    {
+        return nullptr;
+    }
+    if (ar->read(f->v_ptr, f->v_size))
+    {
+        return nullptr;
+    }
+    return f.release();
 }
 
 } // namespace
@@ -84,7 +84,7 @@ template <int TYPE_CODE, typename VALUE_TYPE> struct vec : object
     size_t      v_size;     // current length
     size_t      v_capacity; // total capacity
     map        *v_props;    // user-defined properties
-    vec        *v_parent;   // parent vec (iff this is a slice)
+    object     *v_parent;   // owner of v_ptr's data (iff a slice or mapped)
 
     vec(const vec &) = delete;
     vec &operator=(const vec &) = delete;
@@ -118,32 +118,14 @@ template <int TYPE_CODE, typename VALUE_TYPE> struct vec : object
         }
     }
 
-#ifdef ICI_VEC_USE_IPP
+    /*
+     * The fill and arithmetic operations are implemented in vec.cc,
+     * with IPP if ICI_VEC_USE_IPP is defined. Large vecs are processed
+     * in pieces on the worker threads, see parallel_for().
+     */
     void fill(value_type, size_t, size_t);
     void fill(value_type, size_t = 0);
     vec &operator=(value_type);
-#else
-    void fill(value_type value, size_t ofs, size_t lim)
-    {
-        for (size_t i = ofs; i < lim; ++i)
-        {
-            v_ptr[i] = value;
-        }
-        v_size = lim;
-    }
-
-    void fill(value_type value, size_t ofs = 0)
-    {
-        fill(value, ofs, v_capacity);
-    }
-
-    vec &operator=(value_type value)
-    {
-        fill(value);
-        return *this;
-    }
-
-#endif
 
     const value_type &operator[](size_t index) const
     {
@@ -155,29 +137,8 @@ template <int TYPE_CODE, typename VALUE_TYPE> struct vec : object
         return v_ptr[index];
     }
 
-#ifdef ICI_VEC_USE_IPP
 #define define_vec_binop_vec(OP) vec &operator OP(const vec &);
 #define define_vec_binop_scalar(OP) vec &operator OP(value_type);
-#else
-#define define_vec_binop_vec(OP)                                                                                       \
-    vec &operator OP(const vec &rhs)                                                                                   \
-    {                                                                                                                  \
-        for (size_t index = 0; index < v_size; ++index)                                                                \
-        {                                                                                                              \
-            v_ptr[index] OP rhs[index];                                                                                \
-        }                                                                                                              \
-        return *this;                                                                                                  \
-    }
-#define define_vec_binop_scalar(OP)                                                                                    \
-    vec &operator OP(value_type scalar)                                                                                \
-    {                                                                                                                  \
-        for (size_t index = 0; index < v_size; ++index)                                                                \
-        {                                                                                                              \
-            v_ptr[index] OP scalar;                                                                                    \
-        }                                                                                                              \
-        return *this;                                                                                                  \
-    }
-#endif
 
     define_vec_binop_vec(+=)
     define_vec_binop_vec(-=)
@@ -39,7 +39,7 @@
             FAIL();                                     \
         }                                               \
         (*VECOF(o)) OP intof(o1)->i_value;              \
-        USEo();
+        LOOSEo();
 
 #define VEC_FLOAT_BINOP(VEC, NEWVEC, VECOF, BINOP, OP)  \
     case ICI_TRI(VEC, TC_FLOAT, BINOP):                 \
@@ -48,7 +48,7 @@
             FAIL();                                     \
         }                                               \
         (*VECOF(o)) OP floatof(o1)->f_value;            \
-        USEo();
+        LOOSEo();
 
 #define INT_VEC_BINOP(VEC, NEWVEC, VECOF, BINOP, OP)    \
     case ICI_TRI(TC_INT, VEC, BINOP):                   \
@@ -57,7 +57,7 @@
             FAIL();                                     \
         }                                               \
         (*VECOF(o)) OP intof(o0)->i_value;              \
-        USEo();
+        LOOSEo();
 
 #define FLOAT_VEC_BINOP(VEC, NEWVEC, VECOF, BINOP, OP)  \
     case ICI_TRI(TC_FLOAT, VEC, BINOP):                 \
@@ -66,7 +66,7 @@
             FAIL();                                     \
         }                                               \
         (*VECOF(o)) OP floatof(o0)->f_value;            \
-        USEo();
+        LOOSEo();
 
 #define VEC_OPS(VEC, NEWVEC, VECOF)                     \
                                                         \
@@ -0,0 +1,184 @@
+#define ICI_CORE
+#include "workers.h"
+#include "exec.h"
+#include "fwd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace ici
+{
+
+namespace
+{
+
+/*
+ * A parallel_for() in progress. It lives on its caller's stack and is
+ * queued until all of its pieces have been taken. j_active counts the
+ * workers using it, its caller waits for that to reach zero, after
+ * removing it from the queue, before returning.
+ */
+struct job
+{
+    void (*j_fn)(void *, size_t, size_t);
+    void               *j_arg;
+    size_t              j_n;
+    size_t              j_piece;
+    size_t              j_npieces;
+    std::atomic<size_t> j_next{0};
+    std::atomic<size_t> j_done{0};
+    size_t              j_active = 0; /* Protected by p_mutex. */
+
+    /*
+     * Run the next piece, if any. Returns false if there were none.
+     */
+    bool run_piece()
+    {
+        const auto i = j_next.fetch_add(1);
+        if (i >= j_npieces)
+        {
+            return false;
+        }
+        const auto begin = i * j_piece;
+        (*j_fn)(j_arg, begin, std::min(j_n, begin + j_piece));
+        ++j_done;
+        return true;
+    }
+
+    bool finished() const
+    {
+        return j_done == j_npieces && j_active == 0;
+    }
+};
+
+/*
+ * The pool's state is allocated, and never freed, as the workers are
+ * still waiting on it when static destructors run at exit.
+ */
+struct pool
+{
+    std::mutex              p_mutex;
+    std::condition_variable p_work; /* Signalled when a job is queued. */
+    std::condition_variable p_done; /* Signalled when a worker leaves a job. */
+    std::deque<job *>       p_jobs;
+    size_t                  p_size = 0;
+};
+
+pool          *workers;
+std::once_flag workers_started;
+
+void worker()
+{
+    std::unique_lock<std::mutex> lock(workers->p_mutex);
+    for (;;)
+    {
+        workers->p_work.wait(lock, [] { return !workers->p_jobs.empty(); });
+        auto j = workers->p_jobs.front();
+        if (j->j_next >= j->j_npieces)
+        {
+            workers->p_jobs.pop_front();
+            continue;
+        }
+        ++j->j_active;
+        lock.unlock();
+        while (j->run_piece())
+        {
+        }
+        lock.lock();
+        if (--j->j_active == 0)
+        {
+            workers->p_done.notify_all();
+        }
+    }
+}
+
+void start_pool()
+{
+    workers = new pool;
+    size_t n = std::thread::hardware_concurrency();
+    n = n > 1 ? n - 1 : 0;
+    if (const char *p = getenv("ICI_WORKERS"))
+    {
+        n = size_t(strtoul(p, nullptr, 10));
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        try
+        {
+            std::thread(worker).detach();
+        }
+        catch (...)
+        {
+            break;
+        }
+        ++workers->p_size;
+    }
+}
+
+} // namespace
+
+size_t nworkers()
+{
+    std::call_once(workers_started, start_pool);
+    return workers->p_size;
+}
+
+void parallel_for(size_t n, size_t grain, void (*fn)(void *, size_t, size_t), void *arg)
+{
+    if (grain == 0)
+    {
+        grain = 1;
+    }
+    if (n / grain < 2 || nworkers() == 0)
+    {
+        (*fn)(arg, 0, n);
+        return;
+    }
+
+    /*
+     * Several pieces per thread so threads that finish early, or start
+     * late, take a share of the rest.
+     */
+    job j;
+    j.j_fn = fn;
+    j.j_arg = arg;
+    j.j_n = n;
+    j.j_npieces = std::min(n / grain, (workers->p_size + 1) * 4);
+    j.j_piece = (n + j.j_npieces - 1) / j.j_npieces;
+    j.j_npieces = (n + j.j_piece - 1) / j.j_piece;
+
+    /*
+     * The pieces don't touch ICI data, so other ICI threads can run
+     * meanwhile, except in a critical section, where leave() would
+     * release the mutex without enter() taking it again.
+     */
+    exec *x = ex->x_critsect ? nullptr : leave();
+    {
+        std::lock_guard<std::mutex> lock(workers->p_mutex);
+        workers->p_jobs.push_back(&j);
+    }
+    workers->p_work.notify_all();
+    while (j.run_piece())
+    {
+    }
+    {
+        std::unique_lock<std::mutex> lock(workers->p_mutex);
+        auto                        &jobs = workers->p_jobs;
+        auto                         p    = std::find(jobs.begin(), jobs.end(), &j);
+        if (p != jobs.end())
+        {
+            jobs.erase(p);
+        }
+        workers->p_done.wait(lock, [&j] { return j.finished(); });
+    }
+    if (x != nullptr)
+    {
+        enter(x);
+    }
+}
+
+} // namespace ici
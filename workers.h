@@ -0,0 +1,59 @@
+// -*- mode:c++ -*-
+
+#ifndef ICI_WORKERS_H
+#define ICI_WORKERS_H
+
+#include "fwd.h"
+
+namespace ici
+{
+
+/*
+ * The following portion of this file exports to ici.h. --ici.h-start--
+ */
+
+/*
+ * Native worker threads for data-parallel kernels
+ *
+ * parallel_for(n, grain, f) calls f(begin, end) for pieces of the
+ * range [0, n), each of at least grain elements, on a pool of native
+ * worker threads and the calling thread, and returns once all the
+ * pieces are done. The pieces don't overlap and together cover the
+ * range. If the range isn't at least two grains, or there are no
+ * workers, it simply calls f(0, n).
+ *
+ * It is called with the ICI mutex held, as usual, and releases it,
+ * with leave(), while the pieces run so other ICI threads continue,
+ * unless the caller is in a critical section.
+ * f must not use any ICI data, only the plain memory, such as a vec's
+ * values, that it was given. The objects holding that memory must be
+ * reachable, e.g. arguments of the calling function, so they aren't
+ * collected meanwhile.
+ *
+ * The pool is started on first use and has one thread fewer than
+ * the machine has CPUs, or the number given by the ICI_WORKERS
+ * environment variable.
+ */
+void parallel_for(size_t n, size_t grain, void (*fn)(void *, size_t, size_t), void *arg);
+
+template <typename F>
+inline void parallel_for(size_t n, size_t grain, const F &f)
+{
+    parallel_for(
+        n, grain, [](void *arg, size_t begin, size_t end) { (*static_cast<const F *>(arg))(begin, end); },
+        const_cast<F *>(&f));
+}
+
+/*
+ * The number of native worker threads parallel_for() uses, in
+ * addition to the calling thread.
+ */
+size_t nworkers();
+
+/*
+ * End of ici.h export. --ici.h-end--
+ */
+
+} // namespace ici
+
+#endif /* ICI_WORKERS_H */